@@ -0,0 +1,254 @@
+#include "dump_file.hpp"
+#include <cstring>
+#include <algorithm>
+
+
+using namespace std;
+
+#define FNV_OFFSET_BASIS    0xcbf29ce484222325ULL
+#define FNV_PRIME           0x100000001b3ULL
+
+
+static uint64_t fnv1a(uint64_t hash, const uint8_t* data, uint32_t size)
+{
+    for (uint32_t i=0; i<size; ++i){
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+
+static void put_le(uint8_t* p, uint64_t value, uint32_t size)
+{
+    for (uint32_t i=0; i<size; ++i){
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+
+static uint64_t get_le(const uint8_t* p, uint32_t size)
+{
+    uint64_t value = 0;
+    for (uint32_t i=0; i<size; ++i){
+        value |= (uint64_t)p[i] << (8 * i);
+    }
+    return value;
+}
+
+
+DebuggerExecutingState_t DumpFileWriter::open(const char* file_name, ProgramerDumpFormat_t format, uint32_t addr, uint32_t size)
+{
+    if (! (file_name && (format >= 0) && (format < ProgramerDumpFormatCount))){
+        return DebuggerExecutingParamFault;
+    }
+    this->format = format;
+    this->addr = addr;
+    this->size = size;
+    this->appended = 0;
+    this->in_segment = false;
+    this->segments.clear();
+    this->table_offset = 0;
+
+    string suffix = (ProgramerDumpSparse == format)? ".sparse": ".readback";
+    this->file.open(string(file_name) + suffix, ios::binary|ios::out|ios::trunc);
+    if (this->file.fail()){
+        return DebuggerExecutingFileOperationError;
+    }
+    if (ProgramerDumpSparse == format){
+        // placeholder, completed by close()
+        return this->write_header();
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t DumpFileWriter::append(const uint8_t* data, uint32_t size)
+{
+    if (ProgramerDumpRaw == this->format){
+        this->file.write((const char*)data, size);
+        this->appended += size;
+        return this->file.fail()? DebuggerExecutingFileOperationError: DebuggerExecutingNormal;
+    }
+
+    // granule by granule of the target: the scan of an erased one stops at its first byte other than 0xFF
+    uint32_t finish_size = 0;
+    while (finish_size < size)
+    {
+        uint64_t at = this->addr + this->appended;
+        uint32_t tmp_size = min<uint64_t>(size - finish_size, SPARSE_DUMP_GRANULE_B - at % SPARSE_DUMP_GRANULE_B);
+        const uint8_t* piece = data + finish_size;
+        if (! DbgrMemIsFill(piece, tmp_size, 0xff)){
+            if (! this->in_segment){
+                this->segment = SparseDumpSegment_t{(uint32_t)at, 0, (uint64_t)this->file.tellp(), FNV_OFFSET_BASIS};
+                this->in_segment = true;
+            }
+            this->file.write((const char*)piece, tmp_size);
+            this->segment.size += tmp_size;
+            this->segment.hash = fnv1a(this->segment.hash, piece, tmp_size);
+        }
+        else if (this->in_segment){
+            this->segments.push_back(this->segment);
+            this->in_segment = false;
+        }
+        finish_size += tmp_size;
+        this->appended += tmp_size;
+    }
+    return this->file.fail()? DebuggerExecutingFileOperationError: DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t DumpFileWriter::close()
+{
+    DebuggerExecutingState_t stat = DebuggerExecutingNormal;
+
+    if (! this->file.is_open()){
+        return DebuggerExecutingNormal;
+    }
+    if (ProgramerDumpSparse == this->format){
+        if (this->in_segment){
+            this->segments.push_back(this->segment);
+            this->in_segment = false;
+        }
+        this->table_offset = this->file.tellp();
+        uint8_t entry[SPARSE_DUMP_SEGMENT_B];
+        for (auto& segment: this->segments)
+        {
+            put_le(entry, segment.addr, 4);
+            put_le(entry + 4, segment.size, 4);
+            put_le(entry + 8, segment.offset, 8);
+            put_le(entry + 16, segment.hash, 8);
+            this->file.write((const char*)entry, sizeof(entry));
+        }
+        this->file.seekp(0, ios::beg);
+        stat = this->write_header();
+    }
+    this->file.close();
+    if ((DebuggerExecutingNormal == stat) && this->file.fail()){
+        stat = DebuggerExecutingFileOperationError;
+    }
+    return stat;
+}
+
+
+uint32_t DumpFileWriter::segment_count()
+{
+    return this->segments.size();
+}
+
+
+uint64_t DumpFileWriter::stored_bytes()
+{
+    uint64_t count = 0;
+    for (auto& segment: this->segments){
+        count += segment.size;
+    }
+    return count;
+}
+
+
+DebuggerExecutingState_t DumpFileWriter::write_header()
+{
+    uint8_t header[SPARSE_DUMP_HEADER_B];
+    memcpy(header, SPARSE_DUMP_MAGIC, 8);
+    put_le(header + 8, SPARSE_DUMP_VERSION, 4);
+    put_le(header + 12, this->addr, 4);
+    put_le(header + 16, this->size, 4);
+    put_le(header + 20, this->segments.size(), 4);
+    put_le(header + 24, this->table_offset, 8);
+    this->file.write((const char*)header, sizeof(header));
+    return this->file.fail()? DebuggerExecutingFileOperationError: DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t SparseDumpReader::open(const char* file_name)
+{
+    if (! file_name){
+        return DebuggerExecutingParamFault;
+    }
+    this->close();
+    this->file.open(file_name, ios::binary|ios::in);
+    if (this->file.fail()){
+        return DebuggerExecutingFileOperationError;
+    }
+    this->file.seekg(0, ios::end);
+    uint64_t file_size = this->file.tellg();
+    this->file.seekg(0, ios::beg);
+
+    uint8_t header[SPARSE_DUMP_HEADER_B];
+    if ((file_size < sizeof(header)) || (! this->file.read((char*)header, sizeof(header)))
+        || memcmp(header, SPARSE_DUMP_MAGIC, 8) || (SPARSE_DUMP_VERSION != get_le(header + 8, 4))){
+        return DebuggerExecutingFirmwareFileNotSuitable;
+    }
+    this->dump_addr = get_le(header + 12, 4);
+    this->dump_size = get_le(header + 16, 4);
+    uint64_t count = get_le(header + 20, 4);
+    uint64_t table_offset = get_le(header + 24, 8);
+    // an unfinished dump has no table
+    if ((table_offset < sizeof(header)) || (table_offset + count * SPARSE_DUMP_SEGMENT_B != file_size)){
+        return DebuggerExecutingFirmwareFileNotSuitable;
+    }
+
+    uint64_t next_addr = this->dump_addr;
+    uint64_t dump_end = (uint64_t)this->dump_addr + this->dump_size;
+    uint8_t entry[SPARSE_DUMP_SEGMENT_B];
+    this->file.seekg(table_offset, ios::beg);
+    for (uint64_t i=0; i<count; ++i)
+    {
+        if (! this->file.read((char*)entry, sizeof(entry))){
+            return DebuggerExecutingFileOperationError;
+        }
+        SparseDumpSegment_t segment = {(uint32_t)get_le(entry, 4), (uint32_t)get_le(entry + 4, 4), get_le(entry + 8, 8), get_le(entry + 16, 8)};
+        // in address order within the dump, the data before the table
+        if ((0 == segment.size) || (segment.addr < next_addr) || ((uint64_t)segment.addr + segment.size > dump_end)
+            || (segment.offset < sizeof(header)) || (segment.offset + segment.size > table_offset)){
+            this->table.clear();
+            return DebuggerExecutingFirmwareFileNotSuitable;
+        }
+        next_addr = (uint64_t)segment.addr + segment.size;
+        this->table.push_back(segment);
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+uint32_t SparseDumpReader::addr()
+{
+    return this->dump_addr;
+}
+
+
+uint32_t SparseDumpReader::size()
+{
+    return this->dump_size;
+}
+
+
+const std::vector<SparseDumpSegment_t>& SparseDumpReader::segments()
+{
+    return this->table;
+}
+
+
+DebuggerExecutingState_t SparseDumpReader::read_segment(const SparseDumpSegment_t& segment, std::vector<uint8_t>& data)
+{
+    data.resize(segment.size);
+    this->file.clear();
+    this->file.seekg(segment.offset, ios::beg);
+    if (! this->file.read((char*)data.data(), segment.size)){
+        return DebuggerExecutingFileOperationError;
+    }
+    if (fnv1a(FNV_OFFSET_BASIS, data.data(), segment.size) != segment.hash){
+        return DebuggerExecutingFirmwareFileNotSuitable;
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+void SparseDumpReader::close()
+{
+    if (this->file.is_open()){
+        this->file.close();
+    }
+    this->file.clear();
+    this->table.clear();
+}
@@ -0,0 +1,84 @@
+#ifndef __DUMP_FILE_HPP__
+#define __DUMP_FILE_HPP__
+
+#include "DbgrCommon.h"
+#include <fstream>
+#include <vector>
+#include <string>
+
+
+#define SPARSE_DUMP_MAGIC       "SBLSPARS"
+#define SPARSE_DUMP_VERSION     1
+#define SPARSE_DUMP_HEADER_B    32
+#define SPARSE_DUMP_SEGMENT_B   24
+#define SPARSE_DUMP_GRANULE_B   256     // one Write Memory frame: erased granules of the target are not stored
+
+
+/* output format of dump */
+typedef enum{
+    ProgramerDumpRaw = 0,               // every byte, file_name.readback
+    ProgramerDumpSparse,                // the not erased granules only, file_name.sparse
+    ProgramerDumpFormatCount,
+}ProgramerDumpFormat_t;
+
+/* one stored range of a sparse dump */
+typedef struct{
+    uint32_t addr;                      // target address
+    uint32_t size;
+    uint64_t offset;                    // of the data in the file
+    uint64_t hash;                      // FNV-1a 64 of the data
+}SparseDumpSegment_t;
+
+
+/*
+    Sparse dump file, little-endian:
+        header      char magic[8] "SBLSPARS", u32 version, u32 addr, u32 size, u32 segment count, u64 table offset
+        data        the bytes of the segments, back to back
+        table       per segment: u32 addr, u32 size, u64 data offset, u64 hash
+    Segments are runs of SPARSE_DUMP_GRANULE_B granules of the target holding a byte other than 0xFF, in address
+    order; the bytes of [addr, addr + size) outside them are 0xFF. The header is completed last: a dump that failed
+    has table offset 0.
+*/
+class DumpFileWriter
+{
+public:
+    DebuggerExecutingState_t open(const char* file_name, ProgramerDumpFormat_t format, uint32_t addr, uint32_t size);
+    DebuggerExecutingState_t append(const uint8_t* data, uint32_t size);   // the next bytes of the dump
+    DebuggerExecutingState_t close();
+    uint32_t segment_count();
+    uint64_t stored_bytes();
+
+private:
+    DebuggerExecutingState_t write_header();
+
+private:
+    std::ofstream file;
+    ProgramerDumpFormat_t format = ProgramerDumpRaw;
+    uint32_t addr = 0;
+    uint32_t size = 0;
+    uint64_t appended = 0;
+    bool in_segment = false;
+    SparseDumpSegment_t segment;
+    std::vector<SparseDumpSegment_t> segments;
+    uint64_t table_offset = 0;
+};
+
+
+class SparseDumpReader
+{
+public:
+    DebuggerExecutingState_t open(const char* file_name);     // header and table checked
+    uint32_t addr();
+    uint32_t size();
+    const std::vector<SparseDumpSegment_t>& segments();
+    DebuggerExecutingState_t read_segment(const SparseDumpSegment_t& segment, std::vector<uint8_t>& data);  // hash checked
+    void close();
+
+private:
+    std::ifstream file;
+    uint32_t dump_addr = 0;
+    uint32_t dump_size = 0;
+    std::vector<SparseDumpSegment_t> table;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include <cassert>
+#include <algorithm>
+
+#include "erase_planner.hpp"
+
+
+ErasePlanner::ErasePlanner(uint32_t flash_base, uint32_t page_size, uint32_t page_count)
+{
+    assert(page_size > 0);
+    this->flash_base = flash_base;
+    this->page_size = page_size;
+    this->page_count = page_count;
+}
+
+
+void ErasePlanner::add(uint32_t addr, uint32_t size)
+{
+    uint64_t flash_end = (uint64_t)this->flash_base + (uint64_t)this->page_count * this->page_size;
+    uint64_t start = std::max<uint64_t>(addr, this->flash_base);
+    uint64_t end = std::min<uint64_t>((uint64_t)addr + size, flash_end);
+    if (start >= end){
+        return;
+    }
+    uint32_t first = (start - this->flash_base) / this->page_size;
+    uint32_t last = (end - 1 - this->flash_base) / this->page_size;
+    for (uint32_t page=first; page<=last; ++page){
+        this->page_set.insert(page);
+    }
+}
+
+
+std::vector<uint32_t> ErasePlanner::pages()
+{
+    return std::vector<uint32_t>(this->page_set.begin(), this->page_set.end());
+}
+
+
+std::vector<std::vector<uint32_t>> ErasePlanner::page_lists(uint32_t max_pages)
+{
+    assert(max_pages > 0);
+
+    std::vector<std::vector<uint32_t>> lists;
+    for (uint32_t page: this->page_set)
+    {
+        if (lists.empty() || (lists.back().size() >= max_pages)){
+            lists.emplace_back();
+        }
+        lists.back().push_back(page);
+    }
+    return lists;
+}
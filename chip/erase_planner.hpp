@@ -0,0 +1,29 @@
+#ifndef __ERASE_PLANNER_HPP__
+#define __ERASE_PLANNER_HPP__
+
+#include <set>
+#include <vector>
+#include <cstdint>
+
+
+/*
+    Flash pages to erase before programming images: the pages touched by the image extents,
+    nothing more. Extents outside [flash_base, flash_base + page_count * page_size) are clipped.
+*/
+class ErasePlanner
+{
+public:
+    ErasePlanner(uint32_t flash_base, uint32_t page_size, uint32_t page_count);
+
+    void add(uint32_t addr, uint32_t size);
+    std::vector<uint32_t> pages();                                   // ascending page numbers
+    std::vector<std::vector<uint32_t>> page_lists(uint32_t max_pages);  // the pages cut in lists of max_pages
+
+private:
+    uint32_t flash_base;
+    uint32_t page_size;
+    uint32_t page_count;
+    std::set<uint32_t> page_set;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#include <algorithm>
+
+#include "erased_ranges.hpp"
+
+
+void ErasedRanges::clear()
+{
+    this->ranges.clear();
+}
+
+
+void ErasedRanges::insert(uint64_t start, uint64_t end)
+{
+    if (start >= end){
+        return;
+    }
+    // merge every range overlapping or touching [start, end)
+    auto it = this->ranges.upper_bound(start);
+    if ((it != this->ranges.begin()) && (std::prev(it)->second >= start)){
+        --it;
+    }
+    while ((it != this->ranges.end()) && (it->first <= end))
+    {
+        start = std::min(start, it->first);
+        end = std::max(end, it->second);
+        it = this->ranges.erase(it);
+    }
+    this->ranges[start] = end;
+}
+
+
+void ErasedRanges::remove(uint64_t start, uint64_t end)
+{
+    if (start >= end){
+        return;
+    }
+    auto it = this->ranges.upper_bound(start);
+    if (it != this->ranges.begin()){
+        --it;
+    }
+    while ((it != this->ranges.end()) && (it->first < end))
+    {
+        uint64_t range_start = it->first;
+        uint64_t range_end = it->second;
+        if (range_end <= start){
+            ++it;
+            continue;
+        }
+        it = this->ranges.erase(it);
+        if (range_start < start){
+            this->ranges[range_start] = start;
+        }
+        if (range_end > end){
+            this->ranges[end] = range_end;
+            break;
+        }
+    }
+}
+
+
+bool ErasedRanges::contains(uint64_t start, uint64_t end)
+{
+    if (start >= end){
+        return true;
+    }
+    auto it = this->ranges.upper_bound(start);
+    if (it == this->ranges.begin()){
+        return false;
+    }
+    --it;
+    return (it->first <= start) && (it->second >= end);
+}
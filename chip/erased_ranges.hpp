@@ -0,0 +1,24 @@
+#ifndef __ERASED_RANGES_HPP__
+#define __ERASED_RANGES_HPP__
+
+#include <map>
+#include <cstdint>
+
+
+/*
+    Target address ranges known to be erased: added by a successful erase, removed by any write.
+    Ranges are half-open [start, end), adjacent ranges are merged.
+*/
+class ErasedRanges
+{
+public:
+    void clear();
+    void insert(uint64_t start, uint64_t end);
+    void remove(uint64_t start, uint64_t end);
+    bool contains(uint64_t start, uint64_t end);
+
+private:
+    std::map<uint64_t, uint64_t> ranges;  // start -> end
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "program_journal.hpp"
+#include <sstream>
+#include <cstdio>
+
+
+using namespace std;
+
+#define FNV_OFFSET_BASIS    0xcbf29ce484222325ULL
+#define FNV_PRIME           0x100000001b3ULL
+
+
+ProgramJournal::~ProgramJournal()
+{
+    this->close();
+}
+
+
+uint64_t ProgramJournal::hash_image(std::istream& file, uint32_t offset, uint32_t size)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    char data[4096];
+    uint32_t finish_size = 0;
+
+    file.seekg(offset, ios::beg);
+    while (finish_size < size)
+    {
+        uint32_t tmp_size = min<uint32_t>(size - finish_size, sizeof(data));
+        file.read(data, tmp_size);
+        for (uint32_t i=0; i<tmp_size; ++i){
+            hash = (hash ^ (uint8_t)data[i]) * FNV_PRIME;
+        }
+        finish_size += tmp_size;
+    }
+    return hash;
+}
+
+
+DebuggerExecutingState_t ProgramJournal::open(const char* file_name, const ProgramJournalKey_t& key)
+{
+    if (! file_name){
+        return DebuggerExecutingParamFault;
+    }
+    this->close();
+    this->key = key;
+    this->verified = 0;
+
+    bool exists = false;
+    ifstream old_file(file_name);
+    if (old_file.is_open()){
+        exists = true;
+        string line;
+        while (getline(old_file, line))
+        {
+            string uid;
+            unsigned long long image_hash;
+            unsigned int addr, size, verified;
+            if (line.empty() || ('#' == line[0])){
+                continue;
+            }
+            istringstream fields(line);
+            if (! (fields >> uid >> hex >> image_hash >> addr >> dec >> size >> verified)){
+                continue;
+            }
+            if ((uid == key.uid) && (image_hash == key.image_hash) && (addr == key.addr) && (size == key.size)){
+                this->verified = verified;
+            }
+        }
+        old_file.close();
+    }
+    if (this->verified >= key.size){
+        this->verified = 0;
+    }
+
+    this->file.open(file_name, ios::out|ios::app);
+    if (this->file.fail()){
+        return DebuggerExecutingFileOperationError;
+    }
+    if (! exists){
+        this->file << "# uid image_hash addr size verified\n";
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+bool ProgramJournal::is_open()
+{
+    return this->file.is_open();
+}
+
+
+uint32_t ProgramJournal::progress()
+{
+    return this->verified;
+}
+
+
+DebuggerExecutingState_t ProgramJournal::record(uint32_t verified)
+{
+    if (! this->file.is_open()){
+        return DebuggerExecutingParamFault;
+    }
+    // one line per chunk, flushed: the run may end with the next frame
+    char line[160];
+    snprintf(line, sizeof(line), "%s %016llx %08x %u %u\n", this->key.uid.c_str(), (unsigned long long)this->key.image_hash,
+             this->key.addr, this->key.size, verified);
+    this->file << line << flush;
+    this->verified = verified;
+    return this->file.fail()? DebuggerExecutingFileOperationError: DebuggerExecutingNormal;
+}
+
+
+void ProgramJournal::close()
+{
+    if (this->file.is_open()){
+        this->file.close();
+    }
+}
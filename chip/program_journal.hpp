@@ -0,0 +1,44 @@
+#ifndef __PROGRAM_JOURNAL_HPP__
+#define __PROGRAM_JOURNAL_HPP__
+
+#include "DbgrCommon.h"
+#include <fstream>
+#include <string>
+
+
+/* one programming run: the device, the image and where it goes */
+typedef struct{
+    std::string uid;            // device UID, hex
+    uint64_t image_hash;        // FNV-1a 64 of the image bytes
+    uint32_t addr;
+    uint32_t size;
+}ProgramJournalKey_t;
+
+
+/*
+    Append-only progress file of program_only, one line per verified chunk:
+        # uid image_hash addr size verified
+        <hex> <%016x> <%08x> <bytes> <bytes verified from addr>
+    The last line of a key is its progress, a new run appends verified 0.
+    A finished run (verified == size) does not resume, the next run of the key starts over.
+*/
+class ProgramJournal
+{
+public:
+    ~ProgramJournal();
+
+    static uint64_t hash_image(std::istream& file, uint32_t offset, uint32_t size);
+
+    DebuggerExecutingState_t open(const char* file_name, const ProgramJournalKey_t& key);
+    bool is_open();
+    uint32_t progress();   // bytes verified by an unfinished run of the key, 0: none
+    DebuggerExecutingState_t record(uint32_t verified);
+    void close();
+
+private:
+    std::ofstream file;
+    ProgramJournalKey_t key;
+    uint32_t verified = 0;
+};
+
+#endif
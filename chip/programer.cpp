@@ -1,12 +1,22 @@
 #include "programer.hpp"
 #include <cassert>
 #include <algorithm>
+#include <thread>
+#include <chrono>
+#include "spsc_ring.hpp"
+#include "target_memory_view.hpp"
 #include "spdlog/sinks/rotating_file_sink.h"
 // #include "spdlog/sinks/stdout_color_sinks.h"
 
 
 using namespace std;
 
+
+static uint64_t elapsed_us(chrono::steady_clock::time_point start)
+{
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+
 Programer::Programer(std::shared_ptr<spdlog::logger> logger)
 {
     this->logger = logger;
@@ -35,12 +45,189 @@ Programer::Programer(char *logger_file_name, uint32_t max_file_size, uint32_t ma
 
 Programer::~Programer(){}
 
+
+ProgramerResult_t Programer::last_result()
+{
+    return this->result;
+}
+
+
+void Programer::reset_result()
+{
+    this->result = ProgramerResult_t{0, 0, 0, 0};
+}
+
+
+DebuggerExecutingState_t Programer::enable_journal(char* file_name, bool check_boundary)
+{
+    this->journal_file = file_name? file_name: "";
+    this->journal_check = check_boundary;
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Programer::set_verify_mode(ProgramerVerifyMode_t mode)
+{
+    if (! ((mode >= 0) && (mode < ProgramerVerifyModeCount))){
+        this->logger->error("param error verify mode {:d}, line {:d}.", int(mode), __LINE__);
+        return DebuggerExecutingParamFault;
+    }
+    this->verify_mode = mode;
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Programer::target_checksum(uint32_t /* addr */, uint32_t /* size */, uint32_t& /* crc */)
+{
+    return DebuggerExecutingFunctionInexistentError;
+}
+
+
+uint32_t Programer::write_once_unit(uint32_t /* addr */)
+{
+    return 0;
+}
+
+
+void Programer::set_pipeline(bool enable)
+{
+    this->pipeline = enable;
+}
+
+
+void Programer::set_dump_overlap(bool enable)
+{
+    this->dump_overlap = enable;
+}
+
+
+DebuggerExecutingState_t Programer::set_dump_format(ProgramerDumpFormat_t format)
+{
+    if (! ((format >= 0) && (format < ProgramerDumpFormatCount))){
+        this->logger->error("param error dump format {:d}, line {:d}.", int(format), __LINE__);
+        return DebuggerExecutingParamFault;
+    }
+    this->dump_format = format;
+    return DebuggerExecutingNormal;
+}
+
+
+DumpTiming_t Programer::last_dump_timing()
+{
+    return this->dump_timing;
+}
+
+
+DebuggerExecutingState_t Programer::begin_pipeline()
+{
+    return DebuggerExecutingNormal;
+}
+
+
+void Programer::prepare_chunk(uint32_t /* addr */, ProgramChunk_t& chunk)
+{
+    chunk.prepared_size = 0;
+}
+
+
+DebuggerExecutingState_t Programer::write_chunk(uint32_t addr, ProgramChunk_t& chunk)
+{
+    return this->write(addr, chunk.data, chunk.size);
+}
+
+
+DebuggerExecutingState_t Programer::verify_chunk(std::ifstream& file, uint32_t addr, uint32_t size, uint32_t file_offset)
+{
+    // size up to ALIGN_SIZE_B, file data in buff
+    file.seekg(file_offset, ios::beg);
+    file.read((char*)this->buff, size);
+    return this->verify_data(this->buff, addr, size);
+}
+
+
+DebuggerExecutingState_t Programer::verify_data(const uint8_t* data, uint32_t addr, uint32_t size)
+{
+    // size up to ALIGN_SIZE_B, target data in verify_buff
+    DebuggerExecutingState_t stat;
+
+    stat = this->read(addr, this->verify_buff, size);
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("Verify read addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr, size,  __LINE__);
+        return stat;
+    }
+    if (! equal(data, data + size, this->verify_buff)){
+        return DebuggerExecutingProgrammingCheckoutError;
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Programer::resume_journal(ProgramJournal& journal, std::ifstream& file, uint32_t addr, uint32_t size,
+                                                   uint32_t file_offset, uint32_t& finish_size)
+{
+    /*
+    finish_size: where program_only goes on. A new run starts at 0 on the flash erased by the caller.
+    A resumed run erases the chunk that failed, from the page holding its start: the bytes of that page
+    before the chunk are programmed again.
+    */
+    DebuggerExecutingState_t stat;
+    std::vector<uint8_t> uid;
+
+    finish_size = 0;
+    if (DebuggerExecutingNormal != this->device_uid(uid)){
+        this->logger->warn("device UID unknown, program without journal. line {:d}", __LINE__);
+        return DebuggerExecutingNormal;
+    }
+    std::string uid_hex;
+    char digits[4];
+    for (uint8_t byte: uid){
+        snprintf(digits, sizeof(digits), "%02x", byte);
+        uid_hex += digits;
+    }
+    ProgramJournalKey_t key = {uid_hex, ProgramJournal::hash_image(file, file_offset, size), addr, size};
+    stat = journal.open(this->journal_file.c_str(), key);
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("journal {} open fail, line {:d}.", this->journal_file, __LINE__);
+        return stat;
+    }
+
+    uint32_t progress = journal.progress();
+    if ((progress > 0) && this->journal_check){
+        uint32_t low = (progress > ALIGN_SIZE_B)? progress - ALIGN_SIZE_B: 0;
+        stat = this->verify_chunk(file, addr + low, progress - low, file_offset + low);
+        if (DebuggerExecutingProgrammingCheckoutError == stat){
+            this->logger->warn("Journal boundary addr 0x{:08x} changed, program from the start. line {:d}", addr + low,  __LINE__);
+            stat = this->erase_image(addr, size);
+            progress = 0;
+        }
+        if (DebuggerExecutingNormal != stat){
+            return stat;
+        }
+    }
+    if (0 == progress){
+        return journal.record(0);
+    }
+
+    uint32_t page_size = this->page_size();
+    uint32_t resume = std::max<uint64_t>(addr, (uint64_t)addr + progress - (addr + progress) % page_size) - addr;
+    uint32_t failed_end = std::min<uint64_t>((uint64_t)progress + ALIGN_SIZE_B, size);
+    this->logger->info("Journal resume addr 0x{:08x}, {:d} of {:d} Bytes verified. line {:d}", addr + resume, progress, size,  __LINE__);
+    stat = this->erase_image(addr + resume, failed_end - resume);
+    if (DebuggerExecutingNormal != stat){
+        return stat;
+    }
+    finish_size = resume;
+    return DebuggerExecutingNormal;
+}
+
+
 DebuggerExecutingState_t Programer::program_only(char* file_name, uint32_t addr, uint32_t size, uint32_t file_offset)
 {
     assert(file_name);
 
     DebuggerExecutingState_t stat = DebuggerExecutingNormal;
 
+    this->reset_result();
     ifstream file;
     file.open(file_name, ios::binary|ios::in);
     if (file.fail() || (!(file.is_open()))){
@@ -61,10 +248,24 @@ DebuggerExecutingState_t Programer::program_only(char* file_name, uint32_t addr,
     // write data
     uint32_t finish_size = 0;
     uint32_t tmp_size = 0;
-    file.seekg(file_offset, ios::beg);
+    ProgramJournal journal;
+    if (! this->journal_file.empty()){
+        stat = this->resume_journal(journal, file, addr, size, file_offset, finish_size);
+        if (DebuggerExecutingNormal != stat){
+            file.close();
+            return stat;
+        }
+    }
+    file.seekg(file_offset + finish_size, ios::beg);
+    if (this->pipeline){
+        stat = this->program_pipelined(file, addr, size, finish_size, journal);
+        file.close();
+        return stat;
+    }
     while (finish_size < size)
     {
-        tmp_size = (size - finish_size < ALIGN_SIZE_B)? (size - finish_size): ALIGN_SIZE_B;
+        // chunks end on the 4 KB grid of the target: with an unaligned image no program unit spans two writes
+        tmp_size = std::min(size - finish_size, ALIGN_SIZE_B - (addr + finish_size) % ALIGN_SIZE_B);
         file.read((char*)this->buff, tmp_size);
         stat = this->write(addr + finish_size, this->buff, tmp_size);
         if (DebuggerExecutingNormal != stat){
@@ -72,6 +273,17 @@ DebuggerExecutingState_t Programer::program_only(char* file_name, uint32_t addr,
             this->logger->error("Programer addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr + finish_size, tmp_size,  __LINE__);
             return stat;
         }
+        if (journal.is_open()){
+            stat = this->verify_chunk(file, addr + finish_size, tmp_size, file_offset + finish_size);
+            if (DebuggerExecutingNormal == stat){
+                stat = journal.record(finish_size + tmp_size);
+            }
+            if (DebuggerExecutingNormal != stat){
+                file.close();
+                this->logger->error("Journal addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr + finish_size, tmp_size,  __LINE__);
+                return stat;
+            }
+        }
         finish_size += tmp_size;
         this->logger->info("Programer addr 0x{:08x} size {:d} Bytes, finish size {:d}. line {:d}", addr + finish_size, tmp_size, finish_size,  __LINE__);
 
@@ -82,6 +294,263 @@ DebuggerExecutingState_t Programer::program_only(char* file_name, uint32_t addr,
 }
 
 
+DebuggerExecutingState_t Programer::program_pipelined(std::ifstream& file, uint32_t addr, uint32_t size, uint32_t finish_size,
+                                                      ProgramJournal& journal)
+{
+    /*
+    The producer thread reads the chunks from finish_size on and lets the chip prepare their frames, up to
+    PIPELINE_DEPTH chunks ahead. This thread sends them, then checks and records the chunk in the journal.
+    The file is used by the producer only until it is joined.
+    */
+    DebuggerExecutingState_t stat;
+
+    stat = this->begin_pipeline();
+    if (DebuggerExecutingNormal != stat){
+        return stat;
+    }
+    SpscRing<ProgramChunk_t> ring(PIPELINE_DEPTH);
+    std::thread producer([this, &ring, &file, addr, size, finish_size](){
+        uint32_t offset = finish_size;
+        while (offset < size)
+        {
+            ProgramChunk_t* chunk = ring.reserve();
+            if (! chunk){
+                return;
+            }
+            chunk->offset = offset;
+            chunk->size = std::min(size - offset, ALIGN_SIZE_B - (addr + offset) % ALIGN_SIZE_B);
+            if (! file.read((char*)chunk->data, chunk->size)){
+                break;
+            }
+            this->prepare_chunk(addr + offset, *chunk);
+            ring.commit();
+            offset += chunk->size;
+        }
+        ring.close();
+    });
+
+    while (finish_size < size)
+    {
+        ProgramChunk_t* chunk = ring.peek();
+        if (! chunk){
+            this->logger->error("file read offset {:d} fail, line {:d}.", finish_size, __LINE__);
+            stat = DebuggerExecutingFileOperationError;
+            break;
+        }
+        stat = this->write_chunk(addr + chunk->offset, *chunk);
+        if (DebuggerExecutingNormal != stat){
+            this->logger->error("Programer addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr + chunk->offset, chunk->size,  __LINE__);
+            break;
+        }
+        if (journal.is_open()){
+            stat = this->verify_data(chunk->data, addr + chunk->offset, chunk->size);
+            if (DebuggerExecutingNormal == stat){
+                stat = journal.record(chunk->offset + chunk->size);
+            }
+            if (DebuggerExecutingNormal != stat){
+                this->logger->error("Journal addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr + chunk->offset, chunk->size,  __LINE__);
+                break;
+            }
+        }
+        finish_size += chunk->size;
+        this->logger->info("Programer addr 0x{:08x} size {:d} Bytes, finish size {:d}. line {:d}", addr + finish_size, chunk->size, finish_size,  __LINE__);
+        ring.release();
+    }
+    ring.close();
+    producer.join();
+    this->logger->info("Pipeline: the bus waited {:d} times for the image. line {:d}", ring.consumer_waits(),  __LINE__);
+    return stat;
+}
+
+
+DebuggerExecutingState_t Programer::erase_image(uint32_t addr, uint32_t size)
+{
+    if (0 == size){
+        return DebuggerExecutingNormal;
+    }
+    uint32_t page_size = this->page_size();
+    uint64_t start = addr - addr % page_size;
+    uint64_t end = ((uint64_t)addr + size + page_size - 1) / page_size * page_size;
+    this->logger->info("Erase image addr 0x{:08x} size {:d} Bytes, {:d} pages. line {:d}", addr, size, (end - start) / page_size,  __LINE__);
+    return this->erase_pages(start, end - start);
+}
+
+
+DebuggerExecutingState_t Programer::read_v(const MemoryRegion_t regions[], uint32_t count)
+{
+    DebuggerExecutingState_t stat;
+
+    if ((count > 0) && (! regions)){
+        return DebuggerExecutingNullPointerParamFault;
+    }
+    std::vector<const MemoryRegion_t*> sorted;
+    for (uint32_t i=0; i<count; ++i)
+    {
+        if (0 == regions[i].size){
+            continue;
+        }
+        if ((! regions[i].data) || ((uint64_t)regions[i].addr + regions[i].size > (1ULL << 32))){
+            this->logger->error("param error region {:d} addr 0x{:08x} size {:d}, line {:d}.", i, regions[i].addr, regions[i].size, __LINE__);
+            return DebuggerExecutingParamFault;
+        }
+        sorted.push_back(&regions[i]);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const MemoryRegion_t* a, const MemoryRegion_t* b){
+        return a->addr < b->addr;
+    });
+
+    std::vector<uint8_t> span;
+    for (size_t i=0; i<sorted.size(); )
+    {
+        uint64_t start = sorted[i]->addr;
+        uint64_t end = start + sorted[i]->size;
+        size_t j = i + 1;
+        for (; j<sorted.size(); ++j)
+        {
+            // the span is read in commands of VECTOR_FRAME_B from its start
+            uint64_t last_command = start + (end - 1 - start) / VECTOR_FRAME_B * VECTOR_FRAME_B;
+            uint64_t region_end = (uint64_t)sorted[j]->addr + sorted[j]->size;
+            if ((sorted[j]->addr > end) && (region_end > last_command + VECTOR_FRAME_B)){
+                break;
+            }
+            end = std::max(end, region_end);
+        }
+        span.resize(end - start);
+        stat = this->read(start, span.data(), span.size());
+        if (DebuggerExecutingNormal != stat){
+            this->logger->error("read_v addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", (uint32_t)start, span.size(),  __LINE__);
+            return stat;
+        }
+        for (; i<j; ++i){
+            std::copy(span.begin() + (sorted[i]->addr - start), span.begin() + (sorted[i]->addr - start + sorted[i]->size), sorted[i]->data);
+        }
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Programer::write_v(const MemoryRegion_t regions[], uint32_t count)
+{
+    DebuggerExecutingState_t stat;
+
+    if ((count > 0) && (! regions)){
+        return DebuggerExecutingNullPointerParamFault;
+    }
+    for (uint32_t i=0; i<count; ++i)
+    {
+        if ((regions[i].size > 0) && ((! regions[i].data) || ((uint64_t)regions[i].addr + regions[i].size > (1ULL << 32)))){
+            this->logger->error("param error region {:d} addr 0x{:08x} size {:d}, line {:d}.", i, regions[i].addr, regions[i].size, __LINE__);
+            return DebuggerExecutingParamFault;
+        }
+    }
+    TargetMemoryView view(this);
+    for (uint32_t i=0; i<count; ++i)
+    {
+        stat = view.write(regions[i].addr, regions[i].data, regions[i].size);
+        if (DebuggerExecutingNormal != stat){
+            return stat;
+        }
+    }
+    return view.flush();
+}
+
+
+DebuggerExecutingState_t Programer::rewrite_pages(uint32_t addr, const std::vector<uint8_t>& data)
+{
+    DebuggerExecutingState_t stat;
+
+    stat = this->erase_pages(addr, data.size());
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("Erase addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr, data.size(),  __LINE__);
+        return stat;
+    }
+    stat = this->write(addr, data.data(), data.size());
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("Programer addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr, data.size(),  __LINE__);
+        return stat;
+    }
+    this->result.pages_rewritten += data.size() / this->page_size();
+    this->logger->info("Rewrite addr 0x{:08x} size {:d} Bytes. line {:d}", addr, data.size(),  __LINE__);
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Programer::program_diff(char* file_name, uint32_t addr, uint32_t size, uint32_t file_offset)
+{
+    /*
+    Program only the pages that differ from the file: every page touched by [addr, addr + size) is read
+    back and compared. Changed pages are erased and written again, runs of consecutive changed pages
+    with one erase. The bytes of a page outside the range are kept from the readback.
+    */
+    assert(file_name);
+
+    DebuggerExecutingState_t stat = DebuggerExecutingNormal;
+
+    this->reset_result();
+    ifstream file;
+    file.open(file_name, ios::binary|ios::in);
+    if (file.fail() || (!(file.is_open()))){
+        this->logger->error("file {} open fail, line {:d}.", file_name,  __LINE__);
+        return DebuggerExecutingFileOperationError;
+    }
+    // check file size
+    file.seekg(0, ios::end);
+    ios::pos_type local = file.tellg();
+    uint32_t file_size = (uint32_t) local;
+    this->logger->info("file {} size {:d} Bytes", file_name, file_size);
+    if ((file_offset > file_size) || (file_size - file_offset < size)){
+        file.close();
+        this->logger->error("file offset out of range, file size {:d}, max offset 0x{:x}, line {:d}.", file_size, file_offset + size, __LINE__);
+        return DebuggerExecutingFirmwareFileNotSuitable;
+    }
+
+    uint32_t page_size = this->page_size();
+    uint64_t end = (uint64_t)addr + size;
+    std::vector<uint8_t> page(page_size);
+    std::vector<uint8_t> image(page_size);
+    std::vector<uint8_t> run;
+    uint32_t run_addr = 0;
+
+    for (uint64_t page_addr = addr - addr % page_size; page_addr < end; page_addr += page_size)
+    {
+        stat = this->read(page_addr, page.data(), page_size);
+        if (DebuggerExecutingNormal != stat){
+            file.close();
+            this->logger->error("Diff read addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", page_addr, page_size,  __LINE__);
+            return stat;
+        }
+        uint64_t low = std::max<uint64_t>(page_addr, addr);
+        uint64_t high = std::min<uint64_t>(page_addr + page_size, end);
+        file.seekg(file_offset + (low - addr), ios::beg);
+        file.read((char*)image.data(), high - low);
+        bool same = equal(image.data(), image.data() + (high - low), page.begin() + (low - page_addr));
+
+        if (same){
+            this->result.pages_unchanged++;
+        }
+        else {
+            if (run.empty()){
+                run_addr = page_addr;
+            }
+            std::copy(image.data(), image.data() + (high - low), page.begin() + (low - page_addr));
+            run.insert(run.end(), page.begin(), page.end());
+        }
+        // a run ends at an unchanged page, at its size limit and at the last page
+        if ((! run.empty()) && (same || (run.size() >= DIFF_RUN_MAX_PAGES * page_size) || (page_addr + page_size >= end))){
+            stat = this->rewrite_pages(run_addr, run);
+            if (DebuggerExecutingNormal != stat){
+                file.close();
+                return stat;
+            }
+            run.clear();
+        }
+    }
+    file.close();
+    this->logger->info("Diff {:d} pages unchanged, {:d} pages rewritten. line {:d}", this->result.pages_unchanged, this->result.pages_rewritten,  __LINE__);
+    return DebuggerExecutingNormal;
+}
+
+
 DebuggerExecutingState_t Programer::dump(char* file_name, uint32_t addr, uint32_t size)
 {
     assert(file_name);
@@ -90,30 +559,170 @@ DebuggerExecutingState_t Programer::dump(char* file_name, uint32_t addr, uint32_
 
     DebuggerExecutingState_t stat;
 
-    ofstream file;
-    file.open(string(file_name) + ".readback", ios::binary|ios::out);
-    if (file.fail()){
+    // a failed dump leaves the output without close(): a sparse one has no segment table
+    DumpFileWriter output;
+    stat = output.open(file_name, this->dump_format, addr, size);
+    if (DebuggerExecutingNormal != stat){
         this->logger->error("file {} open fail, line {:d}.", file_name,  __LINE__);
-        return DebuggerExecutingFileOperationError;
+        return stat;
     }
 
+    this->dump_timing = DumpTiming_t{0, 0, 0};
+    if (this->dump_overlap){
+        stat = this->dump_overlapped(output, addr, size);
+    }
+    else{
+        stat = this->dump_sequential(output, addr, size);
+    }
+    if (DebuggerExecutingNormal != stat){
+        return stat;
+    }
+    stat = output.close();
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("file {} write fail, line {:d}.", file_name,  __LINE__);
+        return stat;
+    }
+    if (ProgramerDumpSparse == this->dump_format){
+        this->logger->info("Sparse dump {:d} segments, {:d} of {:d} Bytes stored. line {:d}", output.segment_count(), output.stored_bytes(), size,  __LINE__);
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Programer::dump_sequential(DumpFileWriter& output, uint32_t addr, uint32_t size)
+{
+    DebuggerExecutingState_t stat;
+
     uint32_t finish_size = 0;
     uint32_t tmp_size;
     while (finish_size < size)
     {
         tmp_size = (size - finish_size < ALIGN_SIZE_B)? (size - finish_size): ALIGN_SIZE_B;
+        auto start = chrono::steady_clock::now();
         stat = this->read(addr + finish_size, this->buff, tmp_size);
+        this->dump_timing.bus_us += elapsed_us(start);
         if (DebuggerExecutingNormal != stat){
-            file.close();
             this->logger->error("Dump addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr + finish_size, tmp_size,  __LINE__);
             return stat;
         }
-        file.write((char*)this->buff, tmp_size);
+        start = chrono::steady_clock::now();
+        stat = output.append(this->buff, tmp_size);
+        this->dump_timing.disk_us += elapsed_us(start);
+        this->dump_timing.stall_us = this->dump_timing.disk_us;
+        if (DebuggerExecutingNormal != stat){
+            this->logger->error("Dump file write fail at {:d} Bytes, line {:d}.", finish_size, __LINE__);
+            return stat;
+        }
         finish_size += tmp_size;
         this->logger->info("Dump addr 0x{:08x} size {:d} Bytes, finish size {:d}. line {:d}", addr + finish_size, tmp_size, finish_size,  __LINE__);
 
     }
-    file.close();
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Programer::dump_overlapped(DumpFileWriter& output, uint32_t addr, uint32_t size)
+{
+    /*
+    This thread reads the chunks into the ring, the writer thread appends them to the output in order and times the
+    appends. A failed file write closes the ring: reserve() then stops the reads. The output is used by the writer
+    only until it is joined.
+    */
+    DebuggerExecutingState_t stat = DebuggerExecutingNormal;
+    DebuggerExecutingState_t write_stat = DebuggerExecutingNormal;
+    uint64_t disk_us = 0;
+
+    SpscRing<DumpChunk_t> ring(PIPELINE_DEPTH);
+    std::thread writer([&ring, &output, &write_stat, &disk_us](){
+        DumpChunk_t* chunk;
+        while (NULL != (chunk = ring.peek()))
+        {
+            auto start = chrono::steady_clock::now();
+            write_stat = output.append(chunk->data, chunk->size);
+            disk_us += elapsed_us(start);
+            if (DebuggerExecutingNormal != write_stat){
+                break;
+            }
+            ring.release();
+        }
+        ring.close();
+    });
+
+    uint32_t finish_size = 0;
+    while (finish_size < size)
+    {
+        auto start = chrono::steady_clock::now();
+        DumpChunk_t* chunk = ring.reserve();
+        this->dump_timing.stall_us += elapsed_us(start);
+        if (! chunk){
+            break;
+        }
+        chunk->size = std::min<uint32_t>(size - finish_size, DUMP_CHUNK_B);
+        start = chrono::steady_clock::now();
+        stat = this->read(addr + finish_size, chunk->data, chunk->size);
+        this->dump_timing.bus_us += elapsed_us(start);
+        if (DebuggerExecutingNormal != stat){
+            this->logger->error("Dump addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr + finish_size, chunk->size,  __LINE__);
+            break;
+        }
+        finish_size += chunk->size;
+        this->logger->debug("Dump addr 0x{:08x} size {:d} Bytes, finish size {:d}. line {:d}", addr + finish_size, chunk->size, finish_size,  __LINE__);
+        ring.commit();
+    }
+    ring.close();
+    writer.join();
+    this->dump_timing.disk_us = disk_us;
+
+    if (DebuggerExecutingNormal != write_stat){
+        this->logger->error("Dump file write fail at {:d} Bytes, line {:d}.", finish_size, __LINE__);
+        return write_stat;
+    }
+    this->logger->info("Dump {:d} Bytes: bus {:d} us, disk {:d} us, the bus waited {:d} us for the disk. line {:d}",
+                       finish_size, this->dump_timing.bus_us, this->dump_timing.disk_us, this->dump_timing.stall_us,  __LINE__);
+    return stat;
+}
+
+
+DebuggerExecutingState_t Programer::restore_sparse(char* file_name)
+{
+    assert(file_name);
+
+    DebuggerExecutingState_t stat;
+
+    SparseDumpReader dump;
+    stat = dump.open(file_name);
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("sparse dump {} open fail, line {:d}.", file_name,  __LINE__);
+        return stat;
+    }
+    this->reset_result();
+
+    std::vector<uint8_t> data;
+    uint64_t restored = 0;
+    for (auto& segment: dump.segments())
+    {
+        stat = dump.read_segment(segment, data);
+        if (DebuggerExecutingNormal != stat){
+            this->logger->error("sparse dump segment addr 0x{:08x} size {:d} Bytes bad, line {:d}.", segment.addr, segment.size,  __LINE__);
+            return stat;
+        }
+        // chunks end on the 4 KB grid of the target, as program_only
+        uint32_t finish_size = 0;
+        uint32_t tmp_size;
+        while (finish_size < segment.size)
+        {
+            tmp_size = std::min(segment.size - finish_size, ALIGN_SIZE_B - (segment.addr + finish_size) % ALIGN_SIZE_B);
+            stat = this->write(segment.addr + finish_size, data.data() + finish_size, tmp_size);
+            if (DebuggerExecutingNormal != stat){
+                this->logger->error("Restore addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", segment.addr + finish_size, tmp_size,  __LINE__);
+                return stat;
+            }
+            finish_size += tmp_size;
+        }
+        restored += segment.size;
+        this->logger->info("Restore addr 0x{:08x} size {:d} Bytes. line {:d}", segment.addr, segment.size,  __LINE__);
+    }
+    this->logger->info("Restore {:d} segments, {:d} of {:d} Bytes from addr 0x{:08x}. line {:d}", dump.segments().size(), restored, dump.size(), dump.addr(),  __LINE__);
     return DebuggerExecutingNormal;
 }
 
@@ -140,31 +749,86 @@ DebuggerExecutingState_t Programer::verify(char* file_name, uint32_t addr, uint3
         return DebuggerExecutingFirmwareFileNotSuitable;
     }
 
-    // verify data
+    stat = DebuggerExecutingFunctionInexistentError;
+    if (ProgramerVerifyChecksum == this->verify_mode){
+        stat = this->verify_checksum(file, addr, size, file_offset);
+        if (DebuggerExecutingFunctionInexistentError == stat){
+            this->logger->info("No target checksum, verify by readback. line {:d}", __LINE__);
+        }
+    }
+    if (DebuggerExecutingFunctionInexistentError == stat){
+        stat = this->verify_readback(file, addr, size, file_offset);
+    }
+    file.close();
+    return stat;
+}
+
+
+DebuggerExecutingState_t Programer::verify_readback(std::ifstream& file, uint32_t addr, uint32_t size, uint32_t file_offset)
+{
+    DebuggerExecutingState_t stat;
     uint32_t finish_size = 0;
     uint32_t tmp_size = 0;
-    file.seekg(file_offset, ios::beg);
+
     while (finish_size < size)
     {
         tmp_size = (size - finish_size < ALIGN_SIZE_B)? (size - finish_size): ALIGN_SIZE_B;
-        file.read((char*)this->buff, tmp_size);
-        stat = this->read(addr + finish_size, this->verify_buff, tmp_size);
+        stat = this->verify_chunk(file, addr + finish_size, tmp_size, file_offset + finish_size);
+        if (DebuggerExecutingProgrammingCheckoutError == stat){
+            this->logger->error("Verify addr 0x{:08x} size {:d} Bytes equal fail!!! line {:d}", addr + finish_size, tmp_size,  __LINE__);
+        }
         if (DebuggerExecutingNormal != stat){
-            file.close();
-            this->logger->error("Verify read addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr + finish_size, tmp_size,  __LINE__);
             return stat;
         }
-        if (! equal(this->buff, this->buff + tmp_size, this->verify_buff))
-        {
-            file.close();
-            this->logger->error("Verify addr 0x{:08x} size {:d} Bytes equal fail!!! line {:d}", addr + finish_size, tmp_size,  __LINE__);
-            return DebuggerExecutingProgrammingCheckoutError;
-        }
         finish_size += tmp_size;
         this->logger->info("Verify addr 0x{:08x} size {:d} Bytes, finish size {:d}. line {:d}", addr + finish_size, tmp_size, finish_size,  __LINE__);
 
     }
-    file.close();
     return DebuggerExecutingNormal;
 }
 
+
+DebuggerExecutingState_t Programer::verify_checksum(std::ifstream& file, uint32_t addr, uint32_t size, uint32_t file_offset)
+{
+    /*
+    One target CRC per region of the words in [addr, addr + size), the host CRC is computed while the file
+    streams through buff. The unaligned head and tail bytes are read back.
+    DebuggerExecutingFunctionInexistentError before any check when the target has no checksum.
+    */
+    DebuggerExecutingState_t stat;
+    uint32_t head = std::min<uint32_t>((4 - addr % 4) % 4, size);
+    uint32_t words = (size - head) & ~3U;
+    uint32_t finish_size = head;
+
+    while (finish_size < head + words)
+    {
+        uint32_t region = std::min<uint32_t>(head + words - finish_size, VERIFY_CRC_REGION_B);
+        uint32_t target_crc = 0;
+        stat = this->target_checksum(addr + finish_size, region, target_crc);
+        if (DebuggerExecutingNormal != stat){
+            if (DebuggerExecutingFunctionInexistentError != stat){
+                this->logger->error("Checksum addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr + finish_size, region,  __LINE__);
+            }
+            return stat;
+        }
+        uint32_t crc = SE_CRC32_STM32_INIT;
+        file.seekg(file_offset + finish_size, ios::beg);
+        for (uint32_t done = 0; done < region; done += ALIGN_SIZE_B)
+        {
+            uint32_t tmp_size = std::min<uint32_t>(region - done, ALIGN_SIZE_B);
+            file.read((char*)this->buff, tmp_size);
+            crc = DbgrCrc32Stm32(crc, this->buff, tmp_size);
+        }
+        if (crc != target_crc){
+            this->logger->error("Verify addr 0x{:08x} size {:d} Bytes CRC 0x{:08x} != 0x{:08x} fail!!! line {:d}", addr + finish_size, region, target_crc, crc,  __LINE__);
+            return DebuggerExecutingProgrammingCheckoutError;
+        }
+        finish_size += region;
+        this->logger->info("Verify addr 0x{:08x} size {:d} Bytes CRC 0x{:08x}, finish size {:d}. line {:d}", addr + finish_size, region, crc, finish_size,  __LINE__);
+    }
+    stat = this->verify_readback(file, addr, head, file_offset);
+    if (DebuggerExecutingNormal != stat){
+        return stat;
+    }
+    return this->verify_readback(file, addr + finish_size, size - finish_size, file_offset + finish_size);
+}
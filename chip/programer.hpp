@@ -4,11 +4,66 @@
 #include "DbgrCommon.h"
 #include <fstream>
 #include <iostream>
+#include <vector>
+#include <string>
+#include "program_journal.hpp"
+#include "dump_file.hpp"
 
 
 #define ALIGN_SIZE_B    (4 * 1024)
 #define MAX_FILE_SIZE   (20 * 1024 * 1024)
 #define MAX_FILES       (2)
+#define DIFF_RUN_MAX_PAGES  64  // program_diff erases and writes up to 64 consecutive changed pages at once
+#define VERIFY_CRC_REGION_B (64 * 1024)  // verify compares one target CRC per 64 KB
+#define PIPELINE_DEPTH      8           // pipelined program_only: 4 KB chunks read and prepared ahead of the bus
+#define PREPARED_SIZE_B     (ALIGN_SIZE_B + 256)
+#define VECTOR_FRAME_B      256         // read_v: regions sharing one read command of the target are read together
+#define DUMP_CHUNK_B        (64 * 1024) // overlapped dump: one target read and one file write per chunk
+
+
+/* counts of the last program_only/program_diff, or of write calls since reset_result */
+typedef struct{
+    uint64_t bytes_programmed;      // sent to the target
+    uint64_t bytes_skipped;         // blank frames on erased flash, never sent
+    uint32_t pages_unchanged;       // program_diff: equal on the target, neither erased nor written
+    uint32_t pages_rewritten;       // program_diff: erased and written again
+}ProgramerResult_t;
+
+/* how verify compares the target with the file */
+typedef enum{
+    ProgramerVerifyReadback = 0,        // read back every byte
+    ProgramerVerifyChecksum,            // target CRC per region, readback when the target has no checksum command
+    ProgramerVerifyModeCount,
+}ProgramerVerifyMode_t;
+
+/* times of the last dump, in microseconds */
+typedef struct{
+    uint64_t bus_us;                // reading the target
+    uint64_t disk_us;               // writing the file, on the writer thread when overlapped
+    uint64_t stall_us;              // the bus waited for the file: the disk time not hidden behind the bus
+}DumpTiming_t;
+
+/* one range of read_v/write_v, data is the buffer of the caller */
+typedef struct{
+    uint32_t addr;
+    uint32_t size;
+    uint8_t* data;
+}MemoryRegion_t;
+
+/* one chunk of the pipelined program_only, read and prepared by the producer thread */
+typedef struct{
+    uint32_t offset;                // from the image addr
+    uint32_t size;                  // up to the next 4 KB boundary of the target
+    uint8_t data[ALIGN_SIZE_B];
+    uint32_t prepared_size;         // Bytes of prepared, 0: write_chunk builds the frames from data
+    alignas(8) uint8_t prepared[PREPARED_SIZE_B];   // frames in the layout of the chip
+}ProgramChunk_t;
+
+/* one chunk of the overlapped dump, read by the bus thread and written by the writer thread */
+typedef struct{
+    uint32_t size;
+    uint8_t data[DUMP_CHUNK_B];
+}DumpChunk_t;
 
 class Programer
 {
@@ -18,16 +73,80 @@ public:
     ~Programer();
 
     DebuggerExecutingState_t program_only(char* file_name, uint32_t addr, uint32_t size, uint32_t file_offset=0);
+    DebuggerExecutingState_t program_diff(char* file_name, uint32_t addr, uint32_t size, uint32_t file_offset=0);
     DebuggerExecutingState_t dump(char* file_name, uint32_t addr, uint32_t size);
+    /* Program the segments of a ProgramerDumpSparse dump at their addresses, the blank space is not written:
+       erase the range of the dump first. */
+    DebuggerExecutingState_t restore_sparse(char* file_name);
     DebuggerExecutingState_t verify(char* file_name, uint32_t addr, uint32_t size, uint32_t file_offset=0);
     virtual DebuggerExecutingState_t mass_erase() = 0;
+    ProgramerResult_t last_result();
+    void reset_result();
+
+    /* Journal of program_only in file_name (NULL: off): every 4 KB chunk is read back and recorded once verified.
+       A run of the same image, addr and device that failed resumes after its last verified chunk: erase the image
+       before the first run only. check_boundary compares that chunk first, on mismatch the image is erased and
+       programmed from the start. */
+    DebuggerExecutingState_t enable_journal(char* file_name, bool check_boundary=true);
+    DebuggerExecutingState_t set_verify_mode(ProgramerVerifyMode_t mode);
+    /* program_only reads the image and builds the frames on a producer thread, PIPELINE_DEPTH chunks ahead:
+       the bus thread only sends frames and waits for ACKs. */
+    void set_pipeline(bool enable);
+    /* dump reads DUMP_CHUNK_B chunks into PIPELINE_DEPTH buffers, a writer thread writes them to the file:
+       the bus waits for the disk only when every buffer is full. */
+    void set_dump_overlap(bool enable);
+    DebuggerExecutingState_t set_dump_format(ProgramerDumpFormat_t format);
+    DumpTiming_t last_dump_timing();
 
     virtual DebuggerExecutingState_t erase4k(uint32_t page) = 0;
+    virtual uint32_t page_size() = 0;
+    virtual DebuggerExecutingState_t erase_pages(uint32_t addr, uint32_t size) = 0;  // page aligned range
+    DebuggerExecutingState_t erase_image(uint32_t addr, uint32_t size);  // the pages touched by the image, instead of mass_erase
+    /* Many ranges in one call, in any order. read_v reads the overlapping, adjacent and nearby regions in one span:
+       a region joins the span when it overlaps it or ends within its last 256 Bytes read command.
+       write_v combines the regions like TargetMemoryView, an overlapped byte takes the data of the later region. */
+    DebuggerExecutingState_t read_v(const MemoryRegion_t regions[], uint32_t count);
+    DebuggerExecutingState_t write_v(const MemoryRegion_t regions[], uint32_t count);
     virtual DebuggerExecutingState_t read(uint32_t addr, uint8_t* data, uint32_t size) = 0;
     virtual DebuggerExecutingState_t write(uint32_t addr, const uint8_t* data, uint32_t size) = 0;
+    virtual DebuggerExecutingState_t device_uid(std::vector<uint8_t>& uid) = 0;
+    /* CRC of the STM32 CRC unit (DbgrCrc32Stm32) computed on the target, addr and size multiples of 4.
+       DebuggerExecutingFunctionInexistentError when the target cannot. */
+    virtual DebuggerExecutingState_t target_checksum(uint32_t addr, uint32_t size, uint32_t& crc);
+    /* Bytes of the units the memory at addr is programmed in, each one at most once between two erases (flash);
+       0 when the memory is written freely (RAM). */
+    virtual uint32_t write_once_unit(uint32_t addr);
 
     std::shared_ptr<spdlog::logger> logger=NULL;
+protected:
+    /* pipeline hooks: begin_pipeline on the bus thread before the producer starts, prepare_chunk on the producer
+       thread, it must not use the bus nor state changed by the bus thread, write_chunk on the bus thread. */
+    virtual DebuggerExecutingState_t begin_pipeline();
+    virtual void prepare_chunk(uint32_t addr, ProgramChunk_t& chunk);
+    virtual DebuggerExecutingState_t write_chunk(uint32_t addr, ProgramChunk_t& chunk);
+
+    ProgramerResult_t result={0, 0, 0, 0};
 private:
+    DebuggerExecutingState_t rewrite_pages(uint32_t addr, const std::vector<uint8_t>& data);
+    DebuggerExecutingState_t resume_journal(ProgramJournal& journal, std::ifstream& file, uint32_t addr, uint32_t size,
+                                            uint32_t file_offset, uint32_t& finish_size);
+    DebuggerExecutingState_t program_pipelined(std::ifstream& file, uint32_t addr, uint32_t size, uint32_t finish_size,
+                                               ProgramJournal& journal);
+    DebuggerExecutingState_t dump_sequential(DumpFileWriter& output, uint32_t addr, uint32_t size);
+    DebuggerExecutingState_t dump_overlapped(DumpFileWriter& output, uint32_t addr, uint32_t size);
+    DebuggerExecutingState_t verify_chunk(std::ifstream& file, uint32_t addr, uint32_t size, uint32_t file_offset);
+    DebuggerExecutingState_t verify_data(const uint8_t* data, uint32_t addr, uint32_t size);
+    DebuggerExecutingState_t verify_readback(std::ifstream& file, uint32_t addr, uint32_t size, uint32_t file_offset);
+    DebuggerExecutingState_t verify_checksum(std::ifstream& file, uint32_t addr, uint32_t size, uint32_t file_offset);
+
+    std::string journal_file;
+    bool journal_check = true;
+    ProgramerVerifyMode_t verify_mode = ProgramerVerifyReadback;
+    bool pipeline = false;
+    bool dump_overlap = false;
+    ProgramerDumpFormat_t dump_format = ProgramerDumpRaw;
+    DumpTiming_t dump_timing = {0, 0, 0};
+
     uint8_t buff[ALIGN_SIZE_B]={0xff};
     uint8_t verify_buff[ALIGN_SIZE_B]={0xff};
     
@@ -0,0 +1,96 @@
+#include <algorithm>
+
+#include "read_cache.hpp"
+
+
+void ReadCache::clear()
+{
+    this->frames.clear();
+    this->partial_frames.clear();
+}
+
+
+bool ReadCache::lookup(uint32_t frame_addr, uint32_t offset, uint8_t* data, uint32_t size)
+{
+    auto it = this->frames.find(frame_addr);
+    bool valid = (it != this->frames.end());
+    for (uint32_t i=offset; valid && (i<offset + size); ++i){
+        valid = it->second.valid[i];
+    }
+    if (! valid){
+        this->stats.misses++;
+        return false;
+    }
+    std::copy(it->second.data + offset, it->second.data + offset + size, data);
+    this->stats.hits++;
+    return true;
+}
+
+
+ReadCache::ReadCacheFrame_t& ReadCache::entry(uint32_t frame_addr)
+{
+    // the frame entry, a new one replaces the oldest of a full cache
+    auto it = this->frames.find(frame_addr);
+    if (it != this->frames.end()){
+        return it->second;
+    }
+    if (this->frames.size() >= READ_CACHE_MAX_FRAMES){
+        auto oldest = std::min_element(this->frames.begin(), this->frames.end(),
+            [](const std::pair<const uint32_t, ReadCacheFrame_t>& a, const std::pair<const uint32_t, ReadCacheFrame_t>& b){
+                return a.second.stamp < b.second.stamp;
+            });
+        this->frames.erase(oldest);
+    }
+    ReadCacheFrame_t& frame = this->frames[frame_addr];
+    frame.stamp = this->stamp++;
+    frame.valid.reset();
+    return frame;
+}
+
+
+void ReadCache::insert(uint32_t frame_addr, const uint8_t* frame)
+{
+    ReadCacheFrame_t& cached = this->entry(frame_addr);
+    std::copy(frame, frame + READ_CACHE_FRAME_B, cached.data);
+    cached.valid.set();
+}
+
+
+void ReadCache::insert_partial(uint32_t frame_addr, uint32_t offset, const uint8_t* data, uint32_t size)
+{
+    this->partial_frames.insert(frame_addr);
+    ReadCacheFrame_t& cached = this->entry(frame_addr);
+    std::copy(data, data + size, cached.data + offset);
+    for (uint32_t i=offset; i<offset + size; ++i){
+        cached.valid.set(i);
+    }
+}
+
+
+bool ReadCache::partial(uint32_t frame_addr)
+{
+    return this->partial_frames.count(frame_addr) > 0;
+}
+
+
+void ReadCache::invalidate(uint64_t start, uint64_t end)
+{
+    // the frames overlapping [start, end)
+    if (start >= end){
+        return;
+    }
+    uint64_t first = start - start % READ_CACHE_FRAME_B;
+    this->frames.erase(this->frames.lower_bound(first), (end > UINT32_MAX)? this->frames.end(): this->frames.lower_bound(end));
+}
+
+
+ReadCacheStatistics_t ReadCache::statistics()
+{
+    return this->stats;
+}
+
+
+void ReadCache::reset_statistics()
+{
+    this->stats = ReadCacheStatistics_t{0, 0};
+}
@@ -0,0 +1,52 @@
+#ifndef __READ_CACHE_HPP__
+#define __READ_CACHE_HPP__
+
+#include <map>
+#include <set>
+#include <bitset>
+#include <cstdint>
+
+
+#define READ_CACHE_FRAME_B      256     // one Read Memory command
+#define READ_CACHE_MAX_FRAMES   64      // 16 KB, the oldest frame is dropped beyond
+
+
+typedef struct{
+    uint64_t hits;                      // frame lookups served from the cache
+    uint64_t misses;                    // frame lookups that went to the target
+}ReadCacheStatistics_t;
+
+
+/*
+    Target memory frames already read: aligned 256 Bytes frames, filled whole.
+    A frame the target cannot read whole (end of a memory area) is marked partial, it keeps the bytes read one by one.
+    The owner invalidates the ranges its commands change.
+*/
+class ReadCache
+{
+public:
+    void clear();
+    bool lookup(uint32_t frame_addr, uint32_t offset, uint8_t* data, uint32_t size);
+    void insert(uint32_t frame_addr, const uint8_t* frame);
+    void insert_partial(uint32_t frame_addr, uint32_t offset, const uint8_t* data, uint32_t size);
+    bool partial(uint32_t frame_addr);
+    void invalidate(uint64_t start, uint64_t end);
+    ReadCacheStatistics_t statistics();
+    void reset_statistics();
+
+private:
+    typedef struct{
+        uint64_t stamp;                 // insertion order
+        std::bitset<READ_CACHE_FRAME_B> valid;
+        uint8_t data[READ_CACHE_FRAME_B];
+    }ReadCacheFrame_t;
+
+    std::map<uint32_t, ReadCacheFrame_t> frames;
+    ReadCacheFrame_t& entry(uint32_t frame_addr);
+
+    std::set<uint32_t> partial_frames;
+    uint64_t stamp = 0;
+    ReadCacheStatistics_t stats = {0, 0};
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef __SPSC_RING_HPP__
+#define __SPSC_RING_HPP__
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cassert>
+#include <cstdint>
+
+
+/*
+    Lock-free ring between one producer thread and one consumer thread, the slots are filled and read in place.
+    Producer: reserve() a free slot, fill it, commit(). Consumer: peek() the oldest filled slot, use it, release().
+    Either side may close(): reserve() then returns NULL at once, peek() once the filled slots are drained.
+    A full or empty ring is waited by yielding, waits counts the waits of the consumer.
+*/
+template <class T>
+class SpscRing
+{
+public:
+    explicit SpscRing(uint32_t capacity): slots(capacity)
+    {
+        assert(capacity && (0 == (capacity & (capacity - 1))));  // power of 2
+        this->mask = capacity - 1;
+        this->head.store(0);
+        this->tail.store(0);
+        this->closed.store(false);
+        this->waits = 0;
+    }
+
+    T* reserve()
+    {
+        uint32_t position = this->head.load(std::memory_order_relaxed);
+        while (position - this->tail.load(std::memory_order_acquire) > this->mask)
+        {
+            if (this->closed.load(std::memory_order_acquire)){
+                return NULL;
+            }
+            std::this_thread::yield();
+        }
+        return this->closed.load(std::memory_order_acquire)? NULL: &this->slots[position & this->mask];
+    }
+
+    void commit()
+    {
+        this->head.store(this->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    T* peek()
+    {
+        uint32_t position = this->tail.load(std::memory_order_relaxed);
+        bool waited = false;
+        while (position == this->head.load(std::memory_order_acquire))
+        {
+            if (this->closed.load(std::memory_order_acquire)){
+                // a commit before the close is visible once closed is
+                if (position == this->head.load(std::memory_order_acquire)){
+                    return NULL;
+                }
+                break;
+            }
+            this->waits += ! waited;
+            waited = true;
+            std::this_thread::yield();
+        }
+        return &this->slots[position & this->mask];
+    }
+
+    void release()
+    {
+        this->tail.store(this->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    void close()
+    {
+        this->closed.store(true, std::memory_order_release);
+    }
+
+    uint64_t consumer_waits()
+    {
+        return this->waits;
+    }
+
+private:
+    std::vector<T> slots;
+    uint32_t mask;
+    std::atomic<uint32_t> head;     // next slot to fill, written by the producer only
+    std::atomic<uint32_t> tail;     // next slot to read, written by the consumer only
+    std::atomic<bool> closed;
+    uint64_t waits;                 // consumer side
+};
+
+#endif
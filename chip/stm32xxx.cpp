@@ -5,36 +5,31 @@
 #include "stm32xxx.hpp"
 
 
-/* Bootloader command set */
-#define GET_CMD_COMMAND        0x00U  /*!< Get CMD command               */
-#define GET_VER_COMMAND        0x01U  /*!< Get Version command           */
-#define GET_ID_COMMAND         0x02U  /*!< Get ID command                */
-#define RMEM_COMMAND           0x11U  /*!< Read Memory command           */
-#define GO_COMMAND             0x21U  /*!< Go command                    */
-#define WMEM_COMMAND           0x31U  /*!< Write Memory command          */
-#define EMEM_COMMAND           0x44U  /*!< Erase Memory command          */
-#define WP_COMMAND             0x63U  /*!< Write Protect command         */
-#define WU_COMMAND             0x73U  /*!< Write Unprotect command       */
-#define RP_COMMAND             0x82U  /*!< Readout Protect command       */
-#define RU_COMMAND             0x92U  /*!< Readout Unprotect command     */
-
-#define BL_SPI_SOF              0x5AU
-#define BL_ACK                  0x79U
-#define BL_NAK                  0x1FU
-#define BL_DUMMY                0xA5U
-#define BL_IDLE                 0x00U
 #define BL_PROCESSING_DELAY_MS  100
 
 
+/* STM32L4 datasheet flash memory characteristics, protection keeps the former fixed processing delay */
+static const Stm32WaitModel_t default_wait_models[Stm32WaitModelCount] = {
+    /* base_us                          unit_us     sleep_percent */
+    {  0,                               82,         80  },      // Stm32WaitWriteMemory: tprog 64 bits
+    {  0,                               22000,      90  },      // Stm32WaitErasePages: tERASE
+    {  22100,                           0,          90  },      // Stm32WaitMassErase: tME
+    {  BL_PROCESSING_DELAY_MS * 1000,   0,          100 },      // Stm32WaitProtection
+    {  0,                               15,         80  },      // Stm32WaitChecksum: CRC unit fed by the CPU
+};
+
+
 STM32XXX::STM32XXX(char* spi_name, uint32_t frequency_hz, SpiCpolnCphaMode_t mode,
                    char *logger_file_name, uint32_t max_file_size, uint32_t max_files, bool rotate_on_open
                    ): Programer(logger_file_name, max_file_size, max_files, rotate_on_open)
 {
     this->logger->info("......... STM32XXX .......");
-    this->spi = new SpiInterface(spi_name, this->logger);
-    this->spi->ModuleEnable();
-    this->spi->SetFrequency(frequency_hz);
-    this->spi->SwitchSpiMode(mode);
+    SpiInterface* spi = new SpiInterface(spi_name, this->logger);
+    spi->ModuleEnable();
+    spi->SetFrequency(frequency_hz);
+    spi->SwitchSpiMode(mode);
+    this->link = new Stm32Link<SpiInterface>(spi, true, this->logger);
+    this->init_wait_models();
 
     std::memset(this->buffer, BL_IDLE, sizeof(this->buffer));
 
@@ -43,79 +38,426 @@ STM32XXX::STM32XXX(char* spi_name, uint32_t frequency_hz, SpiCpolnCphaMode_t mod
 
 STM32XXX::~STM32XXX()
 {
-    if (this->spi){
-        delete this->spi;
+    if (this->ack_learning){
+        this->save_ack_model();
+    }
+    if (this->link){
+        delete this->link;
     }
 }
 
 
-uint8_t complement(uint8_t data)
+SpiTransport* STM32XXX::transport()
 {
-    return data ^ 0xff;
+    return this->link->transport();
 }
 
 
-uint8_t xor_checksum(uint8_t data[], int length)
+void STM32XXX::init_wait_models()
 {
-    uint8_t checksum = 0x00;
+    std::copy(default_wait_models, default_wait_models + Stm32WaitModelCount, this->wait_models);
+}
 
-    for (int i=0; i<length; i++){
-        checksum ^= data[i];
+
+DebuggerExecutingState_t STM32XXX::set_wait_model(Stm32WaitKind_t kind, Stm32WaitModel_t model)
+{
+    if (! ((kind >= 0) && (kind < Stm32WaitModelCount) && (model.sleep_percent <= 100))){
+        this->logger->error("param error wait model {:d}, line {:d}.", int(kind), __LINE__);
+        return DebuggerExecutingParamFault;
     }
-    return checksum;
+    this->wait_models[kind] = model;
+    return DebuggerExecutingNormal;
 }
 
 
-DebuggerExecutingState_t STM32XXX::spi_transmit(uint8_t anWriteList[], uint8_t anReadList[], uint32_t nTransmitLength)
+Stm32WaitModel_t STM32XXX::get_wait_model(Stm32WaitKind_t kind)
 {
-    return this->spi->sTransmit(anWriteList, anReadList, nTransmitLength);
+    assert((kind >= 0) && (kind < Stm32WaitModelCount));
+    return this->wait_models[kind];
 }
 
 
-DebuggerExecutingState_t STM32XXX::is_ack_ok(uint32_t timeout_ms)
+DebuggerExecutingState_t STM32XXX::set_write_workaround(Stm32WriteWorkaround_t workaround)
+{
+    if (! ((workaround >= 0) && (workaround < Stm32WriteWorkaroundCount))){
+        this->logger->error("param error write workaround {:d}, line {:d}.", int(workaround), __LINE__);
+        return DebuggerExecutingParamFault;
+    }
+    this->write_workaround = workaround;
+    return DebuggerExecutingNormal;
+}
+
+
+Stm32WriteWorkaround_t STM32XXX::get_write_workaround()
 {
-    uint32_t elapsed = 0;
-    uint8_t resp = 0;
+    return this->write_workaround;
+}
 
-    std::memset(this->buffer, BL_IDLE, 4);
 
-    this->buffer[0] = BL_IDLE;
-    this->spi_transmit(this->buffer, this->buffer, 1);
+DebuggerExecutingState_t STM32XXX::set_erase_policy(Stm32ErasePolicy_t policy)
+{
+    if (! ((policy >= 0) && (policy < Stm32ErasePolicyCount))){
+        this->logger->error("param error erase policy {:d}, line {:d}.", int(policy), __LINE__);
+        return DebuggerExecutingParamFault;
+    }
+    this->erase_policy = policy;
+    return DebuggerExecutingNormal;
+}
 
-    auto start = std::chrono::steady_clock::now();
-    do{
-        std::memset(this->buffer, BL_IDLE, 4);
-        this->buffer[0] = BL_IDLE;
-        this->spi_transmit(this->buffer, this->buffer, 1);
-        resp = this->buffer[0];
-        if (BL_ACK == resp){
-            std::memset(this->buffer, BL_IDLE, 4);
-            this->buffer[0] = BL_ACK;
-            this->spi_transmit(this->buffer, NULL, 1);
-            // auto end = std::chrono::steady_clock::now();
-            // elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-            // this->logger->debug("ACK cost {:d} ms", elapsed);
-            return DebuggerExecutingNormal;
+
+Stm32ErasePolicy_t STM32XXX::get_erase_policy()
+{
+    return this->erase_policy;
+}
+
+
+void STM32XXX::set_blank_skip(bool enable)
+{
+    this->blank_skip = enable;
+}
+
+
+bool STM32XXX::get_blank_skip()
+{
+    return this->blank_skip;
+}
+
+
+void STM32XXX::set_read_cache(bool enable)
+{
+    this->read_caching = enable;
+    this->read_cache.clear();
+}
+
+
+ReadCacheStatistics_t STM32XXX::read_cache_statistics()
+{
+    return this->read_cache.statistics();
+}
+
+
+bool STM32XXX::blank_frame(uint32_t addr, const uint8_t* data, uint32_t size)
+{
+    // the erased flash already holds the frame
+    return this->blank_skip && DbgrMemIsFill(data, size, 0xff) && this->erased.contains(addr, (uint64_t)addr + size);
+}
+
+
+void STM32XXX::resolve_profile()
+{
+    // once per object: Get ID if not answered yet, then the profile of the PID, NULL for an unknown part
+    if (this->profile_resolved){
+        return;
+    }
+    uint8_t id[BL_MAX_FRAME_SIZE_B];
+    int length = 0;
+    if ((this->chip_pid < 0) && (DebuggerExecutingNormal != this->get_id_cmd(id, length))){
+        this->logger->warn("Get ID fail, chip profile unknown.");
+        return;
+    }
+    this->profile_resolved = true;
+    this->profile = stm32_chip_profile(this->chip_pid);
+    if (this->profile){
+        this->logger->info("PID 0x{:04x}: {}", this->chip_pid, this->profile->name);
+    }
+}
+
+
+uint32_t STM32XXX::bank_size()
+{
+    // bank 2 starts in the middle of the flash of a dual-bank part, 0 for single-bank or unknown parts
+    this->resolve_profile();
+    if (! (this->profile && this->profile->dual_bank)){
+        return 0;
+    }
+    this->page_size();  // resolves the bank mode
+    if (this->single_bank){
+        return 0;
+    }
+    if (0 == this->flash_size){
+        uint8_t size_kb[2] = {0};
+        if (DebuggerExecutingNormal != this->read_memory_cmd(this->profile->flash_size_addr, size_kb, 2)){
+            this->logger->warn("Read flash size fail, line {:d}.", __LINE__);
+            return 0;
         }
-        else if (BL_NAK == resp){
-            std::memset(this->buffer, BL_IDLE, 4);
-            this->buffer[0] = BL_ACK;
-            this->spi_transmit(this->buffer, NULL, 1);
-            // auto end = std::chrono::steady_clock::now();
-            // elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-            // this->logger->debug("NACK cost {:d} ms", elapsed);
-            return DebuggerExecutingHardwareFault;
+        this->flash_size = (size_kb[0] | (size_kb[1] << 8)) * 1024;
+    }
+    return this->flash_size / 2;
+}
+
+
+uint32_t STM32XXX::program_unit()
+{
+    this->resolve_profile();
+    return this->profile? this->profile->program_unit: STM32_PROGRAM_UNIT_B;
+}
+
+
+bool STM32XXX::in_flash(uint32_t addr, uint32_t size)
+{
+    return (addr >= STM32_FLASH_BASE) && ((uint64_t)addr + size <= (uint64_t)STM32_FLASH_BASE + STM32_FLASH_SPAN_B);
+}
+
+
+bool STM32XXX::in_sram(uint32_t addr, uint32_t size)
+{
+    return (addr >= STM32_SRAM_BASE) && ((uint64_t)addr + size <= (uint64_t)STM32_SRAM_BASE + STM32_SRAM_SPAN_B);
+}
+
+
+uint32_t STM32XXX::write_once_unit(uint32_t addr)
+{
+    return this->in_flash(addr, 1)? this->program_unit(): 0;
+}
+
+
+DebuggerExecutingState_t STM32XXX::read_unit(uint32_t addr, uint8_t* data, uint32_t unit)
+{
+    // target content of one program unit, no read when it is known erased
+    if (this->erased.contains(addr, (uint64_t)addr + unit)){
+        std::memset(data, 0xff, unit);
+        return DebuggerExecutingNormal;
+    }
+    return this->read_memory_cmd(addr, data, unit);
+}
+
+
+DebuggerExecutingState_t STM32XXX::stage_aligned(uint32_t& addr, const uint8_t*& data, uint32_t& size)
+{
+    /*
+    The L4 flash programs 64-bit double-words: the bootloader pads a short tail and merges an unaligned head by
+    read-modify-write, and a double-word shared by two frames is programmed twice. A flash write with an unaligned
+    head or tail is widened here to whole program units, the added bytes keep the target content: 0xFF where
+    known erased, else read back. Every frame of the write then starts and ends on a unit.
+    RAM and option bytes are written as given.
+    */
+    DebuggerExecutingState_t stat;
+
+    if (! this->in_flash(addr, size)){
+        return DebuggerExecutingNormal;
+    }
+    uint32_t unit = this->program_unit();
+    uint32_t start = addr - addr % unit;
+    uint64_t end = ((uint64_t)addr + size + unit - 1) / unit * unit;
+    bool head = (start < addr);
+    bool tail = (end > (uint64_t)addr + size);
+    if (! (head || tail)){
+        return DebuggerExecutingNormal;
+    }
+
+    this->staging.resize(end - start);
+    uint8_t* stage = this->staging.data();
+    if (head){
+        stat = this->read_unit(start, stage, unit);
+        if (DebuggerExecutingNormal != stat){
+            this->logger->error("Read head addr 0x{:08x} fail, line {:d}.", start, __LINE__);
+            return stat;
         }
-        else {
+    }
+    if (tail && ! (head && (end - unit == start))){
+        stat = this->read_unit(end - unit, stage + (end - unit - start), unit);
+        if (DebuggerExecutingNormal != stat){
+            this->logger->error("Read tail addr 0x{:08x} fail, line {:d}.", (uint32_t)(end - unit), __LINE__);
+            return stat;
+        }
+    }
+    std::memcpy(stage + (addr - start), data, size);
+    this->logger->debug("Write addr 0x{:08x} size {:d} widened to 0x{:08x} size {:d}", addr, size, start, this->staging.size());
+    addr = start;
+    data = stage;
+    size = this->staging.size();
+    return DebuggerExecutingNormal;
+}
+
+
+void STM32XXX::resolve_write_workaround()
+{
+    /* Read back only where AN2606 lists the write limitation, a part that cannot be identified keeps WA2 per frame. */
+    if (Stm32WriteWorkaroundAuto != this->write_workaround){
+        return;
+    }
+    this->write_workaround = Stm32WriteWorkaroundReadback;
+
+    this->resolve_profile();
+    if (! this->profile_resolved){
+        this->logger->warn("Get ID fail, keep write readback (AN2606 WA2).");
+        return;
+    }
+    this->write_workaround = Stm32WriteWorkaroundNone;
+    if (this->profile && this->profile->write_defect_bootloader_id){
+        // the bootloader ID in system memory is the bootloader version
+        uint8_t bootloader_id = 0;
+        if (DebuggerExecutingNormal != this->read_memory_cmd(this->profile->bootloader_id_addr, &bootloader_id, 1)){
+            this->logger->warn("Read bootloader ID fail, keep write readback (AN2606 WA2).");
+            bootloader_id = this->profile->write_defect_bootloader_id;
+        }
+        if (this->profile->write_defect_bootloader_id == bootloader_id){
+            this->write_workaround = Stm32WriteWorkaroundSectorReadback;
+        }
+    }
+    this->logger->info("PID 0x{:04x}, write workaround {:d}", this->chip_pid, int(this->write_workaround));
+}
+
+
+uint32_t STM32XXX::busy_estimate(Stm32WaitKind_t kind, uint32_t units, uint32_t& sleep_percent)
+{
+    // the learned busy time once the bucket has samples, else the wait model
+    const Stm32WaitModel_t& model = this->wait_models[kind];
+    uint64_t busy_us = model.base_us + (uint64_t)units * model.unit_us;
+    busy_us = std::min<uint64_t>(busy_us, UINT32_MAX);
+    sleep_percent = model.sleep_percent;
+
+    uint32_t learned_us = 0;
+    if (this->ack_learning && this->ack_model.estimate(kind, units, learned_us)){
+        busy_us = learned_us;
+        sleep_percent = std::min<uint32_t>(sleep_percent, ACK_MODEL_MAX_SLEEP_PERCENT);
+    }
+    return busy_us;
+}
+
+
+void STM32XXX::expect(Stm32WaitKind_t kind, uint32_t units, bool full_sleep)
+{
+    // the next ACK wait sleeps through sleep_percent of the busy time, then polls
+    uint32_t sleep_percent = 0;
+    uint32_t busy_us = this->busy_estimate(kind, units, sleep_percent);
+    if (full_sleep){
+        // no poll before the end of the busy time, the wait measures the sleep and is not learned
+        this->pending_kind = -1;
+        this->link->expect_busy(busy_us, busy_us);
+        return;
+    }
+    this->pending_kind = kind;
+    this->pending_units = units;
+    this->link->expect_busy(busy_us, busy_us * sleep_percent / 100);
+}
+
+
+void STM32XXX::learn(DebuggerExecutingState_t stat)
+{
+    // only an ACK measures the busy time, a NAK comes before the flash operation
+    if (this->ack_learning && (this->pending_kind >= 0) && (DebuggerExecutingNormal == stat)){
+        this->ack_model.observe(this->pending_kind, this->pending_units, this->link->last_busy_us());
+    }
+    this->pending_kind = -1;
+}
+
+
+void STM32XXX::identify()
+{
+    if (! (this->ack_learning && (this->chip_pid >= 0) && (this->bl_version >= 0))){
+        return;
+    }
+    if (this->ack_model.bind(this->chip_pid, this->bl_version) && (! this->ack_model_file.empty())){
+        if (DebuggerExecutingNormal == this->ack_model.load(this->ack_model_file.c_str())){
+            this->logger->info("ACK model of PID 0x{:04x} BL 0x{:02x} loaded from {}", this->chip_pid, this->bl_version, this->ack_model_file);
         }
-        auto end = std::chrono::steady_clock::now();
-        elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-        // std::cout<< "elapsed " << elapsed << " ms"<< std::endl;
-    }while(elapsed < timeout_ms);
-    // std::cout<< "ack timeout " << std::dec << timeout_ms << " ms" << std::endl;
-    this->logger->error("ACK wait timeout {:d} ms", timeout_ms);
-    return DebuggerExecutingHardwareBusy;
+    }
+}
+
+
+DebuggerExecutingState_t STM32XXX::enable_ack_learning(char* file_name)
+{
+    this->ack_learning = true;
+    this->ack_model_file = file_name? file_name: "";
+    this->identify();
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t STM32XXX::save_ack_model()
+{
+    if (this->ack_model_file.empty()){
+        return DebuggerExecutingNormal;
+    }
+    if (! this->ack_model.bound()){
+        this->logger->warn("ACK model not saved, Get ID and Get Version never identified the part.");
+        return DebuggerExecutingParamFault;
+    }
+    DebuggerExecutingState_t stat = this->ack_model.save(this->ack_model_file.c_str());
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("file {} write fail, line {:d}.", this->ack_model_file, __LINE__);
+    }
+    return stat;
+}
+
+
+bool STM32XXX::ack_estimate(Stm32WaitKind_t kind, uint32_t units, uint32_t& busy_us)
+{
+    return this->ack_model.estimate(kind, units, busy_us);
+}
+
+
+static const uint8_t latency_commands[ACK_LATENCY_COMMANDS] = {
+    BL_SPI_SOF, GET_CMD_COMMAND, GET_VER_COMMAND, GET_ID_COMMAND, RMEM_COMMAND, GO_COMMAND,
+    WMEM_COMMAND, EMEM_COMMAND, WP_COMMAND, WU_COMMAND, RP_COMMAND, RU_COMMAND, GET_CHECKSUM_COMMAND,
+};
+
+
+Stm32LatencyHistogram* STM32XXX::ack_latency(uint8_t command, Stm32AckOutcome_t outcome)
+{
+    const uint8_t* it = std::find(latency_commands, latency_commands + ACK_LATENCY_COMMANDS, command);
+    if ((it == latency_commands + ACK_LATENCY_COMMANDS) || (! ((outcome >= 0) && (outcome < Stm32AckOutcomeCount)))){
+        return NULL;
+    }
+    return &this->latency[it - latency_commands][outcome];
+}
+
+
+void STM32XXX::reset_ack_latency()
+{
+    for (auto& command: this->latency){
+        for (auto& histogram: command){
+            histogram.reset();
+        }
+    }
+}
+
+
+void STM32XXX::record_ack(std::chrono::steady_clock::time_point start, DebuggerExecutingState_t stat)
+{
+    // transport errors are not an ACK wait outcome
+    Stm32AckOutcome_t outcome;
+    switch (stat)
+    {
+    case DebuggerExecutingNormal:           outcome = Stm32AckOutcomeAck; break;
+    case DebuggerExecutingHardwareFault:    outcome = Stm32AckOutcomeNak; break;
+    case DebuggerExecutingHardwareBusy:     outcome = Stm32AckOutcomeTimeout; break;
+    default: return;
+    }
+    Stm32LatencyHistogram* histogram = this->ack_latency(this->command, outcome);
+    if (histogram){
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        histogram->record(std::min<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(), UINT32_MAX));
+    }
+}
+
+
+uint8_t complement(uint8_t data)
+{
+    return data ^ 0xff;
+}
+
+
+uint8_t xor_checksum(uint8_t data[], int length)
+{
+    return DbgrMemXor(data, length);
+}
+
+
+DebuggerExecutingState_t STM32XXX::spi_transmit(uint8_t anWriteList[], uint8_t anReadList[], uint32_t nTransmitLength)
+{
+    return this->link->spi_transmit(anWriteList, anReadList, nTransmitLength);
+}
 
+
+DebuggerExecutingState_t STM32XXX::is_ack_ok(uint32_t timeout_ms)
+{
+    auto start = std::chrono::steady_clock::now();
+    DebuggerExecutingState_t stat = this->link->is_ack_ok(timeout_ms);
+    this->record_ack(start, stat);
+    this->learn(stat);
+    return stat;
 }
 
 DebuggerExecutingState_t STM32XXX::init()
@@ -125,6 +467,9 @@ DebuggerExecutingState_t STM32XXX::init()
 
     uint8_t resp=0;
 
+    this->command = BL_SPI_SOF;
+    this->erased.clear();
+    this->read_cache.clear();
     std::memset(this->buffer, BL_IDLE, 4);
     this->buffer[0] = BL_SPI_SOF;
     this->spi_transmit(this->buffer, this->buffer, 1);
@@ -137,7 +482,7 @@ DebuggerExecutingState_t STM32XXX::init()
 }
 
 
-DebuggerExecutingState_t STM32XXX::send_command_frame(uint8_t command)
+DebuggerExecutingState_t STM32XXX::send_command_frame(uint8_t command, bool defer_echo)
 {
     /* 
         Command Frame:
@@ -145,17 +490,18 @@ DebuggerExecutingState_t STM32XXX::send_command_frame(uint8_t command)
         MOSI: |0x5A|Cmd Code|Cmd XOR|  |0x00|0x00|0x79|
         MISO: | xx | xx     | xx    |  | xx |0x79| xx |
     */
-    std::memset(this->buffer, BL_IDLE, 4);
-    this->buffer[0] = BL_SPI_SOF;
-    this->buffer[1] = command;
-    this->buffer[2] = complement(command);
+    // not in buffer: the data frame of Write Memory may already be built there
+    uint8_t frame[4] = {BL_SPI_SOF, command, complement(command), BL_IDLE};
+    this->command = command;
 
-    this->spi_transmit(this->buffer, NULL, 3);
-    return this->is_ack_ok();
+    auto start = std::chrono::steady_clock::now();
+    DebuggerExecutingState_t stat = this->link->send_data_frame(frame, 3, WAIT_ACK_TIMEOUT_MS, defer_echo);
+    this->record_ack(start, stat);
+    return stat;
 }
 
 
-DebuggerExecutingState_t STM32XXX::send_data_frame(uint8_t data[], int length)
+DebuggerExecutingState_t STM32XXX::send_data_frame(uint8_t data[], int length, bool defer_echo)
 {
     /*
     Command Frame:
@@ -163,12 +509,15 @@ DebuggerExecutingState_t STM32XXX::send_data_frame(uint8_t data[], int length)
         MOSI: | D1 | D2 | D3 |  |0x00|0x00|0x79|
         MISO: | xx | xx | xx |  | xx |0x79| xx |
     */
-    assert(length <= BL_MAX_FRAME_SIZE_B);
+    assert(length <= BL_MAX_FRAME_SIZE_B + 2);  // write frame: Number + 256*Data + checksum
     assert(length > 0);
     assert(data);
 
-    this->spi_transmit(data, NULL, length);
-    return this->is_ack_ok();
+    auto start = std::chrono::steady_clock::now();
+    DebuggerExecutingState_t stat = this->link->send_data_frame(data, length, WAIT_ACK_TIMEOUT_MS, defer_echo);
+    this->record_ack(start, stat);
+    this->learn(stat);
+    return stat;
 }
 
 
@@ -257,6 +606,10 @@ DebuggerExecutingState_t STM32XXX::get_version_cmd(uint8_t& version)
     this->receive_data_frame(2);
     version = this->buffer[1];
     stat = this->is_ack_ok();
+    if (DebuggerExecutingNormal == stat){
+        this->bl_version = version;
+        this->identify();
+    }
     return stat;
 }
 
@@ -304,24 +657,39 @@ DebuggerExecutingState_t STM32XXX::get_id_cmd(uint8_t id[], int& length)
         this->logger->error("ACK error, line {:d}", __LINE__);
         return stat;
     }
+    if (length >= 2){
+        this->chip_pid = (id[0] << 8) | id[1];
+        this->identify();
+    }
     return DebuggerExecutingNormal;
 }
 
 
-DebuggerExecutingState_t STM32XXX::send_addr_frame(uint32_t addr)
+DebuggerExecutingState_t STM32XXX::send_addr_frame(uint32_t addr, bool defer_echo)
+{
+    return this->send_word_frame(addr, defer_echo);
+}
+
+
+void STM32XXX::build_word_frame(uint8_t frame[], uint32_t word)
+{
+    // 4 bytes, byte 1 being the MSB, and byte 4 being the LSB
+    frame[0] = ((word >> 24) & 0xff);
+    frame[1] = ((word >> 16) & 0xff);
+    frame[2] = ((word >> 8) & 0xff);
+    frame[3] = ((word >> 0) & 0xff);
+    frame[4] = xor_checksum(frame, 4);
+}
+
+
+DebuggerExecutingState_t STM32XXX::send_word_frame(uint32_t word, bool defer_echo)
 {
-    // address 4 bytes, byte 1 being the MSB, and byte 4 being the LSB
-    std::memset(this->buffer, BL_IDLE, 8);
-    this->buffer[0] = ((addr >> 24) & 0xff);
-    this->buffer[1] = ((addr >> 16) & 0xff);
-    this->buffer[2] = ((addr >> 8) & 0xff);
-    this->buffer[3] = ((addr >> 0) & 0xff);
-    this->buffer[4] = xor_checksum(this->buffer, 4);
-    return this->send_data_frame(this->buffer, 5);
+    this->build_word_frame(this->buffer, word);
+    return this->send_data_frame(this->buffer, 5, defer_echo);
 }
 
 
-DebuggerExecutingState_t STM32XXX::send_size_frame(int size)
+DebuggerExecutingState_t STM32XXX::send_size_frame(int size, bool defer_echo)
 {
     assert(size > 0);
     assert(size <= BL_MAX_FRAME_SIZE_B);
@@ -331,7 +699,7 @@ DebuggerExecutingState_t STM32XXX::send_size_frame(int size)
     std::memset(this->buffer, BL_IDLE, 4);
     this->buffer[0] = _size;
     this->buffer[1] = complement(_size);
-    return this->send_data_frame(this->buffer, 2);
+    return this->send_data_frame(this->buffer, 2, defer_echo);
 }
 
 
@@ -351,19 +719,22 @@ DebuggerExecutingState_t STM32XXX::read_memory_cmd(uint32_t addr, uint8_t data[]
         return DebuggerExecutingParamFault;
     }
 
+    /*
+    4 bus transactions when the ACKs are ready at the first poll, every ACK echo leads the next frame:
+        |0x5A|0x11|0xEE|0x00|0x00|  |0x79|ADDR|XOR|0x00|0x00|  |0x79|N|~N|0x00|0x00|  |0x79|DUMMY|DATA...|
+    */
     DebuggerExecutingState_t stat;
-    stat = this->send_command_frame(RMEM_COMMAND);
-    if 
-        (DebuggerExecutingNormal != stat){
+    stat = this->send_command_frame(RMEM_COMMAND, true);
+    if (DebuggerExecutingNormal != stat){
         this->logger->error("Send RMEM_COMMAND ACK error or Protection active.");
         return stat;
     }
-    stat = this->send_addr_frame(addr);
+    stat = this->send_addr_frame(addr, true);
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Send addr ACK error, line {:d}.", __LINE__);
         return stat;
     }
-    stat = this->send_size_frame(size);
+    stat = this->send_size_frame(size, true);
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Send size ACK error, line {:d}.", __LINE__);
         return stat;
@@ -397,46 +768,79 @@ DebuggerExecutingState_t STM32XXX::write_memory_cmd(uint32_t addr, const uint8_t
     // assert(size > 0);
     // assert(size <= BL_MAX_FRAME_SIZE_B);
 
-    DebuggerExecutingState_t stat;
-
-
     if (! ((size > 0) && (size <= BL_MAX_FRAME_SIZE_B))){
         this->logger->error("param error.");
         return DebuggerExecutingParamFault;
     }
 
-    stat = this->send_command_frame(WMEM_COMMAND);
+    uint8_t addr_frame[5];
+    this->build_word_frame(addr_frame, addr);
+    int length = this->build_write_frame(this->buffer, data, size);
+    return this->write_frame_cmd(addr, addr_frame, this->buffer, length);
+}
+
+
+DebuggerExecutingState_t STM32XXX::write_frame_cmd(uint32_t addr, uint8_t addr_frame[], uint8_t frame[], int length)
+{
+    // Write Memory with the address frame and the data frame already built
+    DebuggerExecutingState_t stat;
+    int size = length - 2;
+
+    // flash is programmed by double-words, even a failed write may have programmed some
+    this->erased.remove(addr & ~7U, ((uint64_t)addr + size + 7) & ~7ULL);
+    if (! (this->in_flash(addr, size) || this->in_sram(addr, size))){
+        // option bytes: the part resets with them, an RDP regression mass erases the flash, the bank mode may change
+        this->erased.clear();
+        this->read_cache.clear();
+        this->flash_page_size = 0;
+        this->single_bank = false;
+    }
+    this->read_cache.invalidate(addr, (uint64_t)addr + size);
+    stat = this->send_command_frame(WMEM_COMMAND, true);
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Send WMEM_COMMAND ACK error or Protection active.");
         return stat;
     }
 
-    stat = this->send_addr_frame(addr);
+    stat = this->send_data_frame(addr_frame, 5, true);
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Send addr ACK error, line {:d}.", __LINE__);
         return stat;
     }
-    // send data
-    std::memset(this->buffer, BL_IDLE, sizeof(this->buffer));
-    this->buffer[0] = size - 1;
-    std::copy(data, data + size, this->buffer + 1);
-
-    // word (16-bit) aligned
-    if (size % 2){
-        this->buffer[0] = size;
-        this->buffer[size + 1] = 0xff;
-        size += 1;
+    // send data, the echo of the addr ACK leads this frame
+    if (Stm32WriteWorkaroundDelay == this->write_workaround){
+        this->expect(Stm32WaitWriteMemory, BL_MAX_FRAME_SIZE_B / 8, true);  // AN2606 WA1
     }
-
-    this->buffer[size + 1] = xor_checksum(this->buffer, size + 1);
-    stat = this->send_data_frame(this->buffer, size + 2);  // Number + size + checksum
+    else {
+        this->expect(Stm32WaitWriteMemory, (addr % 8 + size + 7) / 8);
+    }
+    stat = this->send_data_frame(frame, length);  // Number + size + checksum
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Send data ACK error, line {:d}.", __LINE__);
         return stat;
     }
+    this->result.bytes_programmed += size;
     return DebuggerExecutingNormal;
+}
 
+
+int STM32XXX::build_write_frame(uint8_t frame[], const uint8_t* data, int size)
+{
+    /* Number + data padded with 0xFF to a word (16-bit) + checksum, the copy and the checksum in one pass.
+       Only the frame bytes are written, the rest of the buffer is never sent. */
+    int padded = size + (size % 2);
+
+    frame[0] = padded - 1;
+    uint8_t checksum = frame[0] ^ DbgrMemCopyXor(frame + 1, data, size);
+    if (padded > size){
+        frame[padded] = 0xff;
+        checksum ^= 0xff;
+    }
+    frame[padded + 1] = checksum;
+    return padded + 2;
 }
+
+
 DebuggerExecutingState_t STM32XXX::erase_memory_cmd(uint32_t start_page, uint32_t page_num)
 {
     /*
@@ -470,56 +874,116 @@ DebuggerExecutingState_t STM32XXX::erase_memory_cmd(uint32_t start_page, uint32_
         return DebuggerExecutingParamFault;
     }
 
+    if ((num & 0xfff0) != 0xfff0){
+        std::vector<uint32_t> pages(page_num);
+        for (uint32_t i=0; i<page_num; ++i){
+            pages[i] = start_page + i;
+        }
+        return this->erase_page_list(pages.data(), page_num);
+    }
+
     DebuggerExecutingState_t stat;
+    this->read_cache.clear();
     stat = this->send_command_frame(EMEM_COMMAND);
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Send EMEM_COMMAND ACK error or Protection active.");
         return stat;
     }
 
-    // Send data frame: start sector(2 Bytes), the number of pages or sectors to be erased + checksum (1 Byte)
+    // Send data frame: special erase code (2 Bytes) + checksum (1 Byte)
     std::memset(this->buffer, BL_IDLE, 4);
     this->buffer[0] = (num >> 8) & 0xff;
     this->buffer[1] = num & 0xff;
     this->buffer[2] = xor_checksum(this->buffer, 2);
+    this->expect(Stm32WaitMassErase, 1);
     stat = this->send_data_frame(this->buffer, 3);
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Send data ACK error, line {:d}.", __LINE__);
         return stat;
     }
+    if (0xffff == num){
+        this->erased.insert(STM32_FLASH_BASE, (uint64_t)STM32_FLASH_BASE + STM32_FLASH_SPAN_B);
+    }
+    else if (((0xfffe == num) || (0xfffd == num)) && this->profile && this->profile->dual_bank && this->flash_size){
+        uint32_t bank_start = STM32_FLASH_BASE + ((0xfffe == num)? 0: this->flash_size / 2);
+        this->erased.insert(bank_start, (uint64_t)bank_start + this->flash_size / 2);
+    }
+    return DebuggerExecutingNormal;
+}
 
-    // If non-special erase, send sector size (2 Bytes) + checksum (1 Byte)
-    if ((num & 0xfff0) != 0xfff0){
-        uint8_t checksum = 0x00;
-        int buff_index = 0;
-        std::memset(this->buffer, BL_IDLE, sizeof(this->buffer));
-        for (int i=start_page; i < (start_page + num); ++i)
-        {
-            if (buff_index < (BL_MAX_FRAME_SIZE_B)){
-                this->buffer[buff_index] = (i >> 8) & 0xff;
-                this->buffer[buff_index + 1] = i & 0xff;
-                buff_index += 2;
-            }
-            else {
-                this->spi_transmit(this->buffer, NULL, buff_index);
-                checksum ^= xor_checksum(this->buffer, buff_index);
-                buff_index = 0;
-                std::memset(this->buffer, BL_IDLE, sizeof(this->buffer));
-            }
+
+DebuggerExecutingState_t STM32XXX::erase_page_list(const uint32_t pages[], uint32_t page_num)
+{
+    /*
+    Erase any set of pages with one EMEM command:
+        the number of pages - 1 (2 Bytes) + checksum (1 Byte), ACK,
+        the page numbers (2 Bytes each, MSB first) + checksum of them (1 Byte), ACK after the erase.
+    */
+    assert(pages);
+
+    if (! ((page_num > 0) && (page_num < 0xfff0))){
+        this->logger->error("param page_num {:d} error, line {:d}.", page_num, __LINE__);
+        return DebuggerExecutingParamFault;
+    }
+    for (uint32_t i=0; i<page_num; ++i){
+        if (pages[i] > 0xffff){
+            this->logger->error("param page {:d} error, line {:d}.", pages[i], __LINE__);
+            return DebuggerExecutingParamFault;
         }
-        if (buff_index > 0){
+    }
+
+    DebuggerExecutingState_t stat;
+    uint32_t page_size = this->page_size();  // before the command, it may read the option bytes
+    for (uint32_t i=0; i<page_num; ++i){
+        this->read_cache.invalidate(STM32_FLASH_BASE + (uint64_t)pages[i] * page_size,
+                                    STM32_FLASH_BASE + (uint64_t)(pages[i] + 1) * page_size);
+    }
+    stat = this->send_command_frame(EMEM_COMMAND);
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("Send EMEM_COMMAND ACK error or Protection active.");
+        return stat;
+    }
+
+    uint32_t num = page_num - 1;
+    std::memset(this->buffer, BL_IDLE, 4);
+    this->buffer[0] = (num >> 8) & 0xff;
+    this->buffer[1] = num & 0xff;
+    this->buffer[2] = xor_checksum(this->buffer, 2);
+    stat = this->send_data_frame(this->buffer, 3);
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("Send data ACK error, line {:d}.", __LINE__);
+        return stat;
+    }
+
+    // the checksum is folded in while the page codes are stored
+    uint8_t checksum = 0x00;
+    int buff_index = 0;
+    for (uint32_t i=0; i < page_num; ++i)
+    {
+        this->buffer[buff_index] = (pages[i] >> 8) & 0xff;
+        this->buffer[buff_index + 1] = pages[i] & 0xff;
+        checksum ^= this->buffer[buff_index] ^ this->buffer[buff_index + 1];
+        buff_index += 2;
+        if (buff_index >= BL_MAX_FRAME_SIZE_B){
             this->spi_transmit(this->buffer, NULL, buff_index);
-            checksum ^= xor_checksum(this->buffer, buff_index);
-        }
-        std::memset(this->buffer, BL_IDLE, 4);
-        this->buffer[0] = checksum;
-        this->spi_transmit(this->buffer, NULL, 1);
-        stat = this->is_ack_ok(ERASE_ACK_TIMEOUT_MS);  // 256 pages need 5.7s
-        if (DebuggerExecutingNormal != stat){
-            this->logger->error("Erase Send data ACK error {:d}, line {:d}.", int(stat), __LINE__);
-            return stat;
+            buff_index = 0;
         }
     }
+    if (buff_index > 0){
+        this->spi_transmit(this->buffer, NULL, buff_index);
+    }
+    this->buffer[0] = checksum;
+    this->spi_transmit(this->buffer, NULL, 1);
+    this->expect(Stm32WaitErasePages, page_num);
+    stat = this->is_ack_ok(WAIT_ACK_TIMEOUT_MS + page_num * ERASE_PAGE_TIMEOUT_MS);
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("Erase {:d} pages ACK error {:d}, line {:d}.", page_num, int(stat), __LINE__);
+        return stat;
+    }
+    for (uint32_t i=0; i<page_num; ++i){
+        this->erased.insert(STM32_FLASH_BASE + (uint64_t)pages[i] * page_size,
+                            STM32_FLASH_BASE + (uint64_t)(pages[i] + 1) * page_size);
+    }
     return DebuggerExecutingNormal;
 }
 
@@ -531,6 +995,9 @@ DebuggerExecutingState_t STM32XXX::go_cmd(uint32_t addr)
     */
     DebuggerExecutingState_t stat;
 
+    this->erased.clear();  // the application may write the flash
+    this->read_cache.clear();
+
     stat = this->send_command_frame(GO_COMMAND);
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Send GO_COMMAND ACK error or Protection active.");
@@ -564,6 +1031,7 @@ DebuggerExecutingState_t STM32XXX::write_protect_cmd(uint32_t start_page, uint32
     uint32_t num = page_num - 1;
     DebuggerExecutingState_t stat;
 
+    this->read_cache.clear();  // option bytes change, the part resets
     stat = this->send_command_frame(WP_COMMAND);
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Send WP_COMMAND ACK error or Protection active.");
@@ -584,6 +1052,7 @@ DebuggerExecutingState_t STM32XXX::write_protect_cmd(uint32_t start_page, uint32
     this->buffer[0] = start_page;
     this->buffer[1] = start_page + num;
     this->buffer[2] = xor_checksum(this->buffer, 2);
+    this->expect(Stm32WaitProtection, 1);
     stat = this->send_data_frame(this->buffer, 3);
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Write protect data checksum fail!!!, line {:d}.", __LINE__);
@@ -603,12 +1072,13 @@ DebuggerExecutingState_t STM32XXX::write_unprotect_cmd()
     */
     DebuggerExecutingState_t stat;
 
+    this->read_cache.clear();  // option bytes change, the part resets
     stat = this->send_command_frame(WU_COMMAND);
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Send WU_COMMAND ACK error or Protection active.");
         return stat;
     }
-    DbgrDelayMs(BL_PROCESSING_DELAY_MS);
+    this->expect(Stm32WaitProtection, 1);
 
     std::memset(this->buffer, BL_IDLE, 4);
     this->buffer[0] = BL_IDLE;
@@ -632,12 +1102,13 @@ DebuggerExecutingState_t STM32XXX::readout_protect_cmd()
     */
     DebuggerExecutingState_t stat;
 
+    this->read_cache.clear();  // option bytes change, the part resets
     stat = this->send_command_frame(RP_COMMAND);
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Send RP_COMMAND ACK error or RDP active.");
         return stat;
     }
-    DbgrDelayMs(BL_PROCESSING_DELAY_MS);
+    this->expect(Stm32WaitProtection, 1);
 
     stat = this->is_ack_ok();
     if (DebuggerExecutingNormal != stat){
@@ -658,12 +1129,13 @@ DebuggerExecutingState_t STM32XXX::readout_unprotect_cmd()
     */
     DebuggerExecutingState_t stat;
 
+    this->read_cache.clear();  // option bytes change and the flash is mass erased
     stat = this->send_command_frame(RU_COMMAND);
     if (DebuggerExecutingNormal != stat){
         this->logger->error("Send RU_COMMAND ACK error.");
         return stat;
     }
-    DbgrDelayMs(BL_PROCESSING_DELAY_MS);
+    this->expect(Stm32WaitProtection, 1);
 
     std::memset(this->buffer, BL_IDLE, 4);
     this->buffer[0] = BL_IDLE;
@@ -675,14 +1147,13 @@ DebuggerExecutingState_t STM32XXX::readout_unprotect_cmd()
 
     DbgrDelayMs(RESET_DELAY_MS);
     this->init();
+    this->erased.insert(STM32_FLASH_BASE, (uint64_t)STM32_FLASH_BASE + STM32_FLASH_SPAN_B);  // RDP regression mass erased the flash
     return DebuggerExecutingNormal;
 }
 
 
-DebuggerExecutingState_t STM32XXX::write(uint32_t addr, const uint8_t* data, uint32_t size)
+DebuggerExecutingState_t STM32XXX::write_frames(uint32_t addr, const uint8_t* data, uint32_t size)
 {
-    assert(data);
-
     DebuggerExecutingState_t stat;
 
     uint32_t finish_size = 0;
@@ -691,51 +1162,153 @@ DebuggerExecutingState_t STM32XXX::write(uint32_t addr, const uint8_t* data, uin
     while (finish_size < size)
     {
         tmp_size = (size - finish_size < BL_MAX_FRAME_SIZE_B)? (size - finish_size):BL_MAX_FRAME_SIZE_B;
+        if (this->blank_frame(addr + finish_size, data + finish_size, tmp_size)){
+            this->result.bytes_skipped += tmp_size;
+            finish_size += tmp_size;
+            continue;
+        }
         stat = this->write_memory_cmd(addr + finish_size, data + finish_size, tmp_size);
         if (DebuggerExecutingNormal != stat){
             this->logger->error(">> write addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr + finish_size, tmp_size,  __LINE__);
             return stat;
         }
-        // ----- read and verify -----
-        /*
-        Reference AN2606 for the W2 solution to fix write operation fail limitation. 
+        finish_size += tmp_size;
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t STM32XXX::readback_rewrite(uint32_t addr, const uint8_t* data, uint32_t size)
+{
+    /*
+    Reference AN2606 for the W2 solution to fix write operation fail limitation. 
 
-        AN2606-stm32-microcontroller-system-memory-boot-mode-stmicroelectronics
+    AN2606-stm32-microcontroller-system-memory-boot-mode-stmicroelectronics
 
-        STM32L45xxx/46xxx bootloader versions
-        V9.2 Version Known limitations:
+    STM32L45xxx/46xxx bootloader versions
+    V9.2 Version Known limitations:
 
-            SPI write operation fail limitation:
-            a. During Bootloader SPI write flash memory operation, some random 64-bits (2 double-words) may be left blank at 0xFF.
-            Root cause:
-                a. Bootloader uses 64-bits cast write operation which is interrupted by SPI DMA and it leads to double access on same flash memory address and the 64-bits are not written
-            Workarounds:
-                a. WA1: add a delay between sending write command and its ACK request. Its duration must be the duration of the 256-Bytes flash memory write time.
-                b. WA2: read back after write and in case of error start write again.
-                c. WA3: Patch in RAM to write in flash memory that implements write memory without 64-bits
+        SPI write operation fail limitation:
+        a. During Bootloader SPI write flash memory operation, some random 64-bits (2 double-words) may be left blank at 0xFF.
+        Root cause:
+            a. Bootloader uses 64-bits cast write operation which is interrupted by SPI DMA and it leads to double access on same flash memory address and the 64-bits are not written
+        Workarounds:
+            a. WA1: add a delay between sending write command and its ACK request. Its duration must be the duration of the 256-Bytes flash memory write time.
+            b. WA2: read back after write and in case of error start write again.
+            c. WA3: Patch in RAM to write in flash memory that implements write memory without 64-bits
 
-        */
-        for (int j=0; j < WRITE_MEM_RETRY_COUNT; ++j)
+    Passes over the chunk: every frame still to check is read back in consecutive Read Memory commands,
+    then the mismatched double-words are written again in consecutive Write Memory commands. The double-words
+    read back right are not sent again: the flash refuses to program a double-word twice (PROGERR).
+    */
+    assert(size <= WRITE_READBACK_SECTOR_B);
+
+    DebuggerExecutingState_t stat;
+    uint32_t unit = this->program_unit();
+    uint32_t base = addr - addr % unit;
+    uint32_t units = ((uint64_t)addr + size - base + unit - 1) / unit;
+    std::vector<bool> mismatched(units);
+    bool check[WRITE_READBACK_SECTOR_B / BL_MAX_FRAME_SIZE_B];
+    uint32_t frames = (size + BL_MAX_FRAME_SIZE_B - 1) / BL_MAX_FRAME_SIZE_B;
+    for (uint32_t i=0; i<frames; ++i)
+    {
+        // skipped blank frames were never written
+        uint32_t offset = i * BL_MAX_FRAME_SIZE_B;
+        check[i] = ! this->blank_frame(addr + offset, data + offset, std::min<uint32_t>(size - offset, BL_MAX_FRAME_SIZE_B));
+    }
+
+    for (int j=0; ; ++j)
+    {
+        uint32_t mismatches = 0;
+        std::fill(mismatched.begin(), mismatched.end(), false);
+        for (uint32_t i=0; i<frames; ++i)
         {
-            stat = this->read_memory_cmd(addr + finish_size, this->buffer, tmp_size);
+            if (! check[i]){
+                continue;
+            }
+            uint32_t offset = i * BL_MAX_FRAME_SIZE_B;
+            uint32_t tmp_size = std::min<uint32_t>(size - offset, BL_MAX_FRAME_SIZE_B);
+            stat = this->read_memory_cmd(addr + offset, this->buffer, tmp_size);
             if (DebuggerExecutingNormal != stat){
-                this->logger->error(">> read addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr + finish_size, tmp_size,  __LINE__);
+                this->logger->error(">> read addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr + offset, tmp_size,  __LINE__);
                 return stat;
             }
-            if (! std::equal(data + finish_size, data + finish_size + tmp_size, this->buffer))
+            check[i] = ! std::equal(data + offset, data + offset + tmp_size, this->buffer);
+            mismatches += check[i];
+            for (uint32_t k=0; check[i] && (k<tmp_size); ++k)
             {
-                this->logger->debug(">> verify addr 0x{:08x} size {:d} Bytes equal fail!!! and retry {:d} line {:d}", addr + finish_size, tmp_size, j, __LINE__);
-                stat = this->write_memory_cmd(addr + finish_size, data + finish_size, tmp_size);
-                if (DebuggerExecutingNormal != stat){
-                    this->logger->error(">> retry write addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", addr + finish_size, tmp_size,  __LINE__);
-                    return stat;
+                if (data[offset + k] != this->buffer[k]){
+                    mismatched[(addr + offset + k - base) / unit] = true;
+                }
+            }
         }
+        if (0 == mismatches){
+            return DebuggerExecutingNormal;
+        }
+        if (j >= WRITE_MEM_RETRY_COUNT){
+            this->logger->error(">> verify addr 0x{:08x} size {:d} Bytes, {:d} frames fail after {:d} retries!!! line {:d}", addr, size, mismatches, j, __LINE__);
+            return DebuggerExecutingProgrammingCheckoutError;
+        }
+        this->logger->debug(">> verify addr 0x{:08x} size {:d} Bytes, {:d} frames equal fail!!! and retry {:d} line {:d}", addr, size, mismatches, j, __LINE__);
+
+        // one frame per run of mismatched double-words
+        for (uint32_t first=0; first<units; )
+        {
+            if (! mismatched[first]){
+                ++first;
+                continue;
             }
-            else {
-                break;
+            uint32_t last = first + 1;
+            while ((last < units) && mismatched[last] && ((last - first) * unit < BL_MAX_FRAME_SIZE_B)){
+                ++last;
+            }
+            uint32_t start = std::max(addr, base + first * unit);
+            uint32_t end = std::min<uint64_t>((uint64_t)addr + size, base + (uint64_t)last * unit);
+            stat = this->write_memory_cmd(start, data + (start - addr), end - start);
+            if (DebuggerExecutingNormal != stat){
+                this->logger->error(">> retry write addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", start, end - start,  __LINE__);
+                return stat;
+            }
+            first = last;
+        }
+    }
+}
+
+
+DebuggerExecutingState_t STM32XXX::write(uint32_t addr, const uint8_t* data, uint32_t size)
+{
+    assert(data);
+
+    DebuggerExecutingState_t stat;
+
+    uint32_t finish_size = 0;
+    uint32_t tmp_size = 0;
+
+    this->resolve_write_workaround();
+    bool readback = (Stm32WriteWorkaroundReadback == this->write_workaround) ||
+                    (Stm32WriteWorkaroundSectorReadback == this->write_workaround);
+    stat = this->stage_aligned(addr, data, size);
+    if (DebuggerExecutingNormal != stat){
+        return stat;
+    }
+
+    while (finish_size < size)
+    {
+        // WA2 reads back every frame, the deferred readback a sector
+        tmp_size = (size - finish_size < BL_MAX_FRAME_SIZE_B)? (size - finish_size):BL_MAX_FRAME_SIZE_B;
+        if (Stm32WriteWorkaroundSectorReadback == this->write_workaround){
+            tmp_size = std::min(size - finish_size, WRITE_READBACK_SECTOR_B - (addr + finish_size) % WRITE_READBACK_SECTOR_B);
+        }
+        stat = this->write_frames(addr + finish_size, data + finish_size, tmp_size);
+        if (DebuggerExecutingNormal != stat){
+            return stat;
+        }
+        if (readback){
+            stat = this->readback_rewrite(addr + finish_size, data + finish_size, tmp_size);
+            if (DebuggerExecutingNormal != stat){
+                return stat;
             }
         }
-        // ----- read and verify -----
         finish_size += tmp_size;
         this->logger->debug(">> write addr 0x{:08x} size {:d} Bytes, finish size {:d}. line {:d}", addr + finish_size, tmp_size, finish_size,  __LINE__);
     }
@@ -743,12 +1316,118 @@ DebuggerExecutingState_t STM32XXX::write(uint32_t addr, const uint8_t* data, uin
 }
 
 
+DebuggerExecutingState_t STM32XXX::begin_pipeline()
+{
+    // what prepare_chunk reads on the producer thread is settled before it starts
+    this->resolve_write_workaround();
+    this->pipeline_unit = this->program_unit();
+    return DebuggerExecutingNormal;
+}
+
+
+void STM32XXX::prepare_chunk(uint32_t addr, ProgramChunk_t& chunk)
+{
+    /* The Write Memory frames of the chunk, split like write() does. A chunk with an unaligned head or tail
+       is left to write() on the bus thread, it widens the chunk with the target content. */
+    static_assert(sizeof(Stm32WriteFrame_t) * (ALIGN_SIZE_B / BL_MAX_FRAME_SIZE_B) <= PREPARED_SIZE_B, "frames of a chunk");
+
+    chunk.prepared_size = 0;
+    if ((addr % this->pipeline_unit) || (chunk.size % this->pipeline_unit)){
+        return;
+    }
+    Stm32WriteFrame_t* frames = (Stm32WriteFrame_t*)chunk.prepared;
+    uint32_t count = 0;
+    for (uint32_t offset=0; offset<chunk.size; offset+=BL_MAX_FRAME_SIZE_B)
+    {
+        Stm32WriteFrame_t& frame = frames[count++];
+        frame.addr = addr + offset;
+        frame.size = std::min<uint32_t>(chunk.size - offset, BL_MAX_FRAME_SIZE_B);
+        this->build_word_frame(frame.addr_frame, frame.addr);
+        frame.length = this->build_write_frame(frame.frame, chunk.data + offset, frame.size);
+    }
+    chunk.prepared_size = count * sizeof(Stm32WriteFrame_t);
+}
+
+
+DebuggerExecutingState_t STM32XXX::write_chunk(uint32_t addr, ProgramChunk_t& chunk)
+{
+    // the prepared frames in the order of write(), the readback workaround checks the whole chunk
+    DebuggerExecutingState_t stat;
+
+    if (0 == chunk.prepared_size){
+        return this->write(addr, chunk.data, chunk.size);
+    }
+    Stm32WriteFrame_t* frames = (Stm32WriteFrame_t*)chunk.prepared;
+    uint32_t count = chunk.prepared_size / sizeof(Stm32WriteFrame_t);
+    for (uint32_t i=0; i<count; ++i)
+    {
+        Stm32WriteFrame_t& frame = frames[i];
+        if (this->blank_frame(frame.addr, chunk.data + (frame.addr - addr), frame.size)){
+            this->result.bytes_skipped += frame.size;
+            continue;
+        }
+        stat = this->write_frame_cmd(frame.addr, frame.addr_frame, frame.frame, frame.length);
+        if (DebuggerExecutingNormal != stat){
+            this->logger->error(">> write addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", frame.addr, frame.size,  __LINE__);
+            return stat;
+        }
+    }
+    if ((Stm32WriteWorkaroundReadback == this->write_workaround) ||
+        (Stm32WriteWorkaroundSectorReadback == this->write_workaround)){
+        return this->readback_rewrite(addr, chunk.data, chunk.size);
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t STM32XXX::read_cached(uint32_t addr, uint8_t* data, uint32_t size)
+{
+    /* Every frame touched is read whole and kept. A frame the target does not read whole is partial,
+       its bytes are read as requested and kept one by one. */
+    DebuggerExecutingState_t stat;
+
+    uint64_t position = addr;
+    uint64_t end = (uint64_t)addr + size;
+    while (position < end)
+    {
+        uint32_t frame_addr = position - position % READ_CACHE_FRAME_B;
+        uint32_t offset = position - frame_addr;
+        uint32_t tmp_size = std::min<uint64_t>(end - position, READ_CACHE_FRAME_B - offset);
+        uint8_t* out = data + (position - addr);
+        if (! this->read_cache.lookup(frame_addr, offset, out, tmp_size)){
+            stat = DebuggerExecutingHardwareFault;
+            if (! this->read_cache.partial(frame_addr)){
+                stat = this->read_memory_cmd(frame_addr, this->cache_frame, READ_CACHE_FRAME_B);
+            }
+            if (DebuggerExecutingNormal == stat){
+                this->read_cache.insert(frame_addr, this->cache_frame);
+                std::memcpy(out, this->cache_frame + offset, tmp_size);
+            }
+            else {
+                stat = this->read_memory_cmd(position, out, tmp_size);
+                if (DebuggerExecutingNormal != stat){
+                    this->logger->error(">> read addr 0x{:08x} size {:d} Bytes fail!!! line {:d}", (uint32_t)position, tmp_size,  __LINE__);
+                    return stat;
+                }
+                this->read_cache.insert_partial(frame_addr, offset, out, tmp_size);
+            }
+        }
+        position += tmp_size;
+    }
+    return DebuggerExecutingNormal;
+}
+
+
 DebuggerExecutingState_t STM32XXX::read(uint32_t addr, uint8_t* data, uint32_t size)
 {
     assert(data);
 
     DebuggerExecutingState_t stat;
 
+    if (this->read_caching){
+        return this->read_cached(addr, data, size);
+    }
+
     uint32_t finish_size = 0;
     uint32_t tmp_size = 0;
     while (finish_size < size)
@@ -766,6 +1445,76 @@ DebuggerExecutingState_t STM32XXX::read(uint32_t addr, uint8_t* data, uint32_t s
 }
 
 
+DebuggerExecutingState_t STM32XXX::get_checksum_cmd(uint32_t addr, uint32_t size, uint32_t polynomial, uint32_t init, uint32_t& crc)
+{
+    /*
+    CRC of a memory area computed by the CRC unit of the target, bootloader protocol v1.3:
+        address, size in 32-bit words, CRC polynomial, CRC initial value: 4 Bytes MSB first + XOR each,
+        the ACK comes once the CRC is computed, then DUMMY + CRC (4 Bytes MSB first) + XOR + ACK.
+    addr and size are multiples of 4.
+    */
+    if (! ((0 == addr % 4) && (size > 0) && (0 == size % 4))){
+        this->logger->error("param error checksum addr 0x{:08x} size {:d}, line {:d}.", addr, size, __LINE__);
+        return DebuggerExecutingParamFault;
+    }
+
+    DebuggerExecutingState_t stat;
+    stat = this->send_command_frame(GET_CHECKSUM_COMMAND, true);
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("Send GET_CHECKSUM_COMMAND ACK error or Protection active.");
+        return stat;
+    }
+    stat = this->send_addr_frame(addr, true);
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("Send addr ACK error, line {:d}.", __LINE__);
+        return stat;
+    }
+    stat = this->send_word_frame(size / 4, true);
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("Send size ACK error, line {:d}.", __LINE__);
+        return stat;
+    }
+    stat = this->send_word_frame(polynomial, true);
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("Send polynomial ACK error, line {:d}.", __LINE__);
+        return stat;
+    }
+    this->expect(Stm32WaitChecksum, (size + 1023) / 1024);
+    stat = this->send_word_frame(init, true);
+    if (DebuggerExecutingNormal != stat){
+        this->logger->error("Send initial value ACK error, line {:d}.", __LINE__);
+        return stat;
+    }
+
+    this->receive_data_frame(6);  // the first one is BL_DUMMY byte.
+    if (xor_checksum(this->buffer + 1, 4) != this->buffer[5]){
+        this->logger->error("checksum frame XOR error, line {:d}.", __LINE__);
+        return DebuggerExecutingProtocolFault;
+    }
+    crc = ((uint32_t)this->buffer[1] << 24) | ((uint32_t)this->buffer[2] << 16) | ((uint32_t)this->buffer[3] << 8) | this->buffer[4];
+    return this->is_ack_ok();
+}
+
+
+DebuggerExecutingState_t STM32XXX::target_checksum(uint32_t addr, uint32_t size, uint32_t& crc)
+{
+    // STM32 CRC unit reset configuration, when Get CMD lists Get Checksum
+    if (this->checksum_command < 0){
+        uint8_t data[BL_MAX_FRAME_SIZE_B];
+        int length = 0;
+        DebuggerExecutingState_t stat = this->get_command_cmd(data, length);
+        if (DebuggerExecutingNormal != stat){
+            return stat;
+        }
+        this->checksum_command = (std::find(data + 1, data + length, GET_CHECKSUM_COMMAND) != data + length)? 1: 0;
+    }
+    if (! this->checksum_command){
+        return DebuggerExecutingFunctionInexistentError;
+    }
+    return this->get_checksum_cmd(addr, size, SE_CRC32_STM32_POLY, SE_CRC32_STM32_INIT, crc);
+}
+
+
 DebuggerExecutingState_t STM32XXX::mass_erase()
 {
     DebuggerExecutingState_t stat;
@@ -780,5 +1529,146 @@ DebuggerExecutingState_t STM32XXX::mass_erase()
 
 DebuggerExecutingState_t STM32XXX::erase4k(uint32_t page)
 {
-    return this->erase_memory_cmd(page, 2);
+    // page: the 4 KB unit of the flash, 2 or 1 pages of the chip
+    return this->erase_pages(STM32_FLASH_BASE + page * ALIGN_SIZE_B, ALIGN_SIZE_B);
+}
+
+
+DebuggerExecutingState_t STM32XXX::device_uid(std::vector<uint8_t>& uid)
+{
+    // the 96-bit unique device ID at the address of the chip profile
+    this->resolve_profile();
+    if (! this->profile){
+        this->logger->error("chip profile unknown, no device UID. line {:d}.", __LINE__);
+        return DebuggerExecutingParamFault;
+    }
+    uid.resize(STM32_UID_SIZE_B);
+    return this->read_memory_cmd(this->profile->uid_addr, uid.data(), STM32_UID_SIZE_B);
+}
+
+
+uint32_t STM32XXX::page_size()
+{
+    /* The page of the profile, resolved once: a part having a single-bank mode is in it when the bank bit of its
+       option bytes is cleared, it has larger pages then. Unknown parts: 2 KB. */
+    if (this->flash_page_size){
+        return this->flash_page_size;
+    }
+    this->resolve_profile();
+    if (! this->profile){
+        return STM32_FLASH_PAGE_SIZE_B;
+    }
+    if (this->profile->single_bank_page_size){
+        uint8_t optr[4] = {0};
+        if (DebuggerExecutingNormal != this->read_memory_cmd(STM32_OPTION_BYTES_BASE, optr, 4)){
+            this->logger->warn("Read option bytes fail, {:d} Bytes pages, line {:d}.", this->profile->page_size, __LINE__);
+            return this->profile->page_size;
+        }
+        uint32_t word = optr[0] | (optr[1] << 8) | (optr[2] << 16) | ((uint32_t)optr[3] << 24);
+        this->single_bank = ! (word & (1U << this->profile->bank_option_bit));
+    }
+    this->flash_page_size = this->single_bank? this->profile->single_bank_page_size: this->profile->page_size;
+    this->logger->info("Flash page {:d} Bytes{}", this->flash_page_size, this->single_bank? ", single-bank mode": "");
+    return this->flash_page_size;
+}
+
+
+DebuggerExecutingState_t STM32XXX::erase_pages(uint32_t addr, uint32_t size)
+{
+    uint32_t page_size = this->page_size();
+    if (! ((addr >= STM32_FLASH_BASE) && (0 == addr % page_size) && (size > 0) && (0 == size % page_size))){
+        this->logger->error("param error erase addr 0x{:08x} size {:d}, line {:d}.", addr, size, __LINE__);
+        return DebuggerExecutingParamFault;
+    }
+    // the exact pages whatever the erase policy: program_diff and the journal resume keep the pages around them
+    ErasePlanner planner = this->erase_plan(&addr, &size, 1);
+    return this->erase_page_lists(planner.page_lists(ERASE_PAGE_LIST_MAX));
+}
+
+
+DebuggerExecutingState_t STM32XXX::erase_special(const std::vector<uint32_t>& pages, uint64_t pages_us, bool& erased_all)
+{
+    /*
+    Stm32ErasePolicyFastest: one special erase instead of the page lists when its busy time is shorter,
+        the bank mass erase if the pages are all in one bank of a dual-bank part, else the global mass erase.
+    A NAKed bank erase (single-bank option bytes) leaves the pages to the page lists.
+    */
+    erased_all = false;
+    uint32_t sleep_percent = 0;
+    if (this->busy_estimate(Stm32WaitMassErase, 1, sleep_percent) >= pages_us){
+        return DebuggerExecutingNormal;
+    }
+
+    uint32_t bank_pages = this->bank_size() / this->page_size();
+    if ((bank_pages > 0) && ((pages.back() < bank_pages) || (pages.front() >= bank_pages))){
+        uint32_t code = (pages.back() < bank_pages)? 0xfffe: 0xfffd;
+        this->logger->info("erase pages {:d}..{:d}: bank {:d} mass erase", pages.front(), pages.back(), (0xfffe == code)? 1: 2);
+        if (DebuggerExecutingNormal == this->erase_memory_cmd(0, code + 1)){
+            erased_all = true;
+        }
+        else {
+            this->logger->warn("bank mass erase NAK, erase the pages, line {:d}.", __LINE__);
+        }
+        return DebuggerExecutingNormal;
+    }
+    this->logger->info("erase pages {:d}..{:d}: global mass erase", pages.front(), pages.back());
+    DebuggerExecutingState_t stat = this->mass_erase();
+    erased_all = (DebuggerExecutingNormal == stat);
+    return stat;
+}
+
+
+ErasePlanner STM32XXX::erase_plan(const uint32_t addr[], const uint32_t size[], uint32_t count)
+{
+    uint32_t page_size = this->page_size();
+    ErasePlanner planner(STM32_FLASH_BASE, page_size, std::min<uint32_t>(STM32_FLASH_SPAN_B / page_size, 0xfff0));
+
+    for (uint32_t i=0; i<count; ++i){
+        planner.add(addr[i], size[i]);
+    }
+    return planner;
+}
+
+
+DebuggerExecutingState_t STM32XXX::erase_page_lists(const std::vector<std::vector<uint32_t>>& page_lists)
+{
+    DebuggerExecutingState_t stat;
+
+    for (const std::vector<uint32_t>& pages: page_lists)
+    {
+        stat = this->erase_page_list(pages.data(), pages.size());
+        if (DebuggerExecutingNormal != stat){
+            this->logger->error("erase pages {:d}..{:d} fail!!! line {:d}.", pages.front(), pages.back(), __LINE__);
+            return stat;
+        }
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t STM32XXX::erase_images(const uint32_t addr[], const uint32_t size[], uint32_t count)
+{
+    /* Erase the pages touched by the images, in page lists of one frame each, instead of a mass erase.
+       Stm32ErasePolicyFastest: a special erase when it is faster, the images are programmed whole afterwards. */
+    assert(addr && size);
+
+    DebuggerExecutingState_t stat;
+    ErasePlanner planner = this->erase_plan(addr, size, count);
+    std::vector<std::vector<uint32_t>> page_lists = planner.page_lists(ERASE_PAGE_LIST_MAX);
+    if (page_lists.empty()){
+        return DebuggerExecutingNormal;
+    }
+    if (Stm32ErasePolicyFastest == this->erase_policy){
+        uint64_t pages_us = 0;
+        uint32_t sleep_percent = 0;
+        for (const std::vector<uint32_t>& pages: page_lists){
+            pages_us += this->busy_estimate(Stm32WaitErasePages, pages.size(), sleep_percent);
+        }
+        bool erased_all = false;
+        stat = this->erase_special(planner.pages(), pages_us, erased_all);
+        if ((DebuggerExecutingNormal != stat) || erased_all){
+            return stat;
+        }
+    }
+    return this->erase_page_lists(page_lists);
 }
\ No newline at end of file
@@ -1,17 +1,90 @@
 #ifndef __STM32XXX_HPP__
 #define __STM32XXX_HPP__
 
+#include <chrono>
+#include <string>
+#include <type_traits>
 #include "interface/SpiInterface.h"
 #include "programer.hpp"
+#include "stm32xxx_link.hpp"
+#include "stm32xxx_ack_model.hpp"
+#include "stm32xxx_latency.hpp"
+#include "stm32xxx_profile.hpp"
+#include "erased_ranges.hpp"
+#include "read_cache.hpp"
+#include "erase_planner.hpp"
 
 
 #define SPI_FREQENCY_HZ         8000000
 #define RESET_DELAY_MS          300
 #define WAIT_ACK_TIMEOUT_MS     500
-#define ERASE_ACK_TIMEOUT_MS    10000  // 256 pages need 5.7s
+#define ERASE_PAGE_TIMEOUT_MS   50     // page list ACK timeout per page, 2 * tERASE max
+#define ERASE_PAGE_LIST_MAX     128    // pages per EMEM command: the page codes fill one 256 Bytes frame
 #define BL_MAX_FRAME_SIZE_B     256
 #define BUFFER_SIZE_B           (BL_MAX_FRAME_SIZE_B + 4)  // 4 Align, write max: 258 (Number + 256*Data + checksum), read max: 257(DUMMY + 256*Data)
 #define WRITE_MEM_RETRY_COUNT   10
+#define WRITE_READBACK_SECTOR_B ALIGN_SIZE_B  // deferred readback unit: the 4 KB chunk of program_only and erase4k
+#define STM32_FLASH_BASE        0x08000000U
+#define STM32_FLASH_SPAN_B      0x08000000U    // flash area up to 0x0FFFFFFF, a global mass erase blanks all of it
+#define STM32_FLASH_PAGE_SIZE_B (2 * 1024)  // erase page of unknown parts
+#define STM32_OPTION_BYTES_BASE 0x1FFF7800U    // first option bytes word, FLASH_OPTR
+#define STM32_SRAM_BASE         0x20000000U
+#define STM32_SRAM_SPAN_B       0x20000000U    // SRAM area of the Cortex-M memory map, up to 0x3FFFFFFF
+#define STM32_UID_SIZE_B        12
+#define STM32_PROGRAM_UNIT_B    8      // 64-bit double-word of the L4/G4 flash, unknown parts are written aligned to it too
+#define ACK_LATENCY_COMMANDS    13     // SOF synchronization of init + the command set
+
+
+/* ACK waits with a predictable busy time, see wait_models in stm32xxx.cpp */
+typedef enum{
+    Stm32WaitWriteMemory = 0,       // WMEM data frame, unit: 64-bit double-word
+    Stm32WaitErasePages,            // EMEM page list, unit: page
+    Stm32WaitMassErase,             // EMEM global or bank mass erase
+    Stm32WaitProtection,            // WP/WU/RP/RU option byte update
+    Stm32WaitChecksum,              // Get Checksum initial value frame, unit: 1 KB
+    Stm32WaitModelCount,
+}Stm32WaitKind_t;
+
+/* outcome of an ACK wait, the ACK latency histograms are kept per command and outcome */
+typedef enum{
+    Stm32AckOutcomeAck = 0,
+    Stm32AckOutcomeNak,
+    Stm32AckOutcomeTimeout,
+    Stm32AckOutcomeCount,
+}Stm32AckOutcome_t;
+
+/* expected busy time = base_us + units * unit_us, sleep_percent of it is slept before polling */
+typedef struct{
+    uint32_t base_us;
+    uint32_t unit_us;
+    uint32_t sleep_percent;
+}Stm32WaitModel_t;
+
+/* Write Memory command of a pipelined chunk, built on the producer thread by prepare_chunk */
+typedef struct{
+    uint32_t addr;
+    uint16_t size;                          // data Bytes
+    uint16_t length;                        // data frame Bytes: Number + data + padding + checksum
+    uint8_t addr_frame[5];
+    uint8_t frame[BL_MAX_FRAME_SIZE_B + 2];
+}Stm32WriteFrame_t;
+
+/* AN2606 STM32L45xxx/46xxx V9.2 SPI write limitation: 2 double-words may be left blank */
+typedef enum{
+    Stm32WriteWorkaroundAuto = 0,           // chosen on the first write from the part and bootloader version
+    Stm32WriteWorkaroundNone,
+    Stm32WriteWorkaroundDelay,              // WA1: sleep the 256 Bytes write time before the ACK request
+    Stm32WriteWorkaroundReadback,           // WA2: read back every frame, write it again on mismatch
+    Stm32WriteWorkaroundSectorReadback,     // WA2 deferred: write a 4 KB chunk, read it back, write the mismatched frames again
+    Stm32WriteWorkaroundCount,
+}Stm32WriteWorkaround_t;
+
+/* how erase_images clears the flash of the images, erase_pages and erase_image erase the exact pages */
+typedef enum{
+    Stm32ErasePolicyPages = 0,              // only the touched pages, the rest of the flash is kept
+    Stm32ErasePolicyFastest,                // bank or global mass erase when estimated faster than the page lists
+    Stm32ErasePolicyCount,
+}Stm32ErasePolicy_t;
 
 
 class STM32XXX: public Programer
@@ -19,8 +92,56 @@ class STM32XXX: public Programer
 public:
     STM32XXX(char* spi_name, uint32_t frequency_hz=SPI_FREQENCY_HZ, SpiCpolnCphaMode_t mode=SpiCpol0nCpha0Mode,
              char *logger_file_name=NULL, uint32_t max_file_size=MAX_FILE_SIZE, uint32_t max_files=MAX_FILES, bool rotate_on_open=false);
+
+    /* Drive any SPI backend: the protocol hot path is instantiated on the static type of transport,
+       pass the concrete (final) backend for static dispatch or a SpiTransport* for virtual dispatch.
+       The transport is deleted with STM32XXX when own_transport is true. */
+    template <class Transport,
+              class = typename std::enable_if<std::is_base_of<SpiTransport, Transport>::value>::type>
+    STM32XXX(Transport* transport, bool own_transport,
+             char *logger_file_name=NULL, uint32_t max_file_size=MAX_FILE_SIZE, uint32_t max_files=MAX_FILES, bool rotate_on_open=false)
+             : Programer(logger_file_name, max_file_size, max_files, rotate_on_open)
+    {
+        this->logger->info("......... STM32XXX .......");
+        this->link = new Stm32Link<Transport>(transport, own_transport, this->logger);
+        this->init_wait_models();
+        std::memset(this->buffer, BL_IDLE, sizeof(this->buffer));
+    }
     ~STM32XXX();
 
+    SpiTransport* transport();
+    DebuggerExecutingState_t set_wait_model(Stm32WaitKind_t kind, Stm32WaitModel_t model);
+    Stm32WaitModel_t get_wait_model(Stm32WaitKind_t kind);
+    DebuggerExecutingState_t set_write_workaround(Stm32WriteWorkaround_t workaround);
+    Stm32WriteWorkaround_t get_write_workaround();
+
+    /* Stm32ErasePolicyFastest may blank flash outside the images: the bank holding them on dual-bank parts
+       (see stm32xxx_profile.cpp), else the whole flash. A NAKed bank erase falls back to the page lists. */
+    DebuggerExecutingState_t set_erase_policy(Stm32ErasePolicy_t policy);
+    Stm32ErasePolicy_t get_erase_policy();
+
+    /* Do not send all-0xFF frames to flash erased by this object, see bytes_skipped of last_result.
+       init and go forget the erased ranges. */
+    void set_blank_skip(bool enable);
+    bool get_blank_skip();
+
+    /* read serves aligned 256 Bytes frames read before. Write Memory, erase, protection, go and init invalidate
+       what they change, memory changed otherwise (RAM used by the bootloader) is served stale: disable to flush. */
+    void set_read_cache(bool enable);
+    ReadCacheStatistics_t read_cache_statistics();
+
+    /* Learn the busy time of the waits, it replaces the wait models once a bucket has samples.
+       The model of the part is loaded from file_name (NULL: no file) when Get ID and Get Version
+       identified it, and saved by save_ack_model or on destruction. */
+    DebuggerExecutingState_t enable_ack_learning(char* file_name);
+    DebuggerExecutingState_t save_ack_model();
+    bool ack_estimate(Stm32WaitKind_t kind, uint32_t units, uint32_t& busy_us);
+
+    /* ACK wait time from the frame to the ACK echo, command BL_SPI_SOF is the synchronization of init.
+       NULL for an unknown command or outcome. */
+    Stm32LatencyHistogram* ack_latency(uint8_t command, Stm32AckOutcome_t outcome);
+    void reset_ack_latency();
+
     DebuggerExecutingState_t init();
     DebuggerExecutingState_t get_command_cmd(uint8_t data[], int& length);
     DebuggerExecutingState_t get_version_cmd(uint8_t& version);
@@ -28,30 +149,91 @@ public:
     DebuggerExecutingState_t read_memory_cmd(uint32_t addr, uint8_t data[], int size);
     DebuggerExecutingState_t write_memory_cmd(uint32_t addr, const uint8_t* data, int length);
     DebuggerExecutingState_t erase_memory_cmd(uint32_t start_page, uint32_t page_num);
+    DebuggerExecutingState_t erase_page_list(const uint32_t pages[], uint32_t page_num);
     DebuggerExecutingState_t go_cmd(uint32_t addr);
     DebuggerExecutingState_t write_protect_cmd(uint32_t start_page, uint32_t page_num);
     DebuggerExecutingState_t write_unprotect_cmd();
     DebuggerExecutingState_t readout_protect_cmd();
     DebuggerExecutingState_t readout_unprotect_cmd();
+    DebuggerExecutingState_t get_checksum_cmd(uint32_t addr, uint32_t size, uint32_t polynomial, uint32_t init, uint32_t& crc);
 
     DebuggerExecutingState_t mass_erase();
     DebuggerExecutingState_t erase4k(uint32_t page);
+    uint32_t page_size();
+    DebuggerExecutingState_t erase_pages(uint32_t addr, uint32_t size);
+    DebuggerExecutingState_t erase_images(const uint32_t addr[], const uint32_t size[], uint32_t count);
     DebuggerExecutingState_t read(uint32_t addr, uint8_t* data, uint32_t size);
     DebuggerExecutingState_t write(uint32_t addr, const uint8_t* data, uint32_t size);
+    DebuggerExecutingState_t device_uid(std::vector<uint8_t>& uid);
+    DebuggerExecutingState_t target_checksum(uint32_t addr, uint32_t size, uint32_t& crc);
+    uint32_t write_once_unit(uint32_t addr);
 
 protected:
     DebuggerExecutingState_t is_ack_ok(uint32_t timeout_ms=WAIT_ACK_TIMEOUT_MS);
+    DebuggerExecutingState_t begin_pipeline();
+    void prepare_chunk(uint32_t addr, ProgramChunk_t& chunk);
+    DebuggerExecutingState_t write_chunk(uint32_t addr, ProgramChunk_t& chunk);
 
 private:
     DebuggerExecutingState_t spi_transmit(uint8_t anWriteList[], uint8_t anReadList[], uint32_t nTransmitLength);
-    DebuggerExecutingState_t send_command_frame(uint8_t command);
-    DebuggerExecutingState_t send_data_frame(uint8_t data[], int length);
+    DebuggerExecutingState_t send_command_frame(uint8_t command, bool defer_echo=false);
+    DebuggerExecutingState_t send_data_frame(uint8_t data[], int length, bool defer_echo=false);
     DebuggerExecutingState_t receive_data_frame(int length);
-    DebuggerExecutingState_t send_addr_frame(uint32_t addr);
-    DebuggerExecutingState_t send_size_frame(int size);
+    DebuggerExecutingState_t send_addr_frame(uint32_t addr, bool defer_echo=false);
+    DebuggerExecutingState_t send_word_frame(uint32_t word, bool defer_echo=false);
+    DebuggerExecutingState_t send_size_frame(int size, bool defer_echo=false);
+    void build_word_frame(uint8_t frame[], uint32_t word);
+    int build_write_frame(uint8_t frame[], const uint8_t* data, int size);
+    DebuggerExecutingState_t write_frame_cmd(uint32_t addr, uint8_t addr_frame[], uint8_t frame[], int length);
+    void init_wait_models();
+    uint32_t busy_estimate(Stm32WaitKind_t kind, uint32_t units, uint32_t& sleep_percent);
+    void expect(Stm32WaitKind_t kind, uint32_t units, bool full_sleep=false);
+    void resolve_profile();
+    uint32_t bank_size();
+    ErasePlanner erase_plan(const uint32_t addr[], const uint32_t size[], uint32_t count);
+    DebuggerExecutingState_t erase_page_lists(const std::vector<std::vector<uint32_t>>& page_lists);
+    DebuggerExecutingState_t erase_special(const std::vector<uint32_t>& pages, uint64_t pages_us, bool& erased_all);
+    void resolve_write_workaround();
+    uint32_t program_unit();
+    bool in_flash(uint32_t addr, uint32_t size);
+    bool in_sram(uint32_t addr, uint32_t size);
+    DebuggerExecutingState_t read_unit(uint32_t addr, uint8_t* data, uint32_t unit);
+    DebuggerExecutingState_t stage_aligned(uint32_t& addr, const uint8_t*& data, uint32_t& size);
+    DebuggerExecutingState_t write_frames(uint32_t addr, const uint8_t* data, uint32_t size);
+    DebuggerExecutingState_t readback_rewrite(uint32_t addr, const uint8_t* data, uint32_t size);
+    bool blank_frame(uint32_t addr, const uint8_t* data, uint32_t size);
+    DebuggerExecutingState_t read_cached(uint32_t addr, uint8_t* data, uint32_t size);
+    void learn(DebuggerExecutingState_t stat);
+    void identify();
+    void record_ack(std::chrono::steady_clock::time_point start, DebuggerExecutingState_t stat);
 
 private:
-    SpiInterface* spi;
+    Stm32LinkBase* link;
+    Stm32WaitModel_t wait_models[Stm32WaitModelCount];
+    Stm32AckModel ack_model;
+    bool ack_learning = false;
+    std::string ack_model_file;
+    int pending_kind = -1;          // wait kind of the next ACK, -1: no expectation
+    uint32_t pending_units = 0;
+    int chip_pid = -1;              // -1 until Get ID/Get Version answered
+    int bl_version = -1;
+    int checksum_command = -1;      // Get Checksum listed by Get CMD, -1 until asked
+    const Stm32ChipProfile_t* profile = NULL;
+    bool profile_resolved = false;
+    uint32_t flash_size = 0;        // from the flash size register of the profile, 0: not read yet or unknown
+    uint32_t flash_page_size = 0;   // 0: not resolved yet
+    bool single_bank = false;       // a part having both bank modes is in single-bank mode
+    Stm32WriteWorkaround_t write_workaround = Stm32WriteWorkaroundAuto;
+    Stm32ErasePolicy_t erase_policy = Stm32ErasePolicyPages;
+    bool blank_skip = false;
+    ErasedRanges erased;
+    bool read_caching = false;
+    ReadCache read_cache;
+    uint8_t cache_frame[READ_CACHE_FRAME_B];
+    std::vector<uint8_t> staging;   // unaligned flash write widened to whole program units
+    uint32_t pipeline_unit = STM32_PROGRAM_UNIT_B;  // program unit for prepare_chunk, set by begin_pipeline
+    uint8_t command = BL_SPI_SOF;   // command in flight
+    Stm32LatencyHistogram latency[ACK_LATENCY_COMMANDS][Stm32AckOutcomeCount];
     uint8_t buffer[BUFFER_SIZE_B];
 };
 
@@ -0,0 +1,166 @@
+#include <cstdio>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "stm32xxx_ack_model.hpp"
+
+
+using namespace std;
+
+Stm32AckModel::Stm32AckModel()
+{
+    this->is_bound = false;
+    this->pid = 0;
+    this->version = 0;
+}
+
+
+void Stm32AckModel::clear()
+{
+    this->buckets.clear();
+}
+
+
+bool Stm32AckModel::bind(uint16_t pid, uint8_t version)
+{
+    if (this->is_bound && (this->pid == pid) && (this->version == version)){
+        return false;
+    }
+    // another part behind the fixture: nothing learned so far applies
+    if (this->is_bound){
+        this->clear();
+    }
+    this->is_bound = true;
+    this->pid = pid;
+    this->version = version;
+    return true;
+}
+
+
+bool Stm32AckModel::bound()
+{
+    return this->is_bound;
+}
+
+
+uint64_t Stm32AckModel::key(uint32_t kind, uint32_t units)
+{
+    return ((uint64_t)kind << 32) | units;
+}
+
+
+void Stm32AckModel::update(Bucket_t& bucket, double value)
+{
+    if (0 == bucket.samples){
+        bucket.ewma_us = value;
+    }
+    else{
+        bucket.ewma_us += ACK_MODEL_EWMA_ALPHA * (value - bucket.ewma_us);
+    }
+    bucket.samples++;
+}
+
+
+void Stm32AckModel::observe(uint32_t kind, uint32_t units, uint32_t busy_us)
+{
+    this->update(this->buckets[key(kind, units)], busy_us);
+    if (units > 0){
+        this->update(this->buckets[key(kind, 0)], (double)busy_us / units);
+    }
+}
+
+
+bool Stm32AckModel::estimate(uint32_t kind, uint32_t units, uint32_t& busy_us)
+{
+    auto it = this->buckets.find(key(kind, units));
+    if ((it != this->buckets.end()) && (it->second.samples >= ACK_MODEL_MIN_SAMPLES)){
+        busy_us = it->second.ewma_us;
+        return true;
+    }
+    it = this->buckets.find(key(kind, 0));
+    if ((units > 0) && (it != this->buckets.end()) && (it->second.samples >= ACK_MODEL_MIN_SAMPLES)){
+        busy_us = std::min<double>(it->second.ewma_us * units, UINT32_MAX);
+        return true;
+    }
+    return false;
+}
+
+
+DebuggerExecutingState_t Stm32AckModel::load(const char* file_name)
+{
+    if (! (file_name && this->is_bound)){
+        return DebuggerExecutingParamFault;
+    }
+
+    ifstream file(file_name);
+    if (! file.is_open()){
+        return DebuggerExecutingFileOperationError;  // first run on this fixture
+    }
+
+    string line;
+    while (getline(file, line))
+    {
+        unsigned int pid, version, kind, units;
+        double ewma_us;
+        uint32_t samples;
+        if (line.empty() || ('#' == line[0])){
+            continue;
+        }
+        istringstream fields(line);
+        if (! (fields >> hex >> pid >> version >> dec >> kind >> units >> ewma_us >> samples)){
+            continue;
+        }
+        if ((pid != this->pid) || (version != this->version) || (0 == samples)){
+            continue;
+        }
+        // buckets observed in this session are newer than the file
+        this->buckets.insert({key(kind, units), {ewma_us, samples}});
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Stm32AckModel::save(const char* file_name)
+{
+    if (! (file_name && this->is_bound)){
+        return DebuggerExecutingParamFault;
+    }
+
+    vector<string> others;
+    ifstream old_file(file_name);
+    if (old_file.is_open()){
+        string line;
+        while (getline(old_file, line))
+        {
+            unsigned int pid, version;
+            istringstream fields(line);
+            if (line.empty() || ('#' == line[0]) || (! (fields >> hex >> pid >> version))){
+                continue;
+            }
+            if ((pid != this->pid) || (version != this->version)){
+                others.push_back(line);
+            }
+        }
+        old_file.close();
+    }
+
+    ofstream file(file_name, ios::out|ios::trunc);
+    if (file.fail()){
+        return DebuggerExecutingFileOperationError;
+    }
+    file << "# pid version kind units ewma_us samples\n";
+    for (const string& line: others){
+        file << line << "\n";
+    }
+    char line[96];
+    for (const auto& bucket: this->buckets){
+        snprintf(line, sizeof(line), "%04x %02x %u %u %.1f %u\n", this->pid, this->version,
+                 (uint32_t)(bucket.first >> 32), (uint32_t)bucket.first, bucket.second.ewma_us, bucket.second.samples);
+        file << line;
+    }
+    file.close();
+    return file.fail()? DebuggerExecutingFileOperationError: DebuggerExecutingNormal;
+}
@@ -0,0 +1,54 @@
+#ifndef __STM32XXX_ACK_MODEL_HPP__
+#define __STM32XXX_ACK_MODEL_HPP__
+
+#include <map>
+#include "DbgrCommon.h"
+
+
+#define ACK_MODEL_EWMA_ALPHA        0.25
+#define ACK_MODEL_MIN_SAMPLES       2
+#define ACK_MODEL_MAX_SLEEP_PERCENT 90    // leave room to poll, else a busy time shorter than the estimate is never seen
+
+
+/*
+    Busy time of the ACK waits learned on the fixture: an EWMA per (wait kind, units) bucket, units is
+    the payload in double-words for writes and the page count for erases. Bucket units 0 holds the
+    EWMA of the busy time per unit of the kind, it answers for unit counts without enough samples.
+
+    The model belongs to one part: chip PID (Get ID) and bootloader version (Get Version).
+    The file keeps the models of every part seen, one bucket per line:
+        # pid version kind units ewma_us samples
+        0462 11 0 32 2650.3 120
+*/
+class Stm32AckModel
+{
+public:
+    Stm32AckModel();
+
+    void clear();
+    bool bind(uint16_t pid, uint8_t version);  // true when the part changed
+    bool bound();
+    void observe(uint32_t kind, uint32_t units, uint32_t busy_us);
+    bool estimate(uint32_t kind, uint32_t units, uint32_t& busy_us);
+
+    /* load merges the buckets of the bound part not observed yet, save keeps the lines of other parts */
+    DebuggerExecutingState_t load(const char* file_name);
+    DebuggerExecutingState_t save(const char* file_name);
+
+private:
+    typedef struct{
+        double ewma_us;
+        uint32_t samples;
+    }Bucket_t;
+
+    static uint64_t key(uint32_t kind, uint32_t units);
+    static void update(Bucket_t& bucket, double value);
+
+private:
+    std::map<uint64_t, Bucket_t> buckets;
+    bool is_bound;
+    uint16_t pid;
+    uint8_t version;
+};
+
+#endif
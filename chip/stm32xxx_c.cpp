@@ -3,6 +3,8 @@
 
 #include <cstring>
 #include "stm32xxx.hpp"
+#include "stm32xxx_sim.hpp"
+#include "target_memory_view.hpp"
 #include "DbgrCommon.h"
 
 
@@ -16,6 +18,19 @@ STM32XXX* new_STM32XXX(char* spi_name, uint32_t frequency_hz, uint32_t mode,
 }
 
 
+STM32XXX* new_STM32XXX_simulator(double time_scale, uint32_t dw_drop_ppm, uint32_t seed,
+                                 char *logger_file_name=NULL, uint32_t max_file_size=MAX_FILE_SIZE, uint32_t max_files=MAX_FILES, bool rotate_on_open=false)
+{
+    /* STM32L452 bootloader simulator instead of a SPI device, see stm32_sim_default_config() */
+    Stm32SimConfig_t config = stm32_sim_default_config();
+    config.time_scale = time_scale;
+    config.dw_drop_ppm = dw_drop_ppm;
+    config.seed = seed;
+    return new STM32XXX(new Stm32BootloaderSim(config), true,
+                        logger_file_name, max_file_size, max_files, rotate_on_open);
+}
+
+
 STM32XXX* del_STM32XXX(STM32XXX* stm32)
 {
     if (stm32){
@@ -116,6 +131,21 @@ int mass_erase(STM32XXX* stm32)
 }
 
 
+int erase_image(STM32XXX* stm32, uint32_t addr, uint32_t size)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    // a whole image: the erase policy applies
+    return stm32->erase_images(&addr, &size, 1);
+}
+
+
+int erase_images(STM32XXX* stm32, const uint32_t addr[], const uint32_t size[], uint32_t count)
+{
+    if (! (stm32 && addr && size)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->erase_images(addr, size, count);
+}
+
+
 int program_only(STM32XXX* stm32, char* file_name, uint32_t addr, uint32_t size, uint32_t file_offset)
 {
     if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
@@ -123,6 +153,34 @@ int program_only(STM32XXX* stm32, char* file_name, uint32_t addr, uint32_t size,
 }
 
 
+int program_diff(STM32XXX* stm32, char* file_name, uint32_t addr, uint32_t size, uint32_t file_offset)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->program_diff(file_name, addr, size, file_offset);
+}
+
+
+int enable_journal(STM32XXX* stm32, char* file_name, bool check_boundary)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->enable_journal(file_name, check_boundary);
+}
+
+
+int set_verify_mode(STM32XXX* stm32, uint32_t mode)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->set_verify_mode((ProgramerVerifyMode_t)mode);
+}
+
+
+int get_checksum(STM32XXX* stm32, uint32_t addr, uint32_t size, uint32_t* crc)
+{
+    if (! (stm32 && crc)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->target_checksum(addr, size, *crc);
+}
+
+
 int dump(STM32XXX* stm32, char* file_name, uint32_t addr, uint32_t size)
 {
     if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
@@ -130,6 +188,20 @@ int dump(STM32XXX* stm32, char* file_name, uint32_t addr, uint32_t size)
 }
 
 
+int set_dump_format(STM32XXX* stm32, uint32_t format)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->set_dump_format((ProgramerDumpFormat_t)format);
+}
+
+
+int restore_sparse(STM32XXX* stm32, char* file_name)
+{
+    if (! (stm32 && file_name)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->restore_sparse(file_name);
+}
+
+
 int verify(STM32XXX* stm32, char* file_name, uint32_t addr, uint32_t size, uint32_t file_offset)
 {
     if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
@@ -158,6 +230,219 @@ int write_memory(STM32XXX* stm32, uint32_t addr, const uint8_t* data, uint32_t s
 }
 
 
+int read_memory_v(STM32XXX* stm32, const MemoryRegion_t regions[], uint32_t count)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->read_v(regions, count);
+}
+
+
+int write_memory_v(STM32XXX* stm32, const MemoryRegion_t regions[], uint32_t count)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->write_v(regions, count);
+}
+
+
+TargetMemoryView* new_TargetMemoryView(STM32XXX* stm32)
+{
+    /* write-combining view over stm32, delete it before stm32 */
+    if (! stm32){printf("param is NULL pointer!!!\n"); return NULL;}
+    return new TargetMemoryView(stm32);
+}
+
+
+TargetMemoryView* del_TargetMemoryView(TargetMemoryView* view)
+{
+    if (view){
+        delete view;
+    }
+    return 0;
+}
+
+
+int view_write(TargetMemoryView* view, uint32_t addr, const uint8_t* data, uint32_t size)
+{
+    if (! (view && data)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return view->write(addr, data, size);
+}
+
+
+int view_read(TargetMemoryView* view, uint32_t addr, uint8_t* data, uint32_t size)
+{
+    if (! (view && data)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return view->read(addr, data, size);
+}
+
+
+int view_flush(TargetMemoryView* view)
+{
+    if (! view){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return view->flush();
+}
+
+
+int set_wait_model(STM32XXX* stm32, uint32_t kind, uint32_t base_us, uint32_t unit_us, uint32_t sleep_percent)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    Stm32WaitModel_t model = {base_us, unit_us, sleep_percent};
+    return stm32->set_wait_model((Stm32WaitKind_t)kind, model);
+}
+
+
+int set_write_workaround(STM32XXX* stm32, uint32_t workaround)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->set_write_workaround((Stm32WriteWorkaround_t)workaround);
+}
+
+
+int get_write_workaround(STM32XXX* stm32, uint32_t* workaround)
+{
+    if (! (stm32 && workaround)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    *workaround = stm32->get_write_workaround();
+    return DebuggerExecutingNormal;
+}
+
+
+int set_erase_policy(STM32XXX* stm32, uint32_t policy)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->set_erase_policy((Stm32ErasePolicy_t)policy);
+}
+
+
+int get_erase_policy(STM32XXX* stm32, uint32_t* policy)
+{
+    if (! (stm32 && policy)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    *policy = stm32->get_erase_policy();
+    return DebuggerExecutingNormal;
+}
+
+
+int set_blank_skip(STM32XXX* stm32, bool enable)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    stm32->set_blank_skip(enable);
+    return DebuggerExecutingNormal;
+}
+
+
+int set_pipeline(STM32XXX* stm32, bool enable)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    stm32->set_pipeline(enable);
+    return DebuggerExecutingNormal;
+}
+
+
+int set_dump_overlap(STM32XXX* stm32, bool enable)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    stm32->set_dump_overlap(enable);
+    return DebuggerExecutingNormal;
+}
+
+
+int get_dump_timing(STM32XXX* stm32, uint64_t* bus_us, uint64_t* disk_us, uint64_t* stall_us)
+{
+    if (! (stm32 && bus_us && disk_us && stall_us)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    DumpTiming_t timing = stm32->last_dump_timing();
+    *bus_us = timing.bus_us;
+    *disk_us = timing.disk_us;
+    *stall_us = timing.stall_us;
+    return DebuggerExecutingNormal;
+}
+
+
+int set_read_cache(STM32XXX* stm32, bool enable)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    stm32->set_read_cache(enable);
+    return DebuggerExecutingNormal;
+}
+
+
+int get_read_cache_statistics(STM32XXX* stm32, uint64_t* hits, uint64_t* misses)
+{
+    if (! (stm32 && hits && misses)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    ReadCacheStatistics_t stats = stm32->read_cache_statistics();
+    *hits = stats.hits;
+    *misses = stats.misses;
+    return DebuggerExecutingNormal;
+}
+
+
+int get_program_result(STM32XXX* stm32, uint64_t* bytes_programmed, uint64_t* bytes_skipped)
+{
+    if (! (stm32 && bytes_programmed && bytes_skipped)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    ProgramerResult_t result = stm32->last_result();
+    *bytes_programmed = result.bytes_programmed;
+    *bytes_skipped = result.bytes_skipped;
+    return DebuggerExecutingNormal;
+}
+
+
+int get_program_pages(STM32XXX* stm32, uint32_t* pages_unchanged, uint32_t* pages_rewritten)
+{
+    if (! (stm32 && pages_unchanged && pages_rewritten)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    ProgramerResult_t result = stm32->last_result();
+    *pages_unchanged = result.pages_unchanged;
+    *pages_rewritten = result.pages_rewritten;
+    return DebuggerExecutingNormal;
+}
+
+
+int enable_ack_learning(STM32XXX* stm32, char* file_name)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->enable_ack_learning(file_name);
+}
+
+
+int save_ack_model(STM32XXX* stm32)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    return stm32->save_ack_model();
+}
+
+
+int ack_estimate(STM32XXX* stm32, uint32_t kind, uint32_t units, uint32_t* busy_us)
+{
+    // DebuggerExecutingParamFault while the bucket has too few samples
+    if (! (stm32 && busy_us)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    if (kind >= Stm32WaitModelCount){
+        return DebuggerExecutingParamFault;
+    }
+    return stm32->ack_estimate((Stm32WaitKind_t)kind, units, *busy_us)? DebuggerExecutingNormal: DebuggerExecutingParamFault;
+}
+
+
+int ack_latency(STM32XXX* stm32, uint8_t command, uint32_t outcome,
+                uint64_t* count, uint32_t* p50_us, uint32_t* p99_us, uint32_t* p999_us, uint32_t* max_us)
+{
+    if (! (stm32 && count && p50_us && p99_us && p999_us && max_us)){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    Stm32LatencyHistogram* histogram = stm32->ack_latency(command, (Stm32AckOutcome_t)outcome);
+    if (! histogram){
+        return DebuggerExecutingParamFault;
+    }
+    *count = histogram->count();
+    *p50_us = histogram->percentile(50);
+    *p99_us = histogram->percentile(99);
+    *p999_us = histogram->percentile(99.9);
+    *max_us = histogram->max();
+    return DebuggerExecutingNormal;
+}
+
+
+int reset_ack_latency(STM32XXX* stm32)
+{
+    if (! stm32){printf("param is NULL pointer!!!\n"); return DebuggerExecutingNullPointerParamFault;}
+    stm32->reset_ack_latency();
+    return DebuggerExecutingNormal;
+}
+
+
 void debug_state_message(int tDebuggerState, char* reason, uint32_t length){
     std::string mesg = DbgrErrorState((DebuggerExecutingState_t)tDebuggerState);
     memset(reason, '\0', length);
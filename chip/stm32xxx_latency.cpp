@@ -0,0 +1,81 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "stm32xxx_latency.hpp"
+
+
+Stm32LatencyHistogram::Stm32LatencyHistogram()
+{
+    this->reset();
+}
+
+
+void Stm32LatencyHistogram::reset()
+{
+    std::memset(this->buckets, 0, sizeof(this->buckets));
+    this->total = 0;
+    this->max_us = 0;
+}
+
+
+uint32_t Stm32LatencyHistogram::bucket_index(uint32_t value)
+{
+    if (value < 2 * LATENCY_SUB_BUCKETS){
+        return value;
+    }
+    uint32_t msb = 31 - __builtin_clz(value);
+    uint32_t shift = msb - LATENCY_SUB_BUCKET_BITS;
+    return (shift + 1) * LATENCY_SUB_BUCKETS + ((value >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+
+uint32_t Stm32LatencyHistogram::bucket_highest(uint32_t index)
+{
+    if (index < 2 * LATENCY_SUB_BUCKETS){
+        return index;
+    }
+    uint32_t shift = index / LATENCY_SUB_BUCKETS - 1;
+    uint64_t lowest = (uint64_t)(LATENCY_SUB_BUCKETS + index % LATENCY_SUB_BUCKETS) << shift;
+    return std::min<uint64_t>(lowest + (1ULL << shift) - 1, UINT32_MAX);
+}
+
+
+void Stm32LatencyHistogram::record(uint32_t value_us)
+{
+    this->buckets[bucket_index(value_us)]++;
+    this->total++;
+    this->max_us = std::max(this->max_us, value_us);
+}
+
+
+uint64_t Stm32LatencyHistogram::count()
+{
+    return this->total;
+}
+
+
+uint32_t Stm32LatencyHistogram::max()
+{
+    return this->max_us;
+}
+
+
+uint32_t Stm32LatencyHistogram::percentile(double percent)
+{
+    if (0 == this->total){
+        return 0;
+    }
+    uint64_t rank = std::ceil(this->total * std::min(std::max(percent, 0.0), 100.0) / 100.0);
+    rank = std::max<uint64_t>(rank, 1);
+
+    uint64_t seen = 0;
+    for (uint32_t i=0; i<LATENCY_BUCKETS; ++i)
+    {
+        seen += this->buckets[i];
+        if (seen >= rank){
+            return std::min(bucket_highest(i), this->max_us);
+        }
+    }
+    return this->max_us;
+}
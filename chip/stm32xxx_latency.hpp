@@ -0,0 +1,38 @@
+#ifndef __STM32XXX_LATENCY_HPP__
+#define __STM32XXX_LATENCY_HPP__
+
+#include "DbgrCommon.h"
+
+
+#define LATENCY_SUB_BUCKET_BITS     3     // 8 linear sub-buckets per power of 2: 12.5% worst relative error
+#define LATENCY_SUB_BUCKETS         (1U << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS             ((32 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+
+/*
+    HDR-style histogram of latencies in microseconds: values below 2 * LATENCY_SUB_BUCKETS have one
+    bucket each, above every power of 2 is split in LATENCY_SUB_BUCKETS buckets. record is a few
+    integer operations, cheap enough to stay on for every ACK wait.
+*/
+class Stm32LatencyHistogram
+{
+public:
+    Stm32LatencyHistogram();
+
+    void reset();
+    void record(uint32_t value_us);
+    uint64_t count();
+    uint32_t max();
+    uint32_t percentile(double percent);  // highest value of the bucket holding the percentile
+
+private:
+    static uint32_t bucket_index(uint32_t value);
+    static uint32_t bucket_highest(uint32_t index);
+
+private:
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint64_t total;
+    uint32_t max_us;
+};
+
+#endif
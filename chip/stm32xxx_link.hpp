@@ -0,0 +1,248 @@
+#ifndef __STM32XXX_LINK_HPP__
+#define __STM32XXX_LINK_HPP__
+
+#include <chrono>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include "DbgrCommon.h"
+#include "interface/SpiTransport.h"
+
+
+/* Bootloader command set */
+#define GET_CMD_COMMAND        0x00U  /*!< Get CMD command               */
+#define GET_VER_COMMAND        0x01U  /*!< Get Version command           */
+#define GET_ID_COMMAND         0x02U  /*!< Get ID command                */
+#define RMEM_COMMAND           0x11U  /*!< Read Memory command           */
+#define GO_COMMAND             0x21U  /*!< Go command                    */
+#define WMEM_COMMAND           0x31U  /*!< Write Memory command          */
+#define EMEM_COMMAND           0x44U  /*!< Erase Memory command          */
+#define WP_COMMAND             0x63U  /*!< Write Protect command         */
+#define WU_COMMAND             0x73U  /*!< Write Unprotect command       */
+#define RP_COMMAND             0x82U  /*!< Readout Protect command       */
+#define RU_COMMAND             0x92U  /*!< Readout Unprotect command     */
+#define GET_CHECKSUM_COMMAND   0xA1U  /*!< Get Checksum command, v1.3    */
+
+#define BL_SPI_SOF              0x5AU
+#define BL_ACK                  0x79U
+#define BL_NAK                  0x1FU
+#define BL_DUMMY                0xA5U
+#define BL_IDLE                 0x00U
+
+
+#define BL_ECHO_DELAY_US        2     // the bootloader re-arms its SPI receive after the ACK echo
+#define BL_POLL_WINDOW_MIN      4
+#define BL_POLL_WINDOW_START    32    // no busy time expected: covers the command decoding of the bootloader
+#define BL_POLL_WINDOW_MAX      2048  // 2 ms per poll at 8 MHz, frame + window stay below the 4096 Bytes of one spidev message
+#define BL_POLL_DEFAULT_HZ      8000000
+
+
+/*
+    Hot path of the bootloader protocol: raw transfers, the ACK polling loop and the data frames.
+    STM32XXX calls it once per frame, the byte-at-a-time polling loop runs inside Stm32Link<Transport>
+    which calls the transport directly when Transport is a final backend class.
+
+    A frame, the dummy byte and the first poll go out in one vectored transaction. With defer_echo the
+    ACK echo of a frame is not sent on its own, it leads the next transaction of the same command.
+
+    Each poll reads a window of bytes and scans it for ACK/NAK. While the expected busy time of the
+    frame (expect_busy) runs, the window covers the remaining time, once overdue it doubles.
+    The sleep part of the expectation is slept on the host before the first poll.
+*/
+class Stm32LinkBase
+{
+public:
+    virtual ~Stm32LinkBase(){}
+
+    virtual SpiTransport* transport() = 0;
+    virtual DebuggerExecutingState_t spi_transmit(uint8_t anWriteList[], uint8_t anReadList[], uint32_t nTransmitLength) = 0;
+    virtual DebuggerExecutingState_t is_ack_ok(uint32_t timeout_ms) = 0;
+    virtual DebuggerExecutingState_t send_data_frame(uint8_t data[], int length, uint32_t timeout_ms, bool defer_echo=false) = 0;
+    virtual void expect_busy(uint32_t busy_us, uint32_t sleep_us) = 0;  // next ACK wait only
+    virtual uint32_t last_busy_us() = 0;  // frame end to ACK/NAK of the last wait, 0 after a timeout
+};
+
+
+template <class Transport>
+class Stm32Link: public Stm32LinkBase
+{
+public:
+    Stm32Link(Transport* spi, bool own_spi, std::shared_ptr<spdlog::logger> logger)
+    {
+        assert(spi);
+        this->spi = spi;
+        this->own_spi = own_spi;
+        this->logger = logger;
+        this->echo_pending = false;
+        this->echo_buffer[0] = BL_ACK;
+        this->busy_us = 0;
+        this->sleep_us = 0;
+        this->measured_us = 0;
+        std::memset(this->ack_buffer, BL_IDLE, sizeof(this->ack_buffer));
+
+        uint32_t frequency_hz = 0;
+        if ((DebuggerExecutingNormal != spi->ReadFrequency(frequency_hz)) || (0 == frequency_hz)){
+            frequency_hz = BL_POLL_DEFAULT_HZ;
+        }
+        this->byte_ns = 8e9 / frequency_hz;
+    }
+
+    ~Stm32Link()
+    {
+        if (this->own_spi && this->spi){
+            delete this->spi;
+        }
+    }
+
+    SpiTransport* transport()
+    {
+        return this->spi;
+    }
+
+    DebuggerExecutingState_t spi_transmit(uint8_t anWriteList[], uint8_t anReadList[], uint32_t nTransmitLength)
+    {
+        if (this->echo_pending){
+            SpiSegment_t segments[2] = {{this->echo_buffer, NULL, 1, false, BL_ECHO_DELAY_US},
+                                        {anWriteList, anReadList, nTransmitLength, false, 0}};
+            this->echo_pending = false;
+            return this->spi->sTransmitv(segments, 2);
+        }
+        return this->spi->sTransmit(anWriteList, anReadList, nTransmitLength);
+    }
+
+    DebuggerExecutingState_t is_ack_ok(uint32_t timeout_ms)
+    {
+        return this->transact_ack(NULL, 0, timeout_ms, false);
+    }
+
+    DebuggerExecutingState_t send_data_frame(uint8_t data[], int length, uint32_t timeout_ms, bool defer_echo=false)
+    {
+        assert(length > 0);
+        assert(data);
+
+        return this->transact_ack(data, length, timeout_ms, defer_echo);
+    }
+
+    void expect_busy(uint32_t busy_us, uint32_t sleep_us)
+    {
+        this->busy_us = busy_us;
+        this->sleep_us = std::min(sleep_us, busy_us);
+    }
+
+    uint32_t last_busy_us()
+    {
+        return this->measured_us;
+    }
+
+private:
+    uint32_t poll_window(uint64_t elapsed_us, uint32_t busy_us, uint32_t previous)
+    {
+        double window = previous * 2.0;
+        if (elapsed_us < busy_us){
+            window = (busy_us - elapsed_us) * 1000.0 / this->byte_ns;
+        }
+        return std::max<uint32_t>(BL_POLL_WINDOW_MIN, std::min<double>(window, BL_POLL_WINDOW_MAX));
+    }
+
+    int find_ack(uint8_t resp[], uint32_t length)
+    {
+        for (uint32_t i=0; i<length; ++i){
+            if ((BL_ACK == resp[i]) || (BL_NAK == resp[i])){
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    DebuggerExecutingState_t transact_ack(uint8_t data[], int length, uint32_t timeout_ms, bool defer_echo)
+    {
+        /*
+        One transaction up to the first poll window, then one transaction per window:
+                     echo    Write DATA          window          window
+            MOSI: | [0x79] | D1 | D2 | D3 |  |0x00|0x00|0x00|  |0x00|0x00|0x00|0x00|  |0x79|
+            MISO: | [ xx ] | xx | xx | xx |  | xx |0xA5|0xA5|  |0xA5|0x79|0x79|0x79|  | xx |
+        The bootloader keeps ACK/NAK on MISO until the echo, bytes clocked after it are ignored.
+        */
+        DebuggerExecutingState_t stat;
+        SpiSegment_t segments[3];
+        uint32_t count = 0;
+        uint32_t busy_us = this->busy_us;
+        uint32_t sleep_us = this->sleep_us;
+        uint32_t window = (busy_us > 0)? this->poll_window(sleep_us, busy_us, 0): BL_POLL_WINDOW_START;
+        this->busy_us = 0;
+        this->sleep_us = 0;
+        this->measured_us = 0;
+
+        if (this->echo_pending){
+            segments[count++] = {this->echo_buffer, NULL, 1, false, BL_ECHO_DELAY_US};
+            this->echo_pending = false;
+        }
+        if (length > 0){
+            segments[count++] = {data, NULL, (uint32_t)length, false, 0};
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (sleep_us > 0){
+            // the frame alone, sleep through most of the busy time, then the dummy + first window
+            if (count > 0){
+                stat = this->spi->sTransmitv(segments, count);
+                if (DebuggerExecutingNormal != stat){
+                    return stat;
+                }
+                count = 0;
+            }
+            DbgrDelayUs(sleep_us);
+        }
+        std::memset(this->ack_buffer, BL_IDLE, window + 1);
+        segments[count++] = {this->ack_buffer, this->ack_buffer, window + 1, false, 0};  // dummy + first window
+        stat = this->spi->sTransmitv(segments, count);
+        if (DebuggerExecutingNormal != stat){
+            return stat;
+        }
+
+        uint32_t clocked = window + 1;
+        int index = this->find_ack(this->ack_buffer, window + 1);  // the dummy byte is never ACK/NAK
+        while (index < 0)
+        {
+            auto end = std::chrono::steady_clock::now();
+            uint64_t elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+            if (elapsed_us >= (uint64_t)timeout_ms * 1000){
+                this->logger->error("ACK wait timeout {:d} ms", timeout_ms);
+                return DebuggerExecutingHardwareBusy;
+            }
+            window = this->poll_window(elapsed_us, busy_us, window);
+            std::memset(this->ack_buffer, BL_IDLE, window);
+            this->spi->sTransmit(this->ack_buffer, this->ack_buffer, window);
+            clocked = window;
+            index = this->find_ack(this->ack_buffer, window);
+        }
+        uint8_t resp = this->ack_buffer[index];
+
+        // the ACK byte sits (clocked - index) bytes before the end of the last transfer, the frame is not busy time
+        double busy_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()
+                         - (clocked - index + length) * this->byte_ns;
+        this->measured_us = (busy_ns > 0)? busy_ns / 1000: 0;
+
+        // a NAK ends the command, its echo is never deferred
+        if (defer_echo && (BL_ACK == resp)){
+            this->echo_pending = true;
+        }
+        else {
+            this->spi->sTransmit(this->echo_buffer, NULL, 1);
+        }
+        return (BL_ACK == resp)? DebuggerExecutingNormal: DebuggerExecutingHardwareFault;
+    }
+
+private:
+    Transport* spi;
+    bool own_spi;
+    std::shared_ptr<spdlog::logger> logger;
+    bool echo_pending;
+    uint8_t echo_buffer[1];
+    uint32_t busy_us;
+    uint32_t sleep_us;
+    uint32_t measured_us;
+    double byte_ns;
+    uint8_t ack_buffer[BL_POLL_WINDOW_MAX + 1];
+};
+
+#endif
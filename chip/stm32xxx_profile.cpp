@@ -0,0 +1,24 @@
+#include "stm32xxx_profile.hpp"
+
+
+static const Stm32ChipProfile_t chip_profiles[] = {
+    /* pid      name                    dual_bank   program_unit    page_size   single_bank_page_size   bank_option_bit flash_size_addr uid_addr        bootloader_id_addr  write_defect_bootloader_id */
+    {  0x0415,  "STM32L47xxx/48xxx",    true,       8,              0x800,      0,                      0,              0x1FFF75E0,     0x1FFF7590,     0x1FFF6FFE,         0x00  },
+    {  0x0435,  "STM32L43xxx/44xxx",    false,      8,              0x800,      0,                      0,              0x1FFF75E0,     0x1FFF7590,     0x1FFF6FFE,         0x00  },
+    {  0x0461,  "STM32L496xx/4A6xx",    true,       8,              0x800,      0,                      0,              0x1FFF75E0,     0x1FFF7590,     0x1FFF6FFE,         0x00  },
+    {  0x0462,  "STM32L45xxx/46xxx",    false,      8,              0x800,      0,                      0,              0x1FFF75E0,     0x1FFF7590,     0x1FFF6FFE,         0x92  },
+    {  0x0464,  "STM32L41xxx/42xxx",    false,      8,              0x800,      0,                      0,              0x1FFF75E0,     0x1FFF7590,     0x1FFF6FFE,         0x00  },
+    {  0x0469,  "STM32G47xxx/48xxx",    true,       8,              0x800,      0x1000,                 22,             0x1FFF75E0,     0x1FFF7590,     0x1FFF6FFE,         0x00  },
+};
+
+
+const Stm32ChipProfile_t* stm32_chip_profile(uint16_t pid)
+{
+    for (const Stm32ChipProfile_t& profile: chip_profiles)
+    {
+        if (profile.pid == pid){
+            return &profile;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef __STM32XXX_PROFILE_HPP__
+#define __STM32XXX_PROFILE_HPP__
+
+#include "DbgrCommon.h"
+
+
+/* Part data the bootloader does not report, by the PID of Get ID. */
+typedef struct{
+    uint16_t pid;
+    const char* name;
+    bool dual_bank;                         // bank 2 starts in the middle of the flash, bank erase 0xFFFE/0xFFFD
+    uint8_t program_unit;                   // Bytes programmed at once by the flash, written aligned and whole
+    uint32_t page_size;                     // erase page, in dual-bank mode for a part having both modes
+    uint32_t single_bank_page_size;         // erase page with the bank option bit cleared, 0: no single-bank mode
+    uint8_t bank_option_bit;                // bank mode bit of the first option bytes word (FLASH_OPTR)
+    uint32_t flash_size_addr;               // flash size register, 16 bits in KB
+    uint32_t uid_addr;                      // 96-bit unique device ID
+    uint32_t bootloader_id_addr;            // AN2606 bootloader ID: the bootloader version
+    uint8_t write_defect_bootloader_id;     // bootloader version with the AN2606 SPI write limitation, 0: none
+}Stm32ChipProfile_t;
+
+
+const Stm32ChipProfile_t* stm32_chip_profile(uint16_t pid);
+
+#endif
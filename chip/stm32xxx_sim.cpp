@@ -0,0 +1,995 @@
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+#include "stm32xxx_sim.hpp"
+
+
+#define SIM_UID_OFFSET              0x90
+#define SIM_UID_SIZE_B              12
+#define SIM_FLASH_SIZE_REG_OFFSET   0xE0
+#define SIM_RDP_LEVEL_0             0xAA
+#define SIM_SPECIAL_ERASE_MASK      0xfff0
+#define SIM_MASS_ERASE              0xffff
+#define SIM_BANK1_ERASE             0xfffe
+#define SIM_BANK2_ERASE             0xfffd
+
+
+static const uint8_t sim_command_list[] = {
+    GET_CMD_COMMAND, GET_VER_COMMAND, GET_ID_COMMAND, RMEM_COMMAND, GO_COMMAND, WMEM_COMMAND,
+    EMEM_COMMAND, WP_COMMAND, WU_COMMAND, RP_COMMAND, RU_COMMAND
+};
+
+
+static uint8_t sim_xor(const uint8_t data[], uint32_t length)
+{
+    uint8_t checksum = 0x00;
+
+    for (uint32_t i=0; i<length; i++){
+        checksum ^= data[i];
+    }
+    return checksum;
+}
+
+
+Stm32SimConfig_t stm32_sim_default_config()
+{
+    /* STM32L452RE, timings from the STM32L4 datasheet flash memory characteristics */
+    Stm32SimConfig_t config;
+
+    std::memset(&config, 0, sizeof(config));
+    config.pid = SIM_L45X_PID;
+    config.protocol_version = SIM_PROTOCOL_VERSION;
+    config.bootloader_id = SIM_L45X_BOOTLOADER_ID;
+    config.bootloader_id_addr = SIM_L45X_BOOTLOADER_ID_ADDR;
+
+    config.flash_base = SIM_FLASH_BASE;
+    config.flash_size = SIM_FLASH_SIZE_B;
+    config.page_size = SIM_FLASH_PAGE_SIZE_B;
+    config.bank_size = 0;
+
+    config.ack_latency_us = 20;
+    config.dw_program_us = 82;          // tprog 64 bits (typ 81.69 us)
+    config.page_erase_us = 22000;       // tERASE (typ 22.02 ms)
+    config.mass_erase_us = 22100;       // tME (typ 22.13 ms)
+    config.protection_us = 25000;
+    config.checksum_kb_us = 13;         // 256 words, about 4 cycles each at 80 MHz
+    config.transfer_overhead_us = 0;
+    config.model_bus_time = false;
+
+    config.dw_drop_ppm = 20000;         // bootloader V9.2: 2% of the polled write frames
+    config.get_checksum = false;        // bootloader V9.2 speaks protocol v1.1
+    config.seed = 1;
+    config.time_scale = 1.0;
+    return config;
+}
+
+
+Stm32BootloaderSim::Stm32BootloaderSim(Stm32SimConfig_t config, std::shared_ptr<spdlog::logger> logger)
+{
+    assert(config.page_size > 0);
+    assert(config.flash_size % config.page_size == 0);
+    assert(config.time_scale >= 0);
+
+    this->cfg = config;
+    this->logger = logger;
+    this->frequency_hz = 0;
+    this->rng = config.seed ? config.seed : 1;
+    std::memset(&this->stats, 0, sizeof(this->stats));
+    this->logger->debug("Stm32BootloaderSim create, PID 0x{:03x} BL ID 0x{:02x}", config.pid, config.bootloader_id);
+
+    SimMemory_t flash = {config.flash_base, config.flash_size, SimMemoryFlash, std::vector<uint8_t>(config.flash_size, 0xff)};
+    SimMemory_t ram = {SIM_RAM_BASE, SIM_RAM_SIZE_B, SimMemoryRam, std::vector<uint8_t>(SIM_RAM_SIZE_B, 0x00)};
+    SimMemory_t system = {SIM_SYSTEM_MEMORY_BASE, SIM_SYSTEM_MEMORY_SIZE_B, SimMemoryReadOnly, std::vector<uint8_t>(SIM_SYSTEM_MEMORY_SIZE_B, 0x00)};
+    SimMemory_t otp = {SIM_OTP_BASE, SIM_OTP_SIZE_B, SimMemoryFlash, std::vector<uint8_t>(SIM_OTP_SIZE_B, 0xff)};
+    SimMemory_t info = {SIM_DEVICE_INFO_BASE, SIM_DEVICE_INFO_SIZE_B, SimMemoryReadOnly, std::vector<uint8_t>(SIM_DEVICE_INFO_SIZE_B, 0xff)};
+    SimMemory_t option = {SIM_OPTION_BYTES_BASE, SIM_OPTION_BYTES_SIZE_B, SimMemoryOptionBytes, std::vector<uint8_t>(SIM_OPTION_BYTES_SIZE_B, 0xff)};
+
+    if ((config.bootloader_id_addr >= system.base) && (config.bootloader_id_addr < system.base + system.size)){
+        system.data[config.bootloader_id_addr - system.base] = config.bootloader_id;
+    }
+    for (uint32_t i=0; i<SIM_UID_SIZE_B; ++i){
+        info.data[SIM_UID_OFFSET + i] = (uint8_t)((this->rng * 2654435761U) >> (i % 4 * 8)) ^ (uint8_t)(i * 0x3d);
+    }
+    info.data[SIM_FLASH_SIZE_REG_OFFSET] = (config.flash_size / 1024) & 0xff;
+    info.data[SIM_FLASH_SIZE_REG_OFFSET + 1] = ((config.flash_size / 1024) >> 8) & 0xff;
+    option.data[0] = SIM_RDP_LEVEL_0;
+
+    this->memories.push_back(flash);
+    this->memories.push_back(ram);
+    this->memories.push_back(system);
+    this->memories.push_back(otp);
+    this->memories.push_back(info);
+    this->memories.push_back(option);
+
+    this->dw_programmed.assign(config.flash_size / SIM_DOUBLE_WORD_B, 0);
+    this->wp_pages.assign(config.flash_size / config.page_size, 0);
+    this->rdp_active = false;
+    this->rx_buffer.resize(SIM_MAX_FRAME_SIZE_B + 2);
+    this->reset();
+    this->stats.resets = 0;
+}
+
+
+Stm32BootloaderSim::~Stm32BootloaderSim()
+{
+}
+
+
+DebuggerExecutingState_t Stm32BootloaderSim::SetFrequency(uint32_t nFreqencyHz)
+{
+    this->logger->debug("SIM SetFrequency={:d}", nFreqencyHz);
+    this->frequency_hz = nFreqencyHz;
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Stm32BootloaderSim::ReadFrequency(uint32_t &qFreqencyHz)
+{
+    qFreqencyHz = this->frequency_hz;
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Stm32BootloaderSim::SwitchSpiMode(SpiCpolnCphaMode_t tSpiModeMask)
+{
+    // the STM32 SPI bootloader samples in mode 0 only, the model does not check the clock edges
+    this->logger->debug("SIM SwitchSpiMode to {:d}", int(tSpiModeMask));
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Stm32BootloaderSim::sTransmit(uint8_t anWriteList[],uint8_t anReadList[],uint32_t nTransmitLength)
+{
+    SpiTransfer_t transfer = {anWriteList, anReadList, nTransmitLength};
+    this->stats.transactions++;
+    if (this->cfg.transfer_overhead_us){
+        this->wait_us(std::chrono::steady_clock::now(), this->cfg.transfer_overhead_us);
+    }
+    this->clock_transfer(transfer);
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Stm32BootloaderSim::sTransmitBatch(SpiTransfer_t atTransferList[], uint32_t nTransferCount)
+{
+    if (0 == nTransferCount){
+        return DebuggerExecutingNormal;
+    }
+    if (! atTransferList){
+        this->logger->error("SIM transfer list is NULL, line {:d}.", __LINE__);
+        return DebuggerExecutingNullPointerParamFault;
+    }
+
+    this->stats.transactions++;
+    if (this->cfg.transfer_overhead_us){
+        this->wait_us(std::chrono::steady_clock::now(), this->cfg.transfer_overhead_us);
+    }
+    for (uint32_t i=0; i<nTransferCount; ++i){
+        this->clock_transfer(atTransferList[i]);
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Stm32BootloaderSim::sTransmitv(SpiSegment_t atSegmentList[], uint32_t nSegmentCount)
+{
+    // chip select is not modelled, the bootloader only follows the clocked bytes
+    if (0 == nSegmentCount){
+        return DebuggerExecutingNormal;
+    }
+    if (! atSegmentList){
+        this->logger->error("SIM segment list is NULL, line {:d}.", __LINE__);
+        return DebuggerExecutingNullPointerParamFault;
+    }
+
+    this->stats.transactions++;
+    if (this->cfg.transfer_overhead_us){
+        this->wait_us(std::chrono::steady_clock::now(), this->cfg.transfer_overhead_us);
+    }
+    for (uint32_t i=0; i<nSegmentCount; ++i){
+        SpiTransfer_t transfer = {atSegmentList[i].pWriteList, atSegmentList[i].pReadList, atSegmentList[i].nTransmitLength};
+        this->clock_transfer(transfer);
+        if (atSegmentList[i].nDelayUs){
+            this->wait_us(std::chrono::steady_clock::now(), atSegmentList[i].nDelayUs);
+        }
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Stm32BootloaderSim::ModuleEnable(void)
+{
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t Stm32BootloaderSim::ModuleDisable(void)
+{
+    return DebuggerExecutingNormal;
+}
+
+
+void Stm32BootloaderSim::reset()
+{
+    /* system reset: the bootloader restarts and waits for the SOF byte again */
+    this->state = SimWaitSync;
+    this->command = BL_IDLE;
+    this->cmd_index = 0;
+    this->stage = 0;
+    this->rx_length = 0;
+    this->rx_expected = 0;
+    this->tx_queue.clear();
+    this->tx_index = 0;
+    this->tx_then_ack = false;
+    this->ack_byte = BL_ACK;
+    this->ack_primed = false;
+    this->ack_polled_busy = false;
+    this->ack_ready = std::chrono::steady_clock::now();
+    this->reset_after_echo = false;
+    this->addr = 0;
+    this->number = 0;
+    this->write_pending = false;
+    this->write_addr = 0;
+    this->write_length = 0;
+    this->stats.resets++;
+}
+
+
+bool Stm32BootloaderSim::peek(uint32_t addr, uint8_t* data, uint32_t size)
+{
+    assert(data);
+
+    SimMemory_t* mem = this->find_memory(addr, size);
+    if (! mem){
+        return false;
+    }
+    std::copy(mem->data.begin() + (addr - mem->base), mem->data.begin() + (addr - mem->base + size), data);
+    return true;
+}
+
+
+bool Stm32BootloaderSim::poke(uint32_t addr, const uint8_t* data, uint32_t size)
+{
+    assert(data);
+
+    SimMemory_t* mem = this->find_memory(addr, size);
+    if (! mem){
+        return false;
+    }
+    std::copy(data, data + size, mem->data.begin() + (addr - mem->base));
+    return true;
+}
+
+
+void Stm32BootloaderSim::set_readout_protection(bool active)
+{
+    this->rdp_active = active;
+}
+
+
+const Stm32SimConfig_t& Stm32BootloaderSim::config()
+{
+    return this->cfg;
+}
+
+
+const Stm32SimStatistics_t& Stm32BootloaderSim::statistics()
+{
+    return this->stats;
+}
+
+
+void Stm32BootloaderSim::reset_statistics()
+{
+    std::memset(&this->stats, 0, sizeof(this->stats));
+}
+
+
+void Stm32BootloaderSim::clock_transfer(SpiTransfer_t& transfer)
+{
+    /* one CS frame, the bytes are clocked at the bus frequency when model_bus_time is set */
+    double byte_us = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    if (this->cfg.model_bus_time && this->frequency_hz){
+        byte_us = 8e6 / this->frequency_hz;
+    }
+    this->stats.transfers++;
+    this->stats.bytes += transfer.nTransmitLength;
+    for (uint32_t i=0; i<transfer.nTransmitLength; ++i)
+    {
+        if (byte_us > 0){
+            this->wait_us(start, byte_us * (i + 1));
+        }
+        uint8_t miso = this->clock_byte(transfer.pWriteList ? transfer.pWriteList[i] : BL_IDLE);
+        if (transfer.pReadList){
+            transfer.pReadList[i] = miso;
+        }
+    }
+}
+
+
+uint8_t Stm32BootloaderSim::clock_byte(uint8_t mosi)
+{
+    /*
+    Full duplex: the MISO byte is loaded before the MOSI byte is decoded.
+        WaitSync      -> 0x5A: ACK procedure, then WaitCommand
+        WaitCommand   -> 0x5A | Cmd | Cmd XOR: ACK or NAK
+        AckWait       -> MISO 0xA5 until the operation is done, then ACK/NAK
+        AckEcho       -> MISO ACK/NAK until the host echoes 0x79, then the next stage of the command
+        ReceiveFrame  -> host data frame of a known length
+        TransmitData  -> 0xA5 followed by the reply of the command
+    */
+    uint8_t miso = BL_DUMMY;
+
+    switch (this->state){
+        case SimWaitSync:
+            if (BL_SPI_SOF == mosi){
+                this->command = BL_SPI_SOF;
+                this->stage = 0;
+                this->ack(BL_ACK, this->cfg.ack_latency_us);
+            }
+            break;
+
+        case SimWaitCommand:
+            if (0 == this->cmd_index){
+                if (BL_SPI_SOF == mosi){
+                    this->cmd_index = 1;
+                }
+            }
+            else if (1 == this->cmd_index){
+                this->command = mosi;
+                this->cmd_index = 2;
+            }
+            else {
+                this->cmd_index = 0;
+                this->stage = 0;
+                this->stats.commands++;
+                if ((uint8_t)(this->command ^ 0xff) != mosi){
+                    this->ack(BL_NAK, this->cfg.ack_latency_us);
+                }
+                else {
+                    this->start_command();
+                }
+            }
+            break;
+
+        case SimReceiveFrame:
+            this->rx_buffer[this->rx_length++] = mosi;
+            if ((WMEM_COMMAND == this->command) && (2 == this->stage) && (1 == this->rx_length)){
+                this->rx_expected = (uint32_t)mosi + 3;  // N + (N + 1) data + checksum
+            }
+            if (this->rx_length >= this->rx_expected){
+                this->handle_frame();
+            }
+            break;
+
+        case SimAckWait:
+        {
+            // the byte clocked right after a frame is always a dummy, the host may poll afterwards
+            bool ready = (std::chrono::steady_clock::now() >= this->ack_ready);
+            if (! ready){
+                this->ack_polled_busy = true;
+            }
+            if (this->ack_primed && ready){
+                if (this->write_pending){
+                    this->commit_write();
+                }
+                miso = this->ack_byte;
+                this->state = SimAckEcho;
+            }
+            this->ack_primed = true;
+            break;
+        }
+
+        case SimAckEcho:
+            // the ACK/NAK stays in the TX register until the host echoes 0x79
+            miso = this->ack_byte;
+            if (BL_ACK == mosi){
+                this->after_echo();
+            }
+            break;
+
+        case SimTransmitData:
+            miso = this->tx_queue[this->tx_index++];
+            if (this->tx_index >= this->tx_queue.size()){
+                if (this->tx_then_ack){
+                    this->ack(BL_ACK, this->cfg.ack_latency_us);
+                }
+                else {
+                    this->state = SimWaitCommand;
+                }
+            }
+            break;
+
+        case SimApplication:
+            miso = BL_IDLE;
+            break;
+    }
+    return miso;
+}
+
+
+void Stm32BootloaderSim::start_command()
+{
+    bool supported = (std::find(sim_command_list, sim_command_list + sizeof(sim_command_list), this->command)
+                      != sim_command_list + sizeof(sim_command_list))
+                     || (this->cfg.get_checksum && (GET_CHECKSUM_COMMAND == this->command));
+
+    if (! supported){
+        this->logger->debug("SIM unknown command 0x{:02x}", this->command);
+        this->ack(BL_NAK, this->cfg.ack_latency_us);
+        return;
+    }
+    // RDP active: only the commands that do not access the memory are accepted
+    if (this->rdp_active && (GET_CMD_COMMAND != this->command) && (GET_VER_COMMAND != this->command)
+        && (GET_ID_COMMAND != this->command) && (RU_COMMAND != this->command)){
+        this->ack(BL_NAK, this->cfg.ack_latency_us);
+        return;
+    }
+    this->ack(BL_ACK, this->cfg.ack_latency_us);
+}
+
+
+void Stm32BootloaderSim::after_echo()
+{
+    int current = this->stage++;
+
+    if (BL_NAK == this->ack_byte){
+        this->state = SimWaitCommand;
+        return;
+    }
+    if (this->reset_after_echo){
+        this->reset();
+        return;
+    }
+
+    switch (this->command){
+        case BL_SPI_SOF:
+            this->state = SimWaitCommand;
+            break;
+
+        case GET_CMD_COMMAND:
+            if (0 == current){
+                std::vector<uint8_t> data = {BL_DUMMY, 0, this->cfg.protocol_version};
+                data.insert(data.end(), sim_command_list, sim_command_list + sizeof(sim_command_list));
+                if (this->cfg.get_checksum){
+                    data.push_back(GET_CHECKSUM_COMMAND);
+                }
+                data[1] = data.size() - 3;  // N = version + commands - 1
+                this->transmit(&data[0], data.size(), true);
+            }
+            else {
+                this->state = SimWaitCommand;
+            }
+            break;
+
+        case GET_VER_COMMAND:
+            if (0 == current){
+                uint8_t data[2] = {BL_DUMMY, this->cfg.protocol_version};
+                this->transmit(data, sizeof(data), true);
+            }
+            else {
+                this->state = SimWaitCommand;
+            }
+            break;
+
+        case GET_ID_COMMAND:
+            if (0 == current){
+                uint8_t data[4] = {BL_DUMMY, 1, (uint8_t)(this->cfg.pid >> 8), (uint8_t)(this->cfg.pid & 0xff)};
+                this->transmit(data, sizeof(data), true);
+            }
+            else {
+                this->state = SimWaitCommand;
+            }
+            break;
+
+        case RMEM_COMMAND:
+            if (0 == current){
+                this->receive(5);
+            }
+            else if (1 == current){
+                this->receive(2);
+            }
+            else {
+                std::vector<uint8_t> data(this->number + 2, BL_DUMMY);
+                this->peek(this->addr, &data[1], this->number + 1);
+                this->transmit(&data[0], data.size(), false);
+            }
+            break;
+
+        case WMEM_COMMAND:
+            if (0 == current){
+                this->receive(5);
+            }
+            else if (1 == current){
+                this->receive(1);  // the length follows from the first byte
+            }
+            else {
+                this->state = SimWaitCommand;
+            }
+            break;
+
+        case GO_COMMAND:
+            if (0 == current){
+                this->receive(5);
+            }
+            else {
+                this->logger->debug("SIM jump to application 0x{:08x}", this->addr);
+                this->state = SimApplication;
+            }
+            break;
+
+        case EMEM_COMMAND:
+            if (0 == current){
+                this->receive(3);
+            }
+            else if ((1 == current) && ((this->number & SIM_SPECIAL_ERASE_MASK) != SIM_SPECIAL_ERASE_MASK)){
+                this->receive(2 * (this->number + 1) + 1);
+            }
+            else {
+                this->state = SimWaitCommand;
+            }
+            break;
+
+        case WP_COMMAND:
+            if (0 == current){
+                this->receive(2);
+            }
+            else {
+                this->receive(this->number + 2);
+            }
+            break;
+
+        case WU_COMMAND:
+            std::fill(this->wp_pages.begin(), this->wp_pages.end(), 0);
+            this->reset_after_echo = true;
+            this->ack(BL_ACK, this->cfg.protection_us);
+            break;
+
+        case RP_COMMAND:
+            this->rdp_active = true;
+            this->reset_after_echo = true;
+            this->ack(BL_ACK, this->cfg.protection_us);
+            break;
+
+        case GET_CHECKSUM_COMMAND:
+            // address, size in words, polynomial, initial value, then the CRC
+            if (current < 4){
+                this->receive(5);
+            }
+            else if (4 == current){
+                uint8_t data[6] = {BL_DUMMY, (uint8_t)(this->checksum >> 24), (uint8_t)(this->checksum >> 16),
+                                   (uint8_t)(this->checksum >> 8), (uint8_t)this->checksum, 0};
+                data[5] = sim_xor(&data[1], 4);
+                this->transmit(data, sizeof(data), true);
+            }
+            else {
+                this->state = SimWaitCommand;
+            }
+            break;
+
+        case RU_COMMAND:
+            // regression to RDP level 0 erases the whole flash memory and the RAM
+            this->mass_erase(0, this->wp_pages.size());
+            std::fill(this->memories[1].data.begin(), this->memories[1].data.end(), 0x00);
+            this->rdp_active = false;
+            this->reset_after_echo = true;
+            this->ack(BL_ACK, this->cfg.mass_erase_us + this->cfg.protection_us);
+            break;
+
+        default:
+            this->state = SimWaitCommand;
+            break;
+    }
+}
+
+
+void Stm32BootloaderSim::handle_frame()
+{
+    uint8_t* rx = &this->rx_buffer[0];
+    int current = this->stage;
+
+    switch (this->command){
+        case RMEM_COMMAND:
+        case WMEM_COMMAND:
+        case GO_COMMAND:
+            if (1 == current){
+                if (sim_xor(rx, 4) != rx[4]){
+                    this->ack(BL_NAK, this->cfg.ack_latency_us);
+                    return;
+                }
+                this->addr = ((uint32_t)rx[0] << 24) | ((uint32_t)rx[1] << 16) | ((uint32_t)rx[2] << 8) | rx[3];
+                if (GO_COMMAND == this->command){
+                    SimMemory_t* mem = this->find_memory(this->addr, 4);
+                    bool valid = mem && ((SimMemoryFlash == mem->kind) || (SimMemoryRam == mem->kind));
+                    this->ack(valid ? BL_ACK : BL_NAK, this->cfg.ack_latency_us);
+                }
+                else {
+                    this->ack(this->memory_valid(this->addr, 1, WMEM_COMMAND == this->command) ? BL_ACK : BL_NAK,
+                              this->cfg.ack_latency_us);
+                }
+            }
+            else if (RMEM_COMMAND == this->command){
+                this->number = rx[0];
+                if (((rx[0] ^ 0xff) != rx[1]) || (! this->memory_valid(this->addr, this->number + 1, false))){
+                    this->ack(BL_NAK, this->cfg.ack_latency_us);
+                    return;
+                }
+                this->ack(BL_ACK, this->cfg.ack_latency_us);
+            }
+            else {
+                this->handle_write_frame();
+            }
+            break;
+
+        case EMEM_COMMAND:
+            if (1 == current){
+                this->handle_erase_number();
+            }
+            else {
+                this->handle_erase_pages();
+            }
+            break;
+
+        case GET_CHECKSUM_COMMAND:
+            this->handle_checksum_frame();
+            break;
+
+        case WP_COMMAND:
+            if (1 == current){
+                this->number = rx[0];
+                this->ack(((rx[0] ^ 0xff) == rx[1]) ? BL_ACK : BL_NAK, this->cfg.ack_latency_us);
+            }
+            else {
+                if ((sim_xor(rx, this->number + 1) != rx[this->number + 1])){
+                    this->ack(BL_NAK, this->cfg.ack_latency_us);
+                    return;
+                }
+                std::fill(this->wp_pages.begin(), this->wp_pages.end(), 0);
+                for (uint32_t i=0; i<=this->number; ++i){
+                    if (rx[i] < this->wp_pages.size()){
+                        this->wp_pages[rx[i]] = 1;
+                    }
+                }
+                this->reset_after_echo = true;
+                this->ack(BL_ACK, this->cfg.protection_us);
+            }
+            break;
+
+        default:
+            this->ack(BL_NAK, this->cfg.ack_latency_us);
+            break;
+    }
+}
+
+
+void Stm32BootloaderSim::handle_write_frame()
+{
+    /* N | N + 1 data | checksum, flash memory writes must be 16-bit aligned */
+    uint8_t* rx = &this->rx_buffer[0];
+    uint32_t length = (uint32_t)rx[0] + 1;
+
+    if (sim_xor(rx, length + 1) != rx[length + 1]){
+        this->ack(BL_NAK, this->cfg.ack_latency_us);
+        return;
+    }
+    if (! this->memory_valid(this->addr, length, true)){
+        this->ack(BL_NAK, this->cfg.ack_latency_us);
+        return;
+    }
+
+    SimMemory_t* mem = this->find_memory(this->addr, length);
+    uint32_t busy_us = this->cfg.ack_latency_us;
+    if (SimMemoryFlash == mem->kind){
+        if ((this->addr % 2) || (length % 2)){
+            this->ack(BL_NAK, this->cfg.ack_latency_us);
+            return;
+        }
+        // programming only clears bits, a 1 over a 0 needs an erase first
+        for (uint32_t i=0; i<length; ++i){
+            uint8_t old_value = mem->data[this->addr - mem->base + i];
+            if (((old_value & rx[i + 1]) != rx[i + 1]) && (! this->page_protected(this->addr + i))){
+                this->logger->debug("SIM write 0x{:08x} over programmed data", this->addr + i);
+                this->ack(BL_NAK, this->cfg.ack_latency_us);
+                return;
+            }
+        }
+        // PROGERR: a programmed double-word only takes all zeros, it is not programmed again otherwise
+        if (mem->base == this->cfg.flash_base){
+            uint32_t offset = this->addr - mem->base;
+            for (uint32_t dw=offset / SIM_DOUBLE_WORD_B; dw<=(offset + length - 1) / SIM_DOUBLE_WORD_B; ++dw)
+            {
+                uint32_t begin = std::max(offset, dw * SIM_DOUBLE_WORD_B);
+                uint32_t end = std::min(offset + length, (dw + 1) * SIM_DOUBLE_WORD_B);
+                bool zeros = (end - begin == SIM_DOUBLE_WORD_B)
+                             && std::all_of(rx + 1 + (begin - offset), rx + 1 + (end - offset), [](uint8_t b){return 0 == b;});
+                if (this->dw_programmed[dw] && (! zeros) && (! this->page_protected(mem->base + dw * SIM_DOUBLE_WORD_B))){
+                    this->logger->debug("SIM write 0x{:08x} over a programmed double-word, PROGERR", mem->base + dw * SIM_DOUBLE_WORD_B);
+                    this->stats.dw_reprogrammed++;
+                    this->ack(BL_NAK, this->cfg.ack_latency_us);
+                    return;
+                }
+            }
+        }
+        uint32_t first_dw = this->addr / SIM_DOUBLE_WORD_B;
+        uint32_t last_dw = (this->addr + length - 1) / SIM_DOUBLE_WORD_B;
+        busy_us += (last_dw - first_dw + 1) * this->cfg.dw_program_us;
+    }
+    else if (SimMemoryOptionBytes == mem->kind){
+        busy_us = this->cfg.protection_us;
+        this->reset_after_echo = true;
+    }
+
+    this->write_addr = this->addr;
+    this->write_length = length;
+    std::copy(rx + 1, rx + 1 + length, this->write_data);
+    this->write_pending = true;
+    this->ack(BL_ACK, busy_us);
+}
+
+
+void Stm32BootloaderSim::handle_erase_number()
+{
+    uint8_t* rx = &this->rx_buffer[0];
+
+    if ((rx[0] ^ rx[1]) != rx[2]){
+        this->ack(BL_NAK, this->cfg.ack_latency_us);
+        return;
+    }
+    this->number = ((uint32_t)rx[0] << 8) | rx[1];
+
+    uint32_t page_count = this->wp_pages.size();
+    uint32_t bank_pages = this->cfg.bank_size / this->cfg.page_size;
+    switch (this->number){
+        case SIM_MASS_ERASE:
+            this->mass_erase(0, page_count);
+            this->ack(BL_ACK, this->cfg.mass_erase_us);
+            break;
+        case SIM_BANK1_ERASE:
+        case SIM_BANK2_ERASE:
+            if (0 == bank_pages){
+                this->ack(BL_NAK, this->cfg.ack_latency_us);
+                break;
+            }
+            if (SIM_BANK1_ERASE == this->number){
+                this->mass_erase(0, bank_pages);
+            }
+            else {
+                this->mass_erase(bank_pages, page_count - bank_pages);
+            }
+            this->ack(BL_ACK, this->cfg.mass_erase_us);
+            break;
+        default:
+            if (((this->number & SIM_SPECIAL_ERASE_MASK) == SIM_SPECIAL_ERASE_MASK) || (this->number >= page_count)){
+                this->ack(BL_NAK, this->cfg.ack_latency_us);
+                break;
+            }
+            this->ack(BL_ACK, this->cfg.ack_latency_us);
+            break;
+    }
+}
+
+
+void Stm32BootloaderSim::handle_erase_pages()
+{
+    /* (N + 1) page codes of 2 bytes, MSB first, then the XOR of all of them */
+    uint8_t* rx = &this->rx_buffer[0];
+    uint32_t count = this->number + 1;
+
+    if (sim_xor(rx, 2 * count) != rx[2 * count]){
+        this->ack(BL_NAK, this->cfg.ack_latency_us);
+        return;
+    }
+    for (uint32_t i=0; i<count; ++i){
+        uint32_t page = ((uint32_t)rx[2 * i] << 8) | rx[2 * i + 1];
+        if (page >= this->wp_pages.size()){
+            this->ack(BL_NAK, this->cfg.ack_latency_us);
+            return;
+        }
+    }
+    for (uint32_t i=0; i<count; ++i){
+        this->erase_page(((uint32_t)rx[2 * i] << 8) | rx[2 * i + 1]);
+    }
+    this->ack(BL_ACK, count * this->cfg.page_erase_us);
+}
+
+
+void Stm32BootloaderSim::handle_checksum_frame()
+{
+    /* 4 Bytes MSB first + XOR each. The CRC unit takes the 32-bit words as the CPU reads them, MSB first. */
+    uint8_t* rx = &this->rx_buffer[0];
+    uint32_t value = ((uint32_t)rx[0] << 24) | ((uint32_t)rx[1] << 16) | ((uint32_t)rx[2] << 8) | rx[3];
+    bool valid = (sim_xor(rx, 4) == rx[4]);
+
+    switch (this->stage){
+        case 1:
+            this->addr = value;
+            valid = valid && (0 == value % 4);
+            break;
+        case 2:
+            this->number = value;
+            valid = valid && (value > 0) && (value <= UINT32_MAX / 4) && this->memory_valid(this->addr, value * 4, false);
+            break;
+        case 3:
+            this->checksum_poly = value;
+            break;
+        default:
+        {
+            if (! valid){
+                break;
+            }
+            std::vector<uint8_t> data(this->number * 4);
+            this->peek(this->addr, &data[0], data.size());
+            uint32_t crc = value;
+            for (uint32_t i=0; i<data.size(); i+=4){
+                crc ^= (uint32_t)data[i] | ((uint32_t)data[i + 1] << 8) | ((uint32_t)data[i + 2] << 16) | ((uint32_t)data[i + 3] << 24);
+                for (int bit=0; bit<32; ++bit){
+                    crc = (crc & 0x80000000U)? (crc << 1) ^ this->checksum_poly: (crc << 1);
+                }
+            }
+            this->checksum = crc;
+            this->ack(BL_ACK, this->cfg.ack_latency_us + (uint64_t)this->cfg.checksum_kb_us * data.size() / 1024);
+            return;
+        }
+    }
+    this->ack(valid ? BL_ACK : BL_NAK, this->cfg.ack_latency_us);
+}
+
+
+void Stm32BootloaderSim::ack(uint8_t resp, uint32_t busy_us)
+{
+    this->state = SimAckWait;
+    this->ack_byte = resp;
+    this->ack_primed = false;
+    this->ack_polled_busy = false;
+    this->ack_ready = std::chrono::steady_clock::now()
+                      + std::chrono::nanoseconds((int64_t)(busy_us * 1000.0 * this->cfg.time_scale));
+    if (BL_NAK == resp){
+        this->stats.naks++;
+    }
+}
+
+
+void Stm32BootloaderSim::receive(uint32_t length)
+{
+    this->state = SimReceiveFrame;
+    this->rx_length = 0;
+    this->rx_expected = length;
+    if (this->rx_buffer.size() < length){
+        this->rx_buffer.resize(length);
+    }
+}
+
+
+void Stm32BootloaderSim::transmit(const uint8_t* data, uint32_t length, bool then_ack)
+{
+    this->state = SimTransmitData;
+    this->tx_queue.assign(data, data + length);
+    this->tx_index = 0;
+    this->tx_then_ack = then_ack;
+}
+
+
+void Stm32BootloaderSim::commit_write()
+{
+    /*
+    The flash memory is programmed when the ACK goes out.
+    V9.2 defect: a frame polled while the flash is busy may leave 2 double-words blank at 0xFF.
+    */
+    SimMemory_t* mem = this->find_memory(this->write_addr, this->write_length);
+    assert(mem);
+    this->write_pending = false;
+    this->stats.frames_written++;
+
+    if (SimMemoryFlash != mem->kind){
+        std::copy(this->write_data, this->write_data + this->write_length, mem->data.begin() + (this->write_addr - mem->base));
+        return;
+    }
+
+    uint32_t offset = this->write_addr - mem->base;
+    bool main_flash = (mem->base == this->cfg.flash_base);
+    uint32_t first_dw = offset / SIM_DOUBLE_WORD_B;
+    uint32_t last_dw = (offset + this->write_length - 1) / SIM_DOUBLE_WORD_B;
+    bool drop = false;
+    uint32_t drop_dw = 0;
+
+    if (this->ack_polled_busy){
+        this->stats.frames_polled_busy++;
+        if (main_flash && this->cfg.dw_drop_ppm && (this->random() % 1000000 < this->cfg.dw_drop_ppm)){
+            drop = true;
+            drop_dw = first_dw + this->random() % (last_dw - first_dw + 1);
+        }
+    }
+
+    for (uint32_t dw=first_dw; dw<=last_dw; ++dw)
+    {
+        if (drop && ((dw == drop_dw) || (dw == drop_dw + 1))){
+            this->stats.dw_dropped++;
+            continue;
+        }
+        if (main_flash && this->page_protected(mem->base + dw * SIM_DOUBLE_WORD_B)){
+            continue;  // no error on write protected pages
+        }
+        uint32_t begin = std::max(offset, dw * SIM_DOUBLE_WORD_B);
+        uint32_t end = std::min(offset + this->write_length, (dw + 1) * SIM_DOUBLE_WORD_B);
+        for (uint32_t i=begin; i<end; ++i){
+            mem->data[i] &= this->write_data[i - offset];
+        }
+        if (main_flash){
+            this->dw_programmed[dw] = 1;
+        }
+    }
+}
+
+
+void Stm32BootloaderSim::erase_page(uint32_t page)
+{
+    if (this->wp_pages[page]){
+        return;  // no error on write protected pages
+    }
+    SimMemory_t& flash = this->memories[0];
+    uint32_t dw_per_page = this->cfg.page_size / SIM_DOUBLE_WORD_B;
+    std::fill(flash.data.begin() + page * this->cfg.page_size, flash.data.begin() + (page + 1) * this->cfg.page_size, 0xff);
+    std::fill(this->dw_programmed.begin() + page * dw_per_page, this->dw_programmed.begin() + (page + 1) * dw_per_page, 0);
+    this->stats.pages_erased++;
+}
+
+
+void Stm32BootloaderSim::mass_erase(uint32_t first_page, uint32_t page_count)
+{
+    for (uint32_t page=first_page; page<first_page + page_count; ++page){
+        this->erase_page(page);
+    }
+    this->stats.mass_erases++;
+}
+
+
+bool Stm32BootloaderSim::memory_valid(uint32_t addr, uint32_t size, bool write)
+{
+    SimMemory_t* mem = this->find_memory(addr, size);
+    if (! mem){
+        return false;
+    }
+    return ! (write && (SimMemoryReadOnly == mem->kind));
+}
+
+
+Stm32BootloaderSim::SimMemory_t* Stm32BootloaderSim::find_memory(uint32_t addr, uint32_t size)
+{
+    for (auto& mem: this->memories){
+        if ((addr >= mem.base) && ((uint64_t)addr + size <= (uint64_t)mem.base + mem.size)){
+            return &mem;
+        }
+    }
+    return NULL;
+}
+
+
+bool Stm32BootloaderSim::page_protected(uint32_t addr)
+{
+    if ((addr < this->cfg.flash_base) || (addr >= this->cfg.flash_base + this->cfg.flash_size)){
+        return false;
+    }
+    return this->wp_pages[(addr - this->cfg.flash_base) / this->cfg.page_size] != 0;
+}
+
+
+void Stm32BootloaderSim::wait_us(std::chrono::steady_clock::time_point from, double us)
+{
+    // busy wait, the sleep granularity of the OS is far above one SPI byte
+    auto until = from + std::chrono::nanoseconds((int64_t)(us * 1000.0));
+    while (std::chrono::steady_clock::now() < until){
+    }
+}
+
+
+uint32_t Stm32BootloaderSim::random()
+{
+    // xorshift32, reproducible from cfg.seed
+    this->rng ^= this->rng << 13;
+    this->rng ^= this->rng >> 17;
+    this->rng ^= this->rng << 5;
+    return this->rng;
+}
@@ -0,0 +1,203 @@
+#ifndef __STM32XXX_SIM_HPP__
+#define __STM32XXX_SIM_HPP__
+
+#include <chrono>
+#include <vector>
+#include "DbgrCommon.h"
+#include "interface/SpiTransport.h"
+#include "stm32xxx_link.hpp"
+
+
+#define SIM_FLASH_BASE              0x08000000U
+#define SIM_FLASH_SIZE_B            (512 * 1024)    // STM32L452RE
+#define SIM_FLASH_PAGE_SIZE_B       (2 * 1024)
+#define SIM_RAM_BASE                0x20000000U
+#define SIM_RAM_SIZE_B              (160 * 1024)
+#define SIM_SYSTEM_MEMORY_BASE      0x1FFF0000U
+#define SIM_SYSTEM_MEMORY_SIZE_B    0x7000
+#define SIM_OTP_BASE                0x1FFF7000U
+#define SIM_OTP_SIZE_B              1024
+#define SIM_DEVICE_INFO_BASE        0x1FFF7500U     // UID at 0x1FFF7590, flash size at 0x1FFF75E0
+#define SIM_DEVICE_INFO_SIZE_B      0x100
+#define SIM_OPTION_BYTES_BASE       0x1FFF7800U
+#define SIM_OPTION_BYTES_SIZE_B     40
+
+#define SIM_L45X_PID                0x0462U
+#define SIM_L45X_BOOTLOADER_ID      0x92U           // AN2606: STM32L45xxx/46xxx bootloader V9.2
+#define SIM_L45X_BOOTLOADER_ID_ADDR 0x1FFF6FFEU
+#define SIM_PROTOCOL_VERSION        0x11U
+
+#define SIM_DOUBLE_WORD_B           8
+#define SIM_MAX_FRAME_SIZE_B        256
+
+
+/*
+    Timing and identity of the simulated part, every duration is in microseconds of device time.
+    Durations are multiplied by time_scale, 0 makes the part answer as soon as the protocol allows.
+*/
+typedef struct{
+    uint16_t pid;
+    uint8_t  protocol_version;
+    uint8_t  bootloader_id;
+    uint32_t bootloader_id_addr;
+
+    uint32_t flash_base;
+    uint32_t flash_size;
+    uint32_t page_size;
+    uint32_t bank_size;                 // 0 for single bank parts, else bank 2 starts at flash_base + bank_size
+
+    uint32_t ack_latency_us;            // command decoding before ACK/NAK
+    uint32_t dw_program_us;             // one 64-bit double-word program
+    uint32_t page_erase_us;
+    uint32_t mass_erase_us;
+    uint32_t protection_us;             // option byte update of WP/WU/RP
+    uint32_t checksum_kb_us;            // Get Checksum: CRC unit fed with 1 KB by the CPU
+    uint32_t transfer_overhead_us;      // host driver cost of one bus transaction (sTransmit, batch or vectored call)
+    bool     model_bus_time;            // clock every byte at the configured SPI frequency
+
+    /* AN2606 STM32L45xxx/46xxx V9.2: a write polled while the flash is busy may leave 2 double-words blank.
+       Probability per polled write frame in parts per million, 0 disables the defect. */
+    uint32_t dw_drop_ppm;
+    bool     get_checksum;              // bootloader protocol v1.3: Get Checksum command listed by Get CMD
+    uint32_t seed;
+    double   time_scale;
+}Stm32SimConfig_t;
+
+
+typedef struct{
+    uint64_t transactions;              // bus transactions: one per sTransmit, batch or vectored call
+    uint64_t transfers;                 // transfers inside the transactions
+    uint64_t bytes;
+    uint64_t commands;
+    uint64_t naks;
+    uint64_t frames_written;
+    uint64_t frames_polled_busy;        // write frames polled before the flash finished
+    uint64_t dw_dropped;
+    uint64_t dw_reprogrammed;           // writes over a programmed double-word without erase: PROGERR, NAKed
+    uint64_t pages_erased;
+    uint64_t mass_erases;
+    uint64_t resets;
+}Stm32SimStatistics_t;
+
+
+Stm32SimConfig_t stm32_sim_default_config();
+
+
+/*
+    In-process STM32 SPI bootloader (AN4286) behind the SpiTransport interface.
+    Every clocked byte runs through the bootloader state machine: SOF/ACK handshake, the command set
+    from GET_CMD_COMMAND to RU_COMMAND, a flash model with double-word programming and page erase timing.
+*/
+class Stm32BootloaderSim final : public SpiTransport
+{
+public:
+    Stm32BootloaderSim(Stm32SimConfig_t config=stm32_sim_default_config(),
+                       std::shared_ptr<spdlog::logger> logger=spdlog::default_logger());
+    ~Stm32BootloaderSim() override;
+
+    DebuggerExecutingState_t SetFrequency(uint32_t nFreqencyHz) override;
+    DebuggerExecutingState_t ReadFrequency(uint32_t &qFreqencyHz) override;
+    DebuggerExecutingState_t SwitchSpiMode(SpiCpolnCphaMode_t tSpiModeMask) override;
+    DebuggerExecutingState_t sTransmit(uint8_t anWriteList[],uint8_t anReadList[],uint32_t nTransmitLength) override;
+    DebuggerExecutingState_t sTransmitBatch(SpiTransfer_t atTransferList[], uint32_t nTransferCount) override;
+    DebuggerExecutingState_t sTransmitv(SpiSegment_t atSegmentList[], uint32_t nSegmentCount) override;
+    DebuggerExecutingState_t ModuleEnable(void) override;
+    DebuggerExecutingState_t ModuleDisable(void) override;
+
+    /* back door of the model, no bus traffic */
+    void reset();
+    bool peek(uint32_t addr, uint8_t* data, uint32_t size);
+    bool poke(uint32_t addr, const uint8_t* data, uint32_t size);
+    void set_readout_protection(bool active);
+    const Stm32SimConfig_t& config();
+    const Stm32SimStatistics_t& statistics();
+    void reset_statistics();
+
+private:
+    typedef enum{
+        SimWaitSync = 0,
+        SimWaitCommand,
+        SimReceiveFrame,
+        SimAckWait,
+        SimAckEcho,
+        SimTransmitData,
+        SimApplication,
+    }SimState_t;
+
+    typedef enum{
+        SimMemoryFlash = 0,
+        SimMemoryRam,
+        SimMemoryReadOnly,
+        SimMemoryOptionBytes,
+    }SimMemoryKind_t;
+
+    typedef struct{
+        uint32_t base;
+        uint32_t size;
+        SimMemoryKind_t kind;
+        std::vector<uint8_t> data;
+    }SimMemory_t;
+
+    void clock_transfer(SpiTransfer_t& transfer);
+    uint8_t clock_byte(uint8_t mosi);
+    void start_command();
+    void handle_frame();
+    void handle_write_frame();
+    void handle_erase_number();
+    void handle_erase_pages();
+    void handle_checksum_frame();
+    void after_echo();
+    void ack(uint8_t resp, uint32_t busy_us);
+    void receive(uint32_t length);
+    void transmit(const uint8_t* data, uint32_t length, bool then_ack);
+    void commit_write();
+    void erase_page(uint32_t page);
+    void mass_erase(uint32_t first_page, uint32_t page_count);
+    bool memory_valid(uint32_t addr, uint32_t size, bool write);
+    SimMemory_t* find_memory(uint32_t addr, uint32_t size);
+    bool page_protected(uint32_t addr);
+    void wait_us(std::chrono::steady_clock::time_point from, double us);
+    uint32_t random();
+
+private:
+    Stm32SimConfig_t cfg;
+    Stm32SimStatistics_t stats;
+    std::shared_ptr<spdlog::logger> logger;
+    uint32_t frequency_hz;
+    uint32_t rng;
+
+    std::vector<SimMemory_t> memories;
+    std::vector<uint8_t> dw_programmed;
+    std::vector<uint8_t> wp_pages;
+    bool rdp_active;
+
+    SimState_t state;
+    uint8_t command;
+    int cmd_index;
+    int stage;
+
+    std::vector<uint8_t> rx_buffer;
+    uint32_t rx_length;
+    uint32_t rx_expected;
+
+    std::vector<uint8_t> tx_queue;
+    uint32_t tx_index;
+    bool tx_then_ack;
+
+    uint8_t ack_byte;
+    bool ack_primed;
+    bool ack_polled_busy;
+    std::chrono::steady_clock::time_point ack_ready;
+    bool reset_after_echo;
+
+    uint32_t addr;
+    uint32_t number;                    // N of the current command: erase pages - 1, write protect sectors - 1, read size - 1, checksum words
+    uint32_t checksum_poly;
+    uint32_t checksum;
+    bool write_pending;
+    uint32_t write_addr;
+    uint32_t write_length;
+    uint8_t write_data[SIM_MAX_FRAME_SIZE_B];
+};
+
+#endif
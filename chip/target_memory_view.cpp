@@ -0,0 +1,172 @@
+#include <cassert>
+#include <algorithm>
+
+#include "target_memory_view.hpp"
+
+
+TargetMemoryView::TargetMemoryView(Programer* target)
+{
+    assert(target);
+    this->target = target;
+}
+
+
+TargetMemoryView::~TargetMemoryView()
+{
+    if (DebuggerExecutingNormal != this->flush()){
+        this->target->logger->error("Memory view flush fail, {:d} Bytes not written.", this->pending_bytes());
+    }
+}
+
+
+uint32_t TargetMemoryView::pending_bytes()
+{
+    uint32_t count = 0;
+    for (auto& run: this->pending){
+        count += run.second.size();
+    }
+    return count;
+}
+
+
+DebuggerExecutingState_t TargetMemoryView::write(uint32_t addr, const uint8_t* data, uint32_t size)
+{
+    assert(data);
+
+    uint64_t start = addr;
+    uint64_t end = (uint64_t)addr + size;
+    if (0 == size){
+        return DebuggerExecutingNormal;
+    }
+    if (end > (1ULL << 32)){
+        this->target->logger->error("param error addr 0x{:08x} size {:d}, line {:d}.", addr, size, __LINE__);
+        return DebuggerExecutingParamFault;
+    }
+
+    // merge every run overlapping or touching [start, end), then the new bytes over them
+    auto it = this->pending.upper_bound(start);
+    if ((it != this->pending.begin()) && (std::prev(it)->first + std::prev(it)->second.size() >= start)){
+        --it;
+    }
+    auto first = it;
+    uint64_t merged_start = start;
+    uint64_t merged_end = end;
+    for (; (it != this->pending.end()) && (it->first <= end); ++it)
+    {
+        merged_start = std::min(merged_start, it->first);
+        merged_end = std::max<uint64_t>(merged_end, it->first + it->second.size());
+    }
+    std::vector<uint8_t> merged(merged_end - merged_start);
+    for (auto run = first; run != it; ++run){
+        std::copy(run->second.begin(), run->second.end(), merged.begin() + (run->first - merged_start));
+    }
+    std::copy(data, data + size, merged.begin() + (start - merged_start));
+    this->pending.erase(first, it);
+    this->pending[merged_start] = std::move(merged);
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t TargetMemoryView::read(uint32_t addr, uint8_t* data, uint32_t size)
+{
+    assert(data);
+
+    DebuggerExecutingState_t stat;
+    uint64_t start = addr;
+    uint64_t end = (uint64_t)addr + size;
+
+    // no target read when one run holds the whole range
+    auto it = this->pending.upper_bound(start);
+    if (it != this->pending.begin()){
+        --it;
+    }
+    if ((it == this->pending.end()) || (it->first > start) || (it->first + it->second.size() < end)){
+        stat = this->target->read(addr, data, size);
+        if (DebuggerExecutingNormal != stat){
+            return stat;
+        }
+    }
+    for (; (it != this->pending.end()) && (it->first < end); ++it)
+    {
+        uint64_t run_start = std::max(start, it->first);
+        uint64_t run_end = std::min<uint64_t>(end, it->first + it->second.size());
+        if (run_start < run_end){
+            std::copy(it->second.begin() + (run_start - it->first), it->second.begin() + (run_end - it->first), data + (run_start - start));
+        }
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t TargetMemoryView::flush()
+{
+    DebuggerExecutingState_t stat;
+
+    while (! this->pending.empty())
+    {
+        uint64_t first = this->pending.begin()->first;
+        stat = this->flush_window(first - first % TARGET_VIEW_FRAME_B);
+        if (DebuggerExecutingNormal != stat){
+            return stat;
+        }
+    }
+    return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t TargetMemoryView::flush_window(uint64_t window)
+{
+    // one frame over the first pending bytes of [window, window + 256), they leave the pending runs once written
+    DebuggerExecutingState_t stat;
+    uint64_t window_end = window + TARGET_VIEW_FRAME_B;
+    uint32_t unit = this->target->write_once_unit(window);
+    uint32_t align = unit? unit: TARGET_VIEW_ALIGN_B;
+
+    uint64_t first = this->pending.begin()->first;
+    uint64_t last = first;
+    uint32_t covered = 0;
+    auto it = this->pending.begin();
+    for (; (it != this->pending.end()) && (it->first < window_end); ++it)
+    {
+        // a whole unit between two runs of a write-once memory ends the frame
+        if (unit && (it != this->pending.begin()) && (it->first / unit > (last + unit - 1) / unit)){
+            break;
+        }
+        uint64_t run_end = std::min<uint64_t>(window_end, it->first + it->second.size());
+        covered += run_end - it->first;
+        last = run_end;
+    }
+    uint64_t start = first - first % align;
+    uint64_t end = std::min(window_end, (last + align - 1) / align * align);
+    uint32_t size = end - start;
+
+    if (covered < size){
+        stat = this->target->read(start, this->frame, size);
+        if (DebuggerExecutingNormal != stat){
+            this->target->logger->error("Memory view read addr 0x{:08x} size {:d} fail, line {:d}.", (uint32_t)start, size, __LINE__);
+            return stat;
+        }
+    }
+    for (auto run = this->pending.begin(); run != it; ++run)
+    {
+        uint64_t run_end = std::min<uint64_t>(window_end, run->first + run->second.size());
+        std::copy(run->second.begin(), run->second.begin() + (run_end - run->first), this->frame + (run->first - start));
+    }
+    stat = this->target->write(start, this->frame, size);
+    if (DebuggerExecutingNormal != stat){
+        this->target->logger->error("Memory view write addr 0x{:08x} size {:d} fail, line {:d}.", (uint32_t)start, size, __LINE__);
+        return stat;
+    }
+
+    // a run going on after the window keeps its bytes from window_end on
+    std::vector<uint8_t> rest;
+    auto last_run = std::prev(it);
+    if (last_run->first + last_run->second.size() > window_end){
+        rest.assign(last_run->second.begin() + (window_end - last_run->first), last_run->second.end());
+    }
+    this->pending.erase(this->pending.begin(), it);
+    if (! rest.empty()){
+        this->pending[window_end] = std::move(rest);
+    }
+    return DebuggerExecutingNormal;
+}
@@ -0,0 +1,43 @@
+#ifndef __TARGET_MEMORY_VIEW_HPP__
+#define __TARGET_MEMORY_VIEW_HPP__
+
+#include <map>
+#include <vector>
+#include "programer.hpp"
+
+
+#define TARGET_VIEW_FRAME_B     256     // one Write Memory frame per 256 Bytes aligned window
+#define TARGET_VIEW_ALIGN_B     8       // frames start and end on 8 Bytes, on the program unit of a write-once memory
+
+
+/*
+    Write-combining view of the target memory, for scripts patching many small fields.
+    write() only records the bytes: overlapping and adjacent writes merge, the later one wins.
+    flush() sends one frame per aligned 256 Bytes window holding pending bytes, from the first to the last one;
+    the bytes between two writes of a window are read from the target once and written back unchanged.
+    On flash (Programer::write_once_unit) a frame only spans touching program units holding pending bytes:
+    a unit between two writes is left alone, it may be erased or programmed already, both forbid a second
+    programming, and the window takes one frame per group of touching units.
+    read() returns the target memory with the pending bytes applied. The destructor flushes.
+*/
+class TargetMemoryView
+{
+public:
+    TargetMemoryView(Programer* target);
+    ~TargetMemoryView();
+
+    DebuggerExecutingState_t write(uint32_t addr, const uint8_t* data, uint32_t size);
+    DebuggerExecutingState_t read(uint32_t addr, uint8_t* data, uint32_t size);
+    DebuggerExecutingState_t flush();
+    uint32_t pending_bytes();
+
+private:
+    DebuggerExecutingState_t flush_window(uint64_t window);
+
+private:
+    Programer* target;
+    std::map<uint64_t, std::vector<uint8_t>> pending;   // start -> bytes, neither overlapping nor adjacent
+    uint8_t frame[TARGET_VIEW_FRAME_B];
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Crc32.c
+ *
+ *  Slice-by-16: 4 words per step, one lookup per byte in 16 tables. anCrcTable[k][b] is the CRC
+ *  of byte b followed by k zero bytes, so the 16 lookups of a step are independent of each other.
+ *  The words are loaded byte by byte: the result does not depend on the alignment or the host byte order.
+ *
+ *  x86-64 hosts with PCLMULQDQ (checked at run time) fold 16 Bytes per carry-less multiply pair:
+ *  X * x^128 = Xhi * (x^192 mod P) + Xlo * (x^128 mod P), the last 128 bits go through the tables.
+ *  The arm release build is 32-bit ARMv7 without PMULL, it keeps slice-by-16.
+ *
+ *  The tables, the fold constants and the PCLMULQDQ check are built once per process by pthread_once:
+ *  programers on several threads may run their first checksum at the same time.
+ */
+
+
+#include "Crc32.h"
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define CRC32_CLMUL
+#define CRC32_CLMUL_MIN_B	64
+#endif
+
+#define CRC32_SLICES		16
+
+static uint32_t anCrcTable[CRC32_SLICES][256];
+static pthread_once_t tCrcInitOnce = PTHREAD_ONCE_INIT;
+#ifdef CRC32_CLMUL
+static int bClmul = 0;
+static uint64_t nFoldHigh = 0;
+static uint64_t nFoldLow = 0;
+#endif
+
+static void SeCrc32InitTable(void)
+{
+	for (uint32_t i = 0; i < 256; ++i)
+	{
+		uint32_t nCrc = i << 24;
+		for (int nBit = 0; nBit < 8; ++nBit)
+		{
+			nCrc = (nCrc & 0x80000000U)? (nCrc << 1) ^ SE_CRC32_STM32_POLY: (nCrc << 1);
+		}
+		anCrcTable[0][i] = nCrc;
+	}
+	for (int k = 1; k < CRC32_SLICES; ++k)
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t nCrc = anCrcTable[k - 1][i];
+			anCrcTable[k][i] = (nCrc << 8) ^ anCrcTable[0][nCrc >> 24];
+		}
+	}
+}
+
+static uint32_t SeLoadWord(const uint8_t *pData)
+{
+	return (uint32_t)pData[0] | ((uint32_t)pData[1] << 8) | ((uint32_t)pData[2] << 16) | ((uint32_t)pData[3] << 24);
+}
+
+static uint32_t SeCrc32Slice16(uint32_t nCrc, const uint8_t *pData, uint32_t nLength)
+{
+	uint32_t i = 0;
+
+	for (; i + CRC32_SLICES <= nLength; i += CRC32_SLICES)
+	{
+		uint32_t nWord0 = nCrc ^ SeLoadWord(pData + i);
+		uint32_t nWord1 = SeLoadWord(pData + i + 4);
+		uint32_t nWord2 = SeLoadWord(pData + i + 8);
+		uint32_t nWord3 = SeLoadWord(pData + i + 12);
+
+		nCrc = anCrcTable[15][nWord0 >> 24] ^ anCrcTable[14][(nWord0 >> 16) & 0xff]
+			 ^ anCrcTable[13][(nWord0 >> 8) & 0xff] ^ anCrcTable[12][nWord0 & 0xff]
+			 ^ anCrcTable[11][nWord1 >> 24] ^ anCrcTable[10][(nWord1 >> 16) & 0xff]
+			 ^ anCrcTable[9][(nWord1 >> 8) & 0xff] ^ anCrcTable[8][nWord1 & 0xff]
+			 ^ anCrcTable[7][nWord2 >> 24] ^ anCrcTable[6][(nWord2 >> 16) & 0xff]
+			 ^ anCrcTable[5][(nWord2 >> 8) & 0xff] ^ anCrcTable[4][nWord2 & 0xff]
+			 ^ anCrcTable[3][nWord3 >> 24] ^ anCrcTable[2][(nWord3 >> 16) & 0xff]
+			 ^ anCrcTable[1][(nWord3 >> 8) & 0xff] ^ anCrcTable[0][nWord3 & 0xff];
+	}
+	for (; i + 4 <= nLength; i += 4)
+	{
+		uint32_t nWord = nCrc ^ SeLoadWord(pData + i);
+		nCrc = anCrcTable[3][nWord >> 24] ^ anCrcTable[2][(nWord >> 16) & 0xff]
+			 ^ anCrcTable[1][(nWord >> 8) & 0xff] ^ anCrcTable[0][nWord & 0xff];
+	}
+	return nCrc;
+}
+
+#ifdef CRC32_CLMUL
+static uint64_t SeCrc32XPowMod(uint32_t nPower)
+{
+	uint32_t nRem = 1;
+
+	for (uint32_t i = 0; i < nPower; ++i)
+	{
+		nRem = (nRem & 0x80000000U)? (nRem << 1) ^ SE_CRC32_STM32_POLY: (nRem << 1);
+	}
+	return nRem;
+}
+
+/*
+ * nLength multiple of 16 and >= 32. The 4 little-endian words of a block in reverse order
+ * are the block as one 128-bit number, its MSB is the first bit into the CRC unit.
+ */
+__attribute__((target("pclmul")))
+static uint32_t SeCrc32Clmul(uint32_t nCrc, const uint8_t *pData, uint32_t nLength)
+{
+	uint8_t anLast[16];
+
+	__m128i tFold = _mm_set_epi64x((long long)nFoldHigh, (long long)nFoldLow);
+	__m128i tAcc = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)pData), 0x1B);
+	tAcc = _mm_xor_si128(tAcc, _mm_set_epi32((int)nCrc, 0, 0, 0));
+	for (uint32_t i = 16; i < nLength; i += 16)
+	{
+		__m128i tData = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(pData + i)), 0x1B);
+		tAcc = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(tAcc, tFold, 0x11), _mm_clmulepi64_si128(tAcc, tFold, 0x00)), tData);
+	}
+	// the remainder of the last 128 bits, CRC with init 0 multiplies it by x^32 mod P
+	_mm_storeu_si128((__m128i *)anLast, _mm_shuffle_epi32(tAcc, 0x1B));
+	return SeCrc32Slice16(0, anLast, sizeof(anLast));
+}
+#endif
+
+static void SeCrc32Init(void)
+{
+	SeCrc32InitTable();
+#ifdef CRC32_CLMUL
+	__builtin_cpu_init();
+	bClmul = __builtin_cpu_supports("pclmul")? 1: 0;
+	nFoldLow = SeCrc32XPowMod(128);
+	nFoldHigh = SeCrc32XPowMod(192);
+#endif
+}
+
+uint32_t SeCrc32Stm32(uint32_t nCrc, const uint8_t *pData, uint32_t nLength)
+{
+	pthread_once(&tCrcInitOnce, SeCrc32Init);
+#ifdef CRC32_CLMUL
+	if (bClmul && (nLength >= CRC32_CLMUL_MIN_B)){
+		uint32_t nBlocks = nLength & ~15U;
+		nCrc = SeCrc32Clmul(nCrc, pData, nBlocks);
+		pData += nBlocks;
+		nLength -= nBlocks;
+	}
+#endif
+	return SeCrc32Slice16(nCrc, pData, nLength);
+}
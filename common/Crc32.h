@@ -0,0 +1,28 @@
+/* Crc32.h
+ *
+ *  CRC-32 of the STM32 CRC unit in its reset configuration: polynomial 0x04C11DB7,
+ *  init 0xFFFFFFFF, 32-bit input words MSB first, no reflection, no final XOR.
+ */
+
+#ifndef _CRC32_H_
+#define _CRC32_H_
+#include <stdint.h>
+
+#define SE_CRC32_STM32_POLY		0x04C11DB7U
+#define SE_CRC32_STM32_INIT		0xFFFFFFFFU
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * nCrc updated with the 32-bit little-endian words of pData, as the CPU of the target reads them from memory.
+ * Start with SE_CRC32_STM32_INIT, nLength is a multiple of 4: trailing bytes are ignored.
+ */
+uint32_t SeCrc32Stm32(uint32_t nCrc, const uint8_t *pData, uint32_t nLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CRC32_H_ */
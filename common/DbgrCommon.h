@@ -9,6 +9,9 @@
 #include <stdint.h>
 #include "spdlog/spdlog.h"
 #include "Delay.h"
+#include "MemScan.h"
+#include "MemXor.h"
+#include "Crc32.h"
 
 
 //------------------------------------spi mode------------------------------
@@ -26,6 +29,11 @@ typedef enum{
 #define DbgrDelayUs(nUs)									SeDelayUs(nUs)//while(0){}
 #define DbgrDelayMs(nMs)									SeDelayMs(nMs)//while(0){}
 #define DbgrDelayNs(nNs)									SeDelayNs(nNs)//while(0){}
+#define DbgrMemFindNotFill(pData, nLength, nFill)			SeMemFindNotFill(pData, nLength, nFill)
+#define DbgrMemIsFill(pData, nLength, nFill)				SeMemIsFill(pData, nLength, nFill)
+#define DbgrMemXor(pData, nLength)							SeMemXor(pData, nLength)
+#define DbgrMemCopyXor(pDst, pSrc, nLength)					SeMemCopyXor(pDst, pSrc, nLength)
+#define DbgrCrc32Stm32(nCrc, pData, nLength)				SeCrc32Stm32(nCrc, pData, nLength)
 
 typedef enum{
 	DebuggerExecutingNormal = 1,											//executing normal not error
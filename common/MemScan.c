@@ -0,0 +1,39 @@
+/*
+ * MemScan.c
+ *
+ *  32 Bytes per step as 4 64-bit words: no alignment requirement and the compiler
+ *  turns the OR of the XORs into SIMD (SSE2/NEON) where the target has it.
+ */
+
+
+#include "MemScan.h"
+#include <string.h>
+
+#define MEMSCAN_STEP_B      32
+
+uint32_t SeMemFindNotFill(const uint8_t *pData, uint32_t nLength, uint8_t nFill)
+{
+	uint64_t nPattern = 0x0101010101010101ULL * nFill;
+	uint64_t anWords[MEMSCAN_STEP_B / 8];
+	uint32_t i = 0;
+
+	for (; i + MEMSCAN_STEP_B <= nLength; i += MEMSCAN_STEP_B)
+	{
+		memcpy(anWords, pData + i, MEMSCAN_STEP_B);
+		if ((anWords[0] ^ nPattern) | (anWords[1] ^ nPattern) | (anWords[2] ^ nPattern) | (anWords[3] ^ nPattern)){
+			break;
+		}
+	}
+	for (; i < nLength; ++i)
+	{
+		if (pData[i] != nFill){
+			return i;
+		}
+	}
+	return nLength;
+}
+
+int SeMemIsFill(const uint8_t *pData, uint32_t nLength, uint8_t nFill)
+{
+	return SeMemFindNotFill(pData, nLength, nFill) == nLength;
+}
@@ -0,0 +1,28 @@
+/* MemScan.h
+ *
+ *  Scan of firmware buffers, a word at a time.
+ */
+
+#ifndef _MEMSCAN_H_
+#define _MEMSCAN_H_
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * index of the first byte different from nFill, nLength when every byte is nFill
+ */
+uint32_t SeMemFindNotFill(const uint8_t *pData, uint32_t nLength, uint8_t nFill);
+
+/*
+ * 1 when every byte is nFill
+ */
+int SeMemIsFill(const uint8_t *pData, uint32_t nLength, uint8_t nFill);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MEMSCAN_H_ */
@@ -0,0 +1,114 @@
+/*
+ * MemXor.c
+ *
+ *  XOR reduction of 32 Bytes (AVX2) or 16 Bytes (SSE2/NEON) per step, unaligned loads and stores.
+ *  AVX2 needs -mavx2 (or -march=native), SSE2 is part of x86-64, NEON comes with -mfpu=neon
+ *  of the arm release build. Other targets fold 64-bit words.
+ */
+
+
+#include "MemXor.h"
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+
+static uint8_t SeFoldWord(uint64_t nWord)
+{
+	nWord ^= nWord >> 32;
+	nWord ^= nWord >> 16;
+	nWord ^= nWord >> 8;
+	return (uint8_t)nWord;
+}
+
+/*
+ * bytes of pSrc from *pIndex on, 16 or 32 at a time, copied to pDst when it is not NULL.
+ * *pIndex ends at the first byte of the tail.
+ */
+static uint8_t SeXorBlocks(uint8_t *pDst, const uint8_t *pSrc, uint32_t nLength, uint32_t *pIndex)
+{
+	uint32_t i = 0;
+	uint64_t anWords[2];
+
+#if defined(__AVX2__)
+	__m256i tAcc256 = _mm256_setzero_si256();
+	for (; i + 32 <= nLength; i += 32)
+	{
+		__m256i tData = _mm256_loadu_si256((const __m256i *)(pSrc + i));
+		if (pDst){
+			_mm256_storeu_si256((__m256i *)(pDst + i), tData);
+		}
+		tAcc256 = _mm256_xor_si256(tAcc256, tData);
+	}
+	__m128i tAcc = _mm_xor_si128(_mm256_castsi256_si128(tAcc256), _mm256_extracti128_si256(tAcc256, 1));
+#elif defined(__SSE2__)
+	__m128i tAcc = _mm_setzero_si128();
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+	for (; i + 16 <= nLength; i += 16)
+	{
+		__m128i tData = _mm_loadu_si128((const __m128i *)(pSrc + i));
+		if (pDst){
+			_mm_storeu_si128((__m128i *)(pDst + i), tData);
+		}
+		tAcc = _mm_xor_si128(tAcc, tData);
+	}
+	_mm_storeu_si128((__m128i *)anWords, tAcc);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	uint8x16_t tAcc = vdupq_n_u8(0);
+	for (; i + 16 <= nLength; i += 16)
+	{
+		uint8x16_t tData = vld1q_u8(pSrc + i);
+		if (pDst){
+			vst1q_u8(pDst + i, tData);
+		}
+		tAcc = veorq_u8(tAcc, tData);
+	}
+	vst1q_u8((uint8_t *)anWords, tAcc);
+#else
+	uint64_t anData[2];
+	anWords[0] = 0;
+	anWords[1] = 0;
+	for (; i + 16 <= nLength; i += 16)
+	{
+		memcpy(anData, pSrc + i, 16);
+		if (pDst){
+			memcpy(pDst + i, anData, 16);
+		}
+		anWords[0] ^= anData[0];
+		anWords[1] ^= anData[1];
+	}
+#endif
+	*pIndex = i;
+	return SeFoldWord(anWords[0] ^ anWords[1]);
+}
+
+uint8_t SeMemXor(const uint8_t *pData, uint32_t nLength)
+{
+	uint32_t i = 0;
+	uint8_t nXor = SeXorBlocks(NULL, pData, nLength, &i);
+
+	for (; i < nLength; ++i)
+	{
+		nXor ^= pData[i];
+	}
+	return nXor;
+}
+
+uint8_t SeMemCopyXor(uint8_t *pDst, const uint8_t *pSrc, uint32_t nLength)
+{
+	uint32_t i = 0;
+	uint8_t nXor = SeXorBlocks(pDst, pSrc, nLength, &i);
+
+	for (; i < nLength; ++i)
+	{
+		pDst[i] = pSrc[i];
+		nXor ^= pSrc[i];
+	}
+	return nXor;
+}
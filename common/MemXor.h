@@ -0,0 +1,28 @@
+/* MemXor.h
+ *
+ *  XOR checksum of bootloader frames, fused with the copy of the payload.
+ */
+
+#ifndef _MEMXOR_H_
+#define _MEMXOR_H_
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * XOR of the nLength bytes of pData
+ */
+uint8_t SeMemXor(const uint8_t *pData, uint32_t nLength);
+
+/*
+ * copy nLength bytes from pSrc to pDst (no overlap) and return their XOR, in one pass
+ */
+uint8_t SeMemCopyXor(uint8_t *pDst, const uint8_t *pSrc, uint32_t nLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MEMXOR_H_ */
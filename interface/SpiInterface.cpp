@@ -1,20 +1,58 @@
-
 #include "SpiInterface.h"
 #include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
 
 
 SpiInterface::SpiInterface(char *pName, std::shared_ptr<spdlog::logger> logger)
 {
 	this->logger = logger;
 	this->logger->debug("SpiInterface create with dev name {}", pName);
+	this->tDevName = pName ? pName : "";
+	this->nFd = -1;
+	this->nFreqencyHz = 0;
+
+	// open the device once, all the transfers reuse this file descriptor
+	this->ModuleEnable();
 }
 
-SpiInterface::~SpiInterface(){}
+SpiInterface::~SpiInterface()
+{
+	this->ModuleDisable();
+}
 
 
 DebuggerExecutingState_t SpiInterface::SetFrequency(uint32_t nFreqencyHz)
 {
 	this->logger->debug("SPI SetFrequency={:d}", nFreqencyHz);
+	if (this->nFd < 0){
+		this->logger->error("SPI {} not open, line {:d}.", this->tDevName, __LINE__);
+		return DebuggerExecutingDriverFault;
+	}
+	if (ioctl(this->nFd, SPI_IOC_WR_MAX_SPEED_HZ, &nFreqencyHz) < 0){
+		this->logger->error("SPI {} set frequency {:d} fail: {}, line {:d}.", this->tDevName, nFreqencyHz, strerror(errno), __LINE__);
+		return DebuggerExecutingDriverFault;
+	}
+	this->nFreqencyHz = nFreqencyHz;
+	return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t SpiInterface::ReadFrequency(uint32_t &qFreqencyHz)
+{
+	if (this->nFd < 0){
+		this->logger->error("SPI {} not open, line {:d}.", this->tDevName, __LINE__);
+		return DebuggerExecutingDriverFault;
+	}
+	if (ioctl(this->nFd, SPI_IOC_RD_MAX_SPEED_HZ, &qFreqencyHz) < 0){
+		this->logger->error("SPI {} read frequency fail: {}, line {:d}.", this->tDevName, strerror(errno), __LINE__);
+		return DebuggerExecutingDriverFault;
+	}
+	this->logger->debug("SPI ReadFrequency={:d}", qFreqencyHz);
 	return DebuggerExecutingNormal;
 }
 
@@ -22,18 +60,165 @@ DebuggerExecutingState_t SpiInterface::SetFrequency(uint32_t nFreqencyHz)
 DebuggerExecutingState_t SpiInterface::SwitchSpiMode(SpiCpolnCphaMode_t tSpiModeMask)
 {
 	this->logger->debug("SPI SwitchSpiMode to {:d}", int(tSpiModeMask));
+
+	uint8_t nMode = 0;
+	switch (tSpiModeMask){
+		case SpiCpol0nCpha0Mode:
+			nMode = SPI_MODE_0;
+			break;
+		case SpiCpol0nCpha1Mode:
+			nMode = SPI_MODE_1;
+			break;
+		case SpiCpol1nCpha0Mode:
+			nMode = SPI_MODE_2;
+			break;
+		case SpiCpol1nCpha1Mode:
+			nMode = SPI_MODE_3;
+			break;
+		default:
+			this->logger->error("SPI mode {:d} not support, line {:d}.", int(tSpiModeMask), __LINE__);
+			return DebuggerExecutingParamFault;
+	}
+
+	if (this->nFd < 0){
+		this->logger->error("SPI {} not open, line {:d}.", this->tDevName, __LINE__);
+		return DebuggerExecutingDriverFault;
+	}
+	if (ioctl(this->nFd, SPI_IOC_WR_MODE, &nMode) < 0){
+		this->logger->error("SPI {} set mode {:d} fail: {}, line {:d}.", this->tDevName, int(nMode), strerror(errno), __LINE__);
+		return DebuggerExecutingDriverFault;
+	}
 	return DebuggerExecutingNormal;
 }
 
 
 DebuggerExecutingState_t SpiInterface::sTransmit(uint8_t anWriteList[],uint8_t anReadList[],uint32_t nTransmitLength)
 {
-	this->logger->debug("SPI transmit data");
-	this->logger->debug("SPI CS=1");
-	this->logger->debug("SPI CS=0");
-	this->logger->debug("SPI write and read.");
-	this->logger->debug("SPI CS=1");
+	if (0 == nTransmitLength){
+		return DebuggerExecutingNormal;
+	}
+	if (this->nFd < 0){
+		this->logger->error("SPI {} not open, line {:d}.", this->tDevName, __LINE__);
+		return DebuggerExecutingDriverFault;
+	}
+
+	// one transfer is one CS frame: CS=0, write and read, CS=1
+	struct spi_ioc_transfer tTransfer;
+	std::memset(&tTransfer, 0, sizeof(tTransfer));
+	tTransfer.tx_buf = (unsigned long)anWriteList;
+	tTransfer.rx_buf = (unsigned long)anReadList;
+	tTransfer.len = nTransmitLength;
+	tTransfer.speed_hz = this->nFreqencyHz;
+	tTransfer.bits_per_word = SPI_BITS_PER_WORD;
+
+	if (ioctl(this->nFd, SPI_IOC_MESSAGE(1), &tTransfer) < 0){
+		this->logger->error("SPI {} transmit {:d} Bytes fail: {}, line {:d}.", this->tDevName, nTransmitLength, strerror(errno), __LINE__);
+		return DebuggerExecutingDriverFault;
+	}
+	return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t SpiInterface::sTransmitBatch(SpiTransfer_t atTransferList[], uint32_t nTransferCount)
+{
+	/*
+	Issue several transfers with one SPI_IOC_MESSAGE(n) ioctl, every transfer keeps its own CS frame.
+	Note: the spidev driver limits the total length of one message to its bufsiz module parameter (default 4096 Bytes).
+	*/
+	if (0 == nTransferCount){
+		return DebuggerExecutingNormal;
+	}
+	if (! atTransferList){
+		this->logger->error("SPI transfer list is NULL, line {:d}.", __LINE__);
+		return DebuggerExecutingNullPointerParamFault;
+	}
+	if (this->nFd < 0){
+		this->logger->error("SPI {} not open, line {:d}.", this->tDevName, __LINE__);
+		return DebuggerExecutingDriverFault;
+	}
 
+	struct spi_ioc_transfer atTransfer[SPI_MAX_BATCH_TRANSFERS];
+	uint32_t nFinishCount = 0;
+	while (nFinishCount < nTransferCount)
+	{
+		uint32_t nCount = (nTransferCount - nFinishCount < SPI_MAX_BATCH_TRANSFERS)? (nTransferCount - nFinishCount): SPI_MAX_BATCH_TRANSFERS;
+		std::memset(atTransfer, 0, sizeof(atTransfer[0]) * nCount);
+		for (uint32_t i=0; i<nCount; ++i)
+		{
+			SpiTransfer_t* pTransfer = &atTransferList[nFinishCount + i];
+			atTransfer[i].tx_buf = (unsigned long)pTransfer->pWriteList;
+			atTransfer[i].rx_buf = (unsigned long)pTransfer->pReadList;
+			atTransfer[i].len = pTransfer->nTransmitLength;
+			atTransfer[i].speed_hz = this->nFreqencyHz;
+			atTransfer[i].bits_per_word = SPI_BITS_PER_WORD;
+			atTransfer[i].cs_change = (i + 1 < nCount)? 1: 0;  // release CS between transfers, the last one ends the message
+		}
+		if (ioctl(this->nFd, SPI_IOC_MESSAGE(nCount), atTransfer) < 0){
+			this->logger->error("SPI {} transmit batch of {:d} fail: {}, line {:d}.", this->tDevName, nCount, strerror(errno), __LINE__);
+			return DebuggerExecutingDriverFault;
+		}
+		nFinishCount += nCount;
+	}
+	return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t SpiInterface::sTransmitv(SpiSegment_t atSegmentList[], uint32_t nSegmentCount)
+{
+	/*
+	Segments are chained in SPI_IOC_MESSAGE(n) ioctls: cs_change releases CS between two segments unless bCsHold,
+	cs_change on the last transfer of a message keeps CS asserted into the next message.
+	A delay above SPI_MAX_TRANSFER_DELAY_US ends the message and is slept on the host.
+	*/
+	if (0 == nSegmentCount){
+		return DebuggerExecutingNormal;
+	}
+	if (! atSegmentList){
+		this->logger->error("SPI segment list is NULL, line {:d}.", __LINE__);
+		return DebuggerExecutingNullPointerParamFault;
+	}
+	if (this->nFd < 0){
+		this->logger->error("SPI {} not open, line {:d}.", this->tDevName, __LINE__);
+		return DebuggerExecutingDriverFault;
+	}
+
+	struct spi_ioc_transfer atTransfer[SPI_MAX_BATCH_TRANSFERS];
+	uint32_t nFinishCount = 0;
+	while (nFinishCount < nSegmentCount)
+	{
+		uint32_t nCount = 0;
+		uint32_t nHostDelayUs = 0;
+		std::memset(atTransfer, 0, sizeof(atTransfer));
+		while ((nFinishCount + nCount < nSegmentCount) && (nCount < SPI_MAX_BATCH_TRANSFERS))
+		{
+			SpiSegment_t* pSegment = &atSegmentList[nFinishCount + nCount];
+			struct spi_ioc_transfer* pTransfer = &atTransfer[nCount++];
+			pTransfer->tx_buf = (unsigned long)pSegment->pWriteList;
+			pTransfer->rx_buf = (unsigned long)pSegment->pReadList;
+			pTransfer->len = pSegment->nTransmitLength;
+			pTransfer->speed_hz = this->nFreqencyHz;
+			pTransfer->bits_per_word = SPI_BITS_PER_WORD;
+			if (pSegment->nDelayUs > SPI_MAX_TRANSFER_DELAY_US){
+				nHostDelayUs = pSegment->nDelayUs;
+				break;
+			}
+			pTransfer->delay_usecs = pSegment->nDelayUs;
+		}
+		bool bMoreSegments = (nFinishCount + nCount < nSegmentCount);
+		for (uint32_t i=0; i+1<nCount; ++i){
+			atTransfer[i].cs_change = atSegmentList[nFinishCount + i].bCsHold ? 0: 1;
+		}
+		atTransfer[nCount - 1].cs_change = (atSegmentList[nFinishCount + nCount - 1].bCsHold && bMoreSegments)? 1: 0;
+
+		if (ioctl(this->nFd, SPI_IOC_MESSAGE(nCount), atTransfer) < 0){
+			this->logger->error("SPI {} transmit {:d} segments fail: {}, line {:d}.", this->tDevName, nCount, strerror(errno), __LINE__);
+			return DebuggerExecutingDriverFault;
+		}
+		if (nHostDelayUs > 0){
+			DbgrDelayUs(nHostDelayUs);
+		}
+		nFinishCount += nCount;
+	}
 	return DebuggerExecutingNormal;
 }
 
@@ -41,6 +226,19 @@ DebuggerExecutingState_t SpiInterface::sTransmit(uint8_t anWriteList[],uint8_t a
 DebuggerExecutingState_t SpiInterface::ModuleEnable(void)
 {
 	this->logger->debug("SPI module enable");
+	if (this->nFd >= 0){
+		return DebuggerExecutingNormal;
+	}
+	this->nFd = open(this->tDevName.c_str(), O_RDWR);
+	if (this->nFd < 0){
+		this->logger->error("SPI {} open fail: {}, line {:d}.", this->tDevName, strerror(errno), __LINE__);
+		return DebuggerExecutingDriverFault;
+	}
+
+	uint8_t nBits = SPI_BITS_PER_WORD;
+	if (ioctl(this->nFd, SPI_IOC_WR_BITS_PER_WORD, &nBits) < 0){
+		this->logger->warn("SPI {} set bits per word fail: {}, line {:d}.", this->tDevName, strerror(errno), __LINE__);
+	}
 	return DebuggerExecutingNormal;
 }
 
@@ -48,5 +246,9 @@ DebuggerExecutingState_t SpiInterface::ModuleEnable(void)
 DebuggerExecutingState_t SpiInterface::ModuleDisable(void)
 {
 	this->logger->debug("SPI module disable");
+	if (this->nFd >= 0){
+		close(this->nFd);
+		this->nFd = -1;
+	}
 	return DebuggerExecutingNormal;
 }
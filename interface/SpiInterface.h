@@ -2,25 +2,38 @@
 #define __SPIINTERFACE_H__
 
 //-------------------------------------------------------include---------------------------------------------------------
+#include <string>
 #include "DbgrCommon.h"
+#include "SpiTransport.h"
 //-------------------------------------------------------macro---------------------------------------------------------
+#define SPI_BITS_PER_WORD			8
+#define SPI_MAX_BATCH_TRANSFERS		64		// transfers per SPI_IOC_MESSAGE(n), the ioctl size field limits n to 511
+#define SPI_MAX_TRANSFER_DELAY_US	0xffff	// delay_usecs of spi_ioc_transfer is 16 bits
 
-class SpiInterface
+
+class SpiInterface final : public SpiTransport
 {
 public:
 	SpiInterface(char *pName,
 				 std::shared_ptr<spdlog::logger> logger=spdlog::default_logger());
-	~SpiInterface();
+	~SpiInterface() override;
 
-	DebuggerExecutingState_t SetFrequency(uint32_t nFreqencyHz);
-	DebuggerExecutingState_t ReadFrequency(uint32_t &qFreqencyHz);
-	DebuggerExecutingState_t SwitchSpiMode(SpiCpolnCphaMode_t tSpiModeMask);
-	DebuggerExecutingState_t sTransmit(uint8_t anWriteList[],uint8_t anReadList[],uint32_t nTransmitLength);
-	DebuggerExecutingState_t ModuleEnable(void) ;
-	DebuggerExecutingState_t ModuleDisable(void);
+	DebuggerExecutingState_t SetFrequency(uint32_t nFreqencyHz) override;
+	DebuggerExecutingState_t ReadFrequency(uint32_t &qFreqencyHz) override;
+	DebuggerExecutingState_t SwitchSpiMode(SpiCpolnCphaMode_t tSpiModeMask) override;
+	DebuggerExecutingState_t sTransmit(uint8_t anWriteList[],uint8_t anReadList[],uint32_t nTransmitLength) override;
+	DebuggerExecutingState_t sTransmitBatch(SpiTransfer_t atTransferList[], uint32_t nTransferCount) override;
+	DebuggerExecutingState_t sTransmitv(SpiSegment_t atSegmentList[], uint32_t nSegmentCount) override;
+	DebuggerExecutingState_t ModuleEnable(void) override;
+	DebuggerExecutingState_t ModuleDisable(void) override;
 
 public:
 	std::shared_ptr<spdlog::logger> logger;
+
+private:
+	std::string tDevName;
+	int nFd;
+	uint32_t nFreqencyHz;
 };
 
 
@@ -30,3 +43,4 @@ public:
 
 
 #endif
+
@@ -0,0 +1,42 @@
+#include "SpiTransport.h"
+
+
+DebuggerExecutingState_t SpiTransport::sTransmitBatch(SpiTransfer_t atTransferList[], uint32_t nTransferCount)
+{
+	// backends without a native batch call send the transfers one by one
+	DebuggerExecutingState_t tStat = DebuggerExecutingNormal;
+
+	if ((nTransferCount > 0) && (! atTransferList)){
+		return DebuggerExecutingNullPointerParamFault;
+	}
+	for (uint32_t i=0; i<nTransferCount; ++i)
+	{
+		tStat = this->sTransmit(atTransferList[i].pWriteList, atTransferList[i].pReadList, atTransferList[i].nTransmitLength);
+		if (DebuggerExecutingNormal != tStat){
+			return tStat;
+		}
+	}
+	return DebuggerExecutingNormal;
+}
+
+
+DebuggerExecutingState_t SpiTransport::sTransmitv(SpiSegment_t atSegmentList[], uint32_t nSegmentCount)
+{
+	// backends without a native vectored call: one transfer per segment, CS is released between the segments
+	DebuggerExecutingState_t tStat = DebuggerExecutingNormal;
+
+	if ((nSegmentCount > 0) && (! atSegmentList)){
+		return DebuggerExecutingNullPointerParamFault;
+	}
+	for (uint32_t i=0; i<nSegmentCount; ++i)
+	{
+		tStat = this->sTransmit(atSegmentList[i].pWriteList, atSegmentList[i].pReadList, atSegmentList[i].nTransmitLength);
+		if (DebuggerExecutingNormal != tStat){
+			return tStat;
+		}
+		if (atSegmentList[i].nDelayUs > 0){
+			DbgrDelayUs(atSegmentList[i].nDelayUs);
+		}
+	}
+	return DebuggerExecutingNormal;
+}
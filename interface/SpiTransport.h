@@ -0,0 +1,54 @@
+#ifndef __SPITRANSPORT_H__
+#define __SPITRANSPORT_H__
+
+//-------------------------------------------------------include---------------------------------------------------------
+#include "DbgrCommon.h"
+//-------------------------------------------------------macro---------------------------------------------------------
+
+
+/*
+ * one transfer of a batch, every transfer is a complete CS frame like one sTransmit call.
+ * pWriteList NULL shifts out zeroes, pReadList NULL drops the received data.
+ */
+typedef struct{
+	uint8_t *pWriteList;
+	uint8_t *pReadList;
+	uint32_t nTransmitLength;
+}SpiTransfer_t;
+
+
+/*
+ * one segment of a vectored transaction (sTransmitv).
+ * bCsHold keeps CS asserted into the next segment, else CS is released after this segment.
+ * nDelayUs is the delay after this segment, before the next one starts.
+ */
+typedef struct{
+	uint8_t *pWriteList;
+	uint8_t *pReadList;
+	uint32_t nTransmitLength;
+	bool bCsHold;
+	uint32_t nDelayUs;
+}SpiSegment_t;
+
+
+/*
+ * SPI bus seen by the chip protocol code: spidev, an in-process simulator, a record/replay backend...
+ * Mark the concrete backend final, so the protocol hot path instantiated on it calls without virtual dispatch.
+ */
+class SpiTransport
+{
+public:
+	virtual ~SpiTransport(){}
+
+	virtual DebuggerExecutingState_t SetFrequency(uint32_t nFreqencyHz) = 0;
+	virtual DebuggerExecutingState_t ReadFrequency(uint32_t &qFreqencyHz) = 0;
+	virtual DebuggerExecutingState_t SwitchSpiMode(SpiCpolnCphaMode_t tSpiModeMask) = 0;
+	virtual DebuggerExecutingState_t sTransmit(uint8_t anWriteList[],uint8_t anReadList[],uint32_t nTransmitLength) = 0;
+	virtual DebuggerExecutingState_t sTransmitBatch(SpiTransfer_t atTransferList[], uint32_t nTransferCount);
+	virtual DebuggerExecutingState_t sTransmitv(SpiSegment_t atSegmentList[], uint32_t nSegmentCount);
+	virtual DebuggerExecutingState_t ModuleEnable(void) = 0;
+	virtual DebuggerExecutingState_t ModuleDisable(void) = 0;
+};
+
+
+#endif
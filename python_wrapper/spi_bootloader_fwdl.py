@@ -13,12 +13,43 @@ class SPIBootLoaderFWDLDef:
     SPI_MODE = 0
     MAX_LOG_FILE_SIZE = 20 * 1024 * 1024
     MAX_LOG_FILES = 2
+    SIM_TIME_SCALE = 1.0
+    SIM_DW_DROP_PPM = 20000
+    SIM_SEED = 1
+    WAIT_WRITE_MEMORY = 0
+    WAIT_ERASE_PAGES = 1
+    WAIT_MASS_ERASE = 2
+    WAIT_PROTECTION = 3
+    WAIT_CHECKSUM = 4
+    WRITE_WA_AUTO = 0
+    WRITE_WA_NONE = 1
+    WRITE_WA_DELAY = 2
+    WRITE_WA_READBACK = 3
+    WRITE_WA_SECTOR_READBACK = 4
+    ERASE_POLICY_PAGES = 0
+    ERASE_POLICY_FASTEST = 1
+    VERIFY_READBACK = 0
+    VERIFY_CHECKSUM = 1
+    DUMP_RAW = 0
+    DUMP_SPARSE = 1
+    STATE_PARAM_FAULT = -30
+    ACK_LATENCY_COMMANDS = [('SYNC', 0x5A), ('GET_CMD', 0x00), ('GET_VER', 0x01), ('GET_ID', 0x02),
+                            ('RMEM', 0x11), ('GO', 0x21), ('WMEM', 0x31), ('EMEM', 0x44),
+                            ('WP', 0x63), ('WU', 0x73), ('RP', 0x82), ('RU', 0x92), ('GET_CHECKSUM', 0xA1)]
+    ACK_LATENCY_OUTCOMES = ['ack', 'nak', 'timeout']
 
 
 class SPIBootLoaderFWDLException(Exception):
     pass
 
 
+class MemoryRegion(ctypes.Structure):
+    '''
+    One range of read_v/write_v: MemoryRegion_t of libchip.
+    '''
+    _fields_ = [('addr', ctypes.c_uint32), ('size', ctypes.c_uint32), ('data', ctypes.POINTER(ctypes.c_ubyte))]
+
+
 class SPIBootLoaderFWDL(object):
     '''
     SPI BootLoader for FWDL.
@@ -39,25 +70,34 @@ class SPIBootLoaderFWDL(object):
                                                     |    3    |    1    |     1    |
                                                     +---------+---------+----------+
         libchip:        instance(string),           file path of libchip.so
+        simulator:      instance(bool),             drive the in-process STM32L452 bootloader simulator instead of spi_name
 
     Examples:
         spi_name = "/dev/AXI4_QSPI_2"
         sbl_fwdl = SPIBootLoaderFWDL(spi_name, frequency=8000000, mode=0, libchip="/root/lib/libchip.so")
 
+        # no hardware: regression test against the simulator
+        sbl_fwdl = SPIBootLoaderFWDL("", libchip="/root/lib/libchip.so", simulator=True)
+
     '''
-    rpc_public_api = ['init', 'mass_erase', 'program_only', 'verify', 'dump',
-                      'get_protocol_version', 'get_chip_id', 'read', 'write',
-                      'write_protect', 'write_unprotect', 'readout_protect', 'readout_unprotect'
+    rpc_public_api = ['init', 'mass_erase', 'erase_image', 'erase_images', 'program_only', 'program_diff', 'enable_journal',
+                      'verify', 'set_verify_mode', 'get_checksum', 'dump', 'set_dump_format', 'restore_sparse',
+                      'get_protocol_version', 'get_chip_id', 'read', 'write', 'read_v', 'write_v', 'write_combined', 'flush_writes',
+                      'write_protect', 'write_unprotect', 'readout_protect', 'readout_unprotect',
+                      'set_wait_model', 'set_write_workaround', 'get_write_workaround', 'set_erase_policy', 'get_erase_policy',
+                      'set_blank_skip', 'set_pipeline', 'set_dump_overlap', 'dump_timing', 'set_read_cache', 'read_cache_statistics', 'program_result', 'enable_ack_learning', 'save_ack_model', 'ack_estimate',
+                      'ack_latency', 'reset_ack_latency'
                       ]
 
     def __init__(self, spi_name, frequency=SPIBootLoaderFWDLDef.SPI_FREQUENCY, mode=SPIBootLoaderFWDLDef.SPI_MODE,
-                 libchip="/root/lib/libchip.so", log_file="/root/log/spi_bootloader.log"):
+                 libchip="/root/lib/libchip.so", log_file="/root/log/spi_bootloader.log", simulator=False):
         self.libchip = libchip
         self.clib = ctypes.cdll.LoadLibrary(libchip)
         self.spi_name = bytes(spi_name)
         self.frequency = frequency
         self.mode = mode
         self.log_file = bytes(log_file)
+        self.simulator = simulator
 
         self.open()
 
@@ -66,6 +106,16 @@ class SPIBootLoaderFWDL(object):
             self.close()
 
     def open(self):
+        self._view = None
+        if self.simulator:
+            self._stm32 = self.clib.new_STM32XXX_simulator(
+                ctypes.c_double(SPIBootLoaderFWDLDef.SIM_TIME_SCALE), ctypes.c_uint32(SPIBootLoaderFWDLDef.SIM_DW_DROP_PPM),
+                ctypes.c_uint32(SPIBootLoaderFWDLDef.SIM_SEED),
+                ctypes.c_char_p(self.log_file), ctypes.c_uint32(SPIBootLoaderFWDLDef.MAX_LOG_FILE_SIZE),
+                ctypes.c_uint32(SPIBootLoaderFWDLDef.MAX_LOG_FILES), ctypes.c_bool(False))
+            if self._stm32 == 0:
+                raise Exception("Open simulator failure.")
+            return
         self._stm32 = self.clib.new_STM32XXX(ctypes.c_char_p(
             self.spi_name), ctypes.c_uint32(self.frequency), ctypes.c_uint32(self.mode),
             ctypes.c_char_p(self.log_file), ctypes.c_uint32(SPIBootLoaderFWDLDef.MAX_LOG_FILE_SIZE),
@@ -74,6 +124,10 @@ class SPIBootLoaderFWDL(object):
             raise Exception("Open device failure.")
 
     def close(self):
+        if getattr(self, "_view", None):
+            # the view flushes its pending writes on deletion
+            self.clib.del_TargetMemoryView(self._view)
+            self._view = None
         if hasattr(self, "_stm32"):
             self.clib.del_STM32XXX(self._stm32)
 
@@ -86,6 +140,7 @@ class SPIBootLoaderFWDL(object):
         '''
         Initializes and enters communication mode.
         '''
+        self.flush_writes()
         state = self.clib.init(self._stm32)
         if (state == -8):
             raise SPIBootLoaderFWDLException(
@@ -103,6 +158,7 @@ class SPIBootLoaderFWDL(object):
             get_protocol_version()
 
         '''
+        self.flush_writes()
         version = ctypes.c_ubyte(0)
         state = self.clib.get_version_cmd(self._stm32, ctypes.byref(version))
         if state < 0:
@@ -118,6 +174,7 @@ class SPIBootLoaderFWDL(object):
             get_chip_id()
 
         '''
+        self.flush_writes()
         length = ctypes.c_ubyte(0)
         uid = (ctypes.c_ubyte * 10)()
         state = self.clib.get_id_cmd(self._stm32, uid, ctypes.byref(length))
@@ -134,10 +191,52 @@ class SPIBootLoaderFWDL(object):
             mass_erase()
 
         '''
+        self.flush_writes()
         state = self.clib.mass_erase(self._stm32)
         if state < 0:
             raise SPIBootLoaderFWDLException(self._get_state_message(state))
 
+    def erase_image(self, addr, size):
+        '''
+        Erase the flash pages touched by an image, erase time follows the image size instead of the flash size.
+
+        Args:
+            addr:   int,        image start addr
+            size:   int,        image size in bytes
+
+        Examples:
+            init()
+            erase_image(0x8000000, os.path.getsize(file))
+            program_only(file, md5, 0x8000000)
+
+        '''
+        self.flush_writes()
+        state = self.clib.erase_image(self._stm32, ctypes.c_uint32(addr), ctypes.c_uint32(size))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def erase_images(self, images):
+        '''
+        Erase the flash pages touched by several images, sent as few page lists as possible.
+
+        Args:
+            images: list,       [(addr, size), ...]
+
+        Examples:
+            init()
+            erase_images([(0x8000000, 0x9000), (0x8040000, 0x800)])
+
+        '''
+        self.flush_writes()
+        count = len(images)
+        addr = (ctypes.c_uint32 * count)(*[image[0] for image in images])
+        size = (ctypes.c_uint32 * count)(*[image[1] for image in images])
+        state = self.clib.erase_images(self._stm32, addr, size, ctypes.c_uint32(count))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
     def program_only(self, file, md5, addr, file_offset=0):
         '''
         Program file datas to chip.
@@ -154,11 +253,12 @@ class SPIBootLoaderFWDL(object):
             md5 = "20eb868d5d3df4be0e3f1d68342d31a8"
 
             init()
-            mass_erase()
+            erase_image(base_addr, os.path.getsize(file))
             program_only(file, md5, base_addr)
             verify(file, md5, base_addr)
 
         '''
+        self.flush_writes()
         if (not os.path.exists(file)):
             raise NameError('FW file not found')
 
@@ -184,6 +284,52 @@ class SPIBootLoaderFWDL(object):
 
         return 'done'
 
+    def program_diff(self, file, md5, addr, file_offset=0):
+        '''
+        Program only the flash pages that differ from the file, no mass erase needed.
+        Every page of the range is read back, changed pages are erased and written again.
+
+        Args:
+            file:   string,     file path.
+            md5:    string,     file md5sum
+            addr:   int,        chip memory addr
+            file_offset:    int,    file data offset to program, default=0
+
+        Returns:
+            dict, {'pages_unchanged': int, 'pages_rewritten': int}
+
+        Examples:
+            init()
+            program_diff(file, md5, 0x8000000)
+            verify(file, md5, 0x8000000)
+
+        '''
+        self.flush_writes()
+        if (not os.path.exists(file)):
+            raise NameError('FW file not found')
+
+        if (md5.lower().startswith("0x")):
+            md5 = md5[2:]
+
+        if (len(md5) != 32):
+            raise NameError('Error in MD5 provided')
+
+        with open(file, "rb") as f:
+            file_md5 = hashlib.md5(f.read()).hexdigest()
+
+        if (file_md5.lower() != md5.lower()):
+            raise NameError('Error, MD5 mismatched.  Programming aborted')
+
+        size = os.path.getsize(file) - file_offset
+        state = self.clib.program_diff(self._stm32,
+                                       ctypes.c_char_p(file), ctypes.c_uint32(addr),
+                                       ctypes.c_uint32(size), ctypes.c_uint32(file_offset))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+
+        result = self.program_result()
+        return {'pages_unchanged': result['pages_unchanged'], 'pages_rewritten': result['pages_rewritten']}
+
     def verify(self, file, md5, addr, file_offset=0):
         '''
         Verify file datas with chip.
@@ -200,11 +346,12 @@ class SPIBootLoaderFWDL(object):
             md5 = "20eb868d5d3df4be0e3f1d68342d31a8"
 
             init()
-            mass_erase()
+            erase_image(base_addr, os.path.getsize(file))
             program_only(file, md5, base_addr)
             verify(file, md5, base_addr)
 
         '''
+        self.flush_writes()
         if (not os.path.exists(file)):
             raise NameError('FW file not found')
 
@@ -230,6 +377,73 @@ class SPIBootLoaderFWDL(object):
 
         return 'done'
 
+    def enable_journal(self, file=None, check_boundary=True):
+        '''
+        Journal program_only in file: each 4 KB chunk is read back and recorded once verified. A failed run
+        of the same image, addr and device resumes after its last verified chunk.
+
+        Args:
+            file:           string,     journal file path, None: journal off
+            check_boundary: bool,       compare the last verified chunk before resuming, on mismatch
+                                        the image is erased and programmed from the start
+
+        Examples:
+            enable_journal('/root/fwdl.journal')
+            init()
+            erase_image(0x8000000, os.path.getsize(file))
+            program_only(file, md5, 0x8000000)      # fails at 80%
+            init()
+            program_only(file, md5, 0x8000000)      # no erase, resumes at 80%
+
+        '''
+        file_name = None if file is None else ctypes.c_char_p(bytes(file))
+        state = self.clib.enable_journal(self._stm32, file_name, ctypes.c_bool(check_boundary))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def set_verify_mode(self, mode):
+        '''
+        Select how verify compares the chip with the file.
+
+        Args:
+            mode:   int, [0~1]  SPIBootLoaderFWDLDef.VERIFY_READBACK: read back every byte,
+                                VERIFY_CHECKSUM: one chip CRC (Get Checksum command) per 64 KB,
+                                readback when the bootloader has no Get Checksum command
+
+        Examples:
+            set_verify_mode(SPIBootLoaderFWDLDef.VERIFY_CHECKSUM)
+            verify(file, md5, 0x8000000)
+
+        '''
+        state = self.clib.set_verify_mode(self._stm32, ctypes.c_uint32(mode))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def get_checksum(self, addr, size):
+        '''
+        CRC of chip memory by the Get Checksum command, in the STM32 CRC unit reset configuration:
+        polynomial 0x04C11DB7, init 0xFFFFFFFF, 32-bit words.
+
+        Args:
+            addr:   int,        chip memory addr, multiple of 4
+            size:   int,        bytes, multiple of 4
+
+        Returns:
+            int, CRC
+
+        Examples:
+            get_checksum(0x8000000, 0x10000)
+
+        '''
+        self.flush_writes()
+        crc = ctypes.c_uint32(0)
+        state = self.clib.get_checksum(self._stm32, ctypes.c_uint32(addr), ctypes.c_uint32(size), ctypes.byref(crc))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return crc.value
+
     def dump(self, file, addr, size):
         '''
         Dump chip datas to file.
@@ -247,11 +461,54 @@ class SPIBootLoaderFWDL(object):
             dump(file, base_addr, os.path.getsize(file))
 
         '''
+        self.flush_writes()
         state = self.clib.dump(self._stm32, ctypes.c_char_p(file), ctypes.c_uint32(addr), ctypes.c_uint32(size))
         if state < 0:
             raise SPIBootLoaderFWDLException(self._get_state_message(state))
         return 'done'
 
+    def set_dump_format(self, format):
+        '''
+        Select the file dump writes.
+
+        Args:
+            format: int, [0~1]  SPIBootLoaderFWDLDef.DUMP_RAW: every byte, file + '.readback',
+                                DUMP_SPARSE: the 256 Bytes blocks holding a byte other than 0xFF, with a
+                                segment table and their hashes, file + '.sparse'
+
+        Examples:
+            set_dump_format(SPIBootLoaderFWDLDef.DUMP_SPARSE)
+            dump(file, 0x8000000, 0x80000)
+
+        '''
+        state = self.clib.set_dump_format(self._stm32, ctypes.c_uint32(format))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def restore_sparse(self, file):
+        '''
+        Program the segments of a sparse dump at their addresses, the hash of each one is checked first.
+        The blank space is not written: erase the range of the dump first.
+
+        Args:
+            file:   string,     sparse dump file path
+
+        Examples:
+            init()
+            erase_image(0x8000000, 0x80000)
+            restore_sparse(file + '.sparse')
+
+        '''
+        self.flush_writes()
+        if (not os.path.exists(file)):
+            raise NameError('Sparse dump file not found')
+
+        state = self.clib.restore_sparse(self._stm32, ctypes.c_char_p(file))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
     def read(self, addr, size):
         '''
         Read memory.
@@ -266,7 +523,11 @@ class SPIBootLoaderFWDL(object):
 
         '''
         data = (ctypes.c_ubyte * size)()
-        state = self.clib.read_memory(self._stm32, ctypes.c_uint32(addr), data, ctypes.c_uint32(size))
+        if self._view:
+            # the pending write_combined data over the chip memory
+            state = self.clib.view_read(self._view, ctypes.c_uint32(addr), data, ctypes.c_uint32(size))
+        else:
+            state = self.clib.read_memory(self._stm32, ctypes.c_uint32(addr), data, ctypes.c_uint32(size))
         if state < 0:
             raise SPIBootLoaderFWDLException(self._get_state_message(state))
         return data[:size]
@@ -284,6 +545,7 @@ class SPIBootLoaderFWDL(object):
             write(0x8000000, [1,2,3,4])
 
         '''
+        self.flush_writes()
         size = len(data)
         data_c = (ctypes.c_ubyte * size)(*data)
         state = self.clib.write_memory(self._stm32, ctypes.c_uint32(addr), data_c, ctypes.c_uint32(size))
@@ -291,6 +553,100 @@ class SPIBootLoaderFWDL(object):
             raise SPIBootLoaderFWDLException(self._get_state_message(state))
         return 'done'
 
+    def read_v(self, regions):
+        '''
+        Read many ranges in one call: nearby ranges share the bootloader read commands.
+        Pending write_combined data is flushed first.
+
+        Args:
+            regions:    list,   [(addr, size), ...] in any order
+
+        Returns:
+            list, the data of each region in the order of regions
+
+        Examples:
+            init()
+            uid, flash_size, serial = read_v([(0x1FFF7590, 12), (0x1FFF75E0, 2), (0x8007F00, 16)])
+
+        '''
+        self.flush_writes()
+        count = len(regions)
+        buffers = [(ctypes.c_ubyte * size)() for (_, size) in regions]
+        regions_c = (MemoryRegion * count)(*[MemoryRegion(addr, size, buffers[i])
+                                              for i, (addr, size) in enumerate(regions)])
+        state = self.clib.read_memory_v(self._stm32, regions_c, ctypes.c_uint32(count))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return [buffers[i][:size] for i, (_, size) in enumerate(regions)]
+
+    def write_v(self, regions):
+        '''
+        Write many ranges in one call, combined in one frame per 256 Bytes window like write_combined.
+        An overlapped byte takes the data of the later region.
+
+        Args:
+            regions:    list,   [(addr, data), ...], data a list of bytes
+
+        Examples:
+            init()
+            write_v([(0x8007F00, [1,2,3,4]), (0x8007F10, [5,6,7,8])])
+
+        '''
+        self.flush_writes()
+        count = len(regions)
+        buffers = [(ctypes.c_ubyte * len(data))(*data) for (_, data) in regions]
+        regions_c = (MemoryRegion * count)(*[MemoryRegion(addr, len(data), buffers[i])
+                                              for i, (addr, data) in enumerate(regions)])
+        state = self.clib.write_memory_v(self._stm32, regions_c, ctypes.c_uint32(count))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def write_combined(self, addr, data):
+        '''
+        Write memory through the write-combining view: the data is kept on the host, overlapping and adjacent
+        writes merge and go out in one frame per 256 Bytes window on flush_writes, close, or first thing in the
+        next method sending a command. read returns the memory with the pending data. On flash the double-words between two writes of a
+        window are programmed with their current content.
+
+        Args:
+            addr:   int,        chip memory addr
+            data:   list,       bytes to write
+
+        Examples:
+            init()
+            for i in range(20):
+                write_combined(0x8010000 + 8 * i, [1,2,3,4])
+            flush_writes()
+
+        '''
+        if not self._view:
+            self._view = self.clib.new_TargetMemoryView(self._stm32)
+            if self._view == 0:
+                raise Exception("Open memory view failure.")
+        size = len(data)
+        data_c = (ctypes.c_ubyte * size)(*data)
+        state = self.clib.view_write(self._view, ctypes.c_uint32(addr), data_c, ctypes.c_uint32(size))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def flush_writes(self):
+        '''
+        Send the pending write_combined data to the chip.
+
+        Examples:
+            write_combined(0x8010000, [1,2,3,4])
+            flush_writes()
+
+        '''
+        if not self._view:
+            return 'done'
+        state = self.clib.view_flush(self._view)
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
     def write_protect(self, start_page, page_num):
         '''
         Write protect memory.
@@ -307,6 +663,7 @@ class SPIBootLoaderFWDL(object):
             write_protect(0, 10)
 
         '''
+        self.flush_writes()
         assert 0 <= start_page < 256
         assert 0 < page_num <= 256
 
@@ -329,6 +686,7 @@ class SPIBootLoaderFWDL(object):
             write_unprotect()
 
         '''
+        self.flush_writes()
         state = self.clib.write_unprotect_cmd(self._stm32)
         if state < 0:
             raise SPIBootLoaderFWDLException(self._get_state_message(state))
@@ -348,6 +706,7 @@ class SPIBootLoaderFWDL(object):
             readout_protect()
 
         '''
+        self.flush_writes()
         state = self.clib.readout_protect_cmd(self._stm32)
         if state < 0:
             raise SPIBootLoaderFWDLException(self._get_state_message(state))
@@ -367,6 +726,7 @@ class SPIBootLoaderFWDL(object):
             readout_unprotect()
 
         '''
+        self.flush_writes()
         state = self.clib.readout_unprotect_cmd(self._stm32)
         if state < 0:
             raise SPIBootLoaderFWDLException(self._get_state_message(state))
@@ -384,11 +744,353 @@ class SPIBootLoaderFWDL(object):
             go(0x8000000)
 
         '''
+        self.flush_writes()
         state = self.clib.go_cmd(self._stm32, ctypes.c_uint32(addr))
         if state < 0:
             raise SPIBootLoaderFWDLException(self._get_state_message(state))
         return 'done'
 
+    def set_wait_model(self, kind, base_us, unit_us, sleep_percent):
+        '''
+        Tune the ACK wait of a long operation: busy = base_us + units * unit_us,
+        sleep_percent of the busy time is slept before polling the ACK.
+
+        Args:
+            kind:           int, [0~4]      SPIBootLoaderFWDLDef.WAIT_WRITE_MEMORY (unit: double-word),
+                                            WAIT_ERASE_PAGES (unit: page), WAIT_MASS_ERASE, WAIT_PROTECTION,
+                                            WAIT_CHECKSUM (unit: KB)
+            base_us:        int,            fixed busy time in us
+            unit_us:        int,            busy time per unit in us
+            sleep_percent:  int, [0~100]    part of the busy time slept on the host
+
+        Examples:
+            set_wait_model(SPIBootLoaderFWDLDef.WAIT_ERASE_PAGES, 0, 25000, 95)
+
+        '''
+        assert 0 <= sleep_percent <= 100
+
+        state = self.clib.set_wait_model(self._stm32, ctypes.c_uint32(kind), ctypes.c_uint32(base_us),
+                                         ctypes.c_uint32(unit_us), ctypes.c_uint32(sleep_percent))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def set_write_workaround(self, workaround):
+        '''
+        Select the workaround of the AN2606 STM32L45xxx/46xxx V9.2 SPI write limitation.
+
+        Args:
+            workaround: int, [0~4]  SPIBootLoaderFWDLDef.WRITE_WA_AUTO: chosen on the first write from the
+                                    chip ID and bootloader version, WRITE_WA_NONE, WRITE_WA_DELAY (WA1),
+                                    WRITE_WA_READBACK (WA2 per frame), WRITE_WA_SECTOR_READBACK (WA2 per 4 KB chunk)
+
+        Examples:
+            set_write_workaround(SPIBootLoaderFWDLDef.WRITE_WA_SECTOR_READBACK)
+
+        '''
+        state = self.clib.set_write_workaround(self._stm32, ctypes.c_uint32(workaround))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def get_write_workaround(self):
+        '''
+        Write workaround in use, WRITE_WA_AUTO until the first write chose it.
+
+        Returns:
+            int, SPIBootLoaderFWDLDef.WRITE_WA_*
+
+        Examples:
+            get_write_workaround()
+
+        '''
+        workaround = ctypes.c_uint32(0)
+        state = self.clib.get_write_workaround(self._stm32, ctypes.byref(workaround))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return workaround.value
+
+    def set_erase_policy(self, policy):
+        '''
+        Select how erase_image and erase_images clear the flash of the images.
+
+        Args:
+            policy: int, [0~1]  SPIBootLoaderFWDLDef.ERASE_POLICY_PAGES: only the pages touched by the images,
+                                ERASE_POLICY_FASTEST: a bank or global mass erase when estimated faster,
+                                the flash outside the images may be blanked
+
+        Examples:
+            set_erase_policy(SPIBootLoaderFWDLDef.ERASE_POLICY_FASTEST)
+            erase_image(0x8000000, os.path.getsize(file))
+
+        '''
+        state = self.clib.set_erase_policy(self._stm32, ctypes.c_uint32(policy))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def get_erase_policy(self):
+        '''
+        Erase policy of erase_image and erase_images.
+
+        Returns:
+            int, SPIBootLoaderFWDLDef.ERASE_POLICY_*
+
+        Examples:
+            get_erase_policy()
+
+        '''
+        policy = ctypes.c_uint32(0)
+        state = self.clib.get_erase_policy(self._stm32, ctypes.byref(policy))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return policy.value
+
+    def set_blank_skip(self, enable):
+        '''
+        Skip the all-0xFF frames of program_only on flash erased since init, they are neither written nor read back.
+
+        Args:
+            enable: bool
+
+        Examples:
+            set_blank_skip(True)
+            init()
+            mass_erase()
+            program_only(file, md5, 0x8000000)
+            program_result()['bytes_skipped']
+
+        '''
+        state = self.clib.set_blank_skip(self._stm32, ctypes.c_bool(enable))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def set_pipeline(self, enable):
+        '''
+        Pipelined program_only: a host thread reads the image and builds the frames a few chunks ahead,
+        the SPI thread only sends them and waits for the ACKs.
+
+        Args:
+            enable: bool
+
+        Examples:
+            set_pipeline(True)
+            program_only(file, md5, 0x8000000)
+
+        '''
+        state = self.clib.set_pipeline(self._stm32, ctypes.c_bool(enable))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def set_dump_overlap(self, enable):
+        '''
+        Overlapped dump: the SPI thread reads 64 KB chunks into a few buffers, a host thread writes them
+        to the file, a slow disk delays the bus only when every buffer is full.
+
+        Args:
+            enable: bool
+
+        Examples:
+            set_dump_overlap(True)
+            dump(file, 0x8000000, 0x80000)
+            dump_timing()
+
+        '''
+        state = self.clib.set_dump_overlap(self._stm32, ctypes.c_bool(enable))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def dump_timing(self):
+        '''
+        Times of the last dump in microseconds: reading the chip, writing the file,
+        and the time the bus waited for the file.
+
+        Returns:
+            dict, {'bus_us': int, 'disk_us': int, 'stall_us': int}
+
+        Examples:
+            dump_timing()
+
+        '''
+        bus_us = ctypes.c_uint64(0)
+        disk_us = ctypes.c_uint64(0)
+        stall_us = ctypes.c_uint64(0)
+        state = self.clib.get_dump_timing(self._stm32, ctypes.byref(bus_us), ctypes.byref(disk_us), ctypes.byref(stall_us))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return {'bus_us': bus_us.value, 'disk_us': disk_us.value, 'stall_us': stall_us.value}
+
+    def set_read_cache(self, enable):
+        '''
+        Serve read from the 256 Bytes frames read before, each frame is read whole once.
+        Write, erase, protection, go and init drop what they change. Disable to drop everything,
+        memory changed by the bootloader itself (RAM) is read stale while cached.
+
+        Args:
+            enable: bool
+
+        Examples:
+            set_read_cache(True)
+            init()
+            for addr in range(0x1FFF7590, 0x1FFF759C, 4):
+                read(addr, 4)
+            read_cache_statistics()
+
+        '''
+        state = self.clib.set_read_cache(self._stm32, ctypes.c_bool(enable))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def read_cache_statistics(self):
+        '''
+        Frame lookups of read since the object was opened.
+
+        Returns:
+            dict, {'hits': int, 'misses': int}
+
+        Examples:
+            read_cache_statistics()
+
+        '''
+        hits = ctypes.c_uint64(0)
+        misses = ctypes.c_uint64(0)
+        state = self.clib.get_read_cache_statistics(self._stm32, ctypes.byref(hits), ctypes.byref(misses))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return {'hits': hits.value, 'misses': misses.value}
+
+    def program_result(self):
+        '''
+        Counts of the last program_only or program_diff.
+
+        Returns:
+            dict, {'bytes_programmed': int, 'bytes_skipped': int, 'pages_unchanged': int, 'pages_rewritten': int}
+
+        Examples:
+            program_result()
+
+        '''
+        programmed = ctypes.c_uint64(0)
+        skipped = ctypes.c_uint64(0)
+        unchanged = ctypes.c_uint32(0)
+        rewritten = ctypes.c_uint32(0)
+        state = self.clib.get_program_result(self._stm32, ctypes.byref(programmed), ctypes.byref(skipped))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        state = self.clib.get_program_pages(self._stm32, ctypes.byref(unchanged), ctypes.byref(rewritten))
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return {'bytes_programmed': programmed.value, 'bytes_skipped': skipped.value,
+                'pages_unchanged': unchanged.value, 'pages_rewritten': rewritten.value}
+
+    def enable_ack_learning(self, file=None):
+        '''
+        Learn the busy time of the long ACK waits on this fixture, the learned time replaces the wait model.
+        The model of the part is loaded from file once get_chip_id and get_protocol_version identified it,
+        and saved by save_ack_model or on close.
+
+        Args:
+            file:   string,     model file shared by the parts of the fixture, None: learn in memory only
+
+        Examples:
+            enable_ack_learning('/root/fixture_ack_model.txt')
+            init()
+            get_protocol_version()
+            get_chip_id()
+
+        '''
+        file_name = None if file is None else ctypes.c_char_p(bytes(file))
+        state = self.clib.enable_ack_learning(self._stm32, file_name)
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def save_ack_model(self):
+        '''
+        Save the learned ACK model of the identified part to the file of enable_ack_learning.
+
+        Examples:
+            save_ack_model()
+
+        '''
+        state = self.clib.save_ack_model(self._stm32)
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
+    def ack_estimate(self, kind, units):
+        '''
+        Learned busy time of an ACK wait.
+
+        Args:
+            kind:   int, [0~4]  SPIBootLoaderFWDLDef.WAIT_WRITE_MEMORY (unit: double-word),
+                                WAIT_ERASE_PAGES (unit: page), WAIT_MASS_ERASE, WAIT_PROTECTION,
+                                WAIT_CHECKSUM (unit: KB)
+            units:  int,        double-words, pages or KB, 1 for the other kinds
+
+        Returns:
+            int, busy time in us, None while too few samples were seen.
+
+        Examples:
+            ack_estimate(SPIBootLoaderFWDLDef.WAIT_WRITE_MEMORY, 32)
+
+        '''
+        busy_us = ctypes.c_uint32(0)
+        state = self.clib.ack_estimate(self._stm32, ctypes.c_uint32(kind), ctypes.c_uint32(units),
+                                       ctypes.byref(busy_us))
+        if state == SPIBootLoaderFWDLDef.STATE_PARAM_FAULT:
+            return None
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return busy_us.value
+
+    def ack_latency(self):
+        '''
+        ACK wait time per bootloader command and outcome, from the frame to the ACK echo.
+        SYNC is the synchronization of init, commands and outcomes never seen are left out.
+
+        Returns:
+            dict, {command: {outcome: {'count', 'p50_us', 'p99_us', 'p999_us', 'max_us'}}}
+                  outcome: 'ack', 'nak' or 'timeout'.
+
+        Examples:
+            program_only(file, md5, 0x8000000)
+            ack_latency()['WMEM']['ack']['p99_us']
+
+        '''
+        latency = {}
+        count = ctypes.c_uint64(0)
+        values = [ctypes.c_uint32(0) for i in range(4)]
+        for name, command in SPIBootLoaderFWDLDef.ACK_LATENCY_COMMANDS:
+            for outcome, outcome_name in enumerate(SPIBootLoaderFWDLDef.ACK_LATENCY_OUTCOMES):
+                state = self.clib.ack_latency(self._stm32, ctypes.c_uint8(command), ctypes.c_uint32(outcome),
+                                              ctypes.byref(count), *[ctypes.byref(v) for v in values])
+                if state < 0:
+                    raise SPIBootLoaderFWDLException(self._get_state_message(state))
+                if count.value == 0:
+                    continue
+                latency.setdefault(name, {})[outcome_name] = {
+                    'count': count.value, 'p50_us': values[0].value, 'p99_us': values[1].value,
+                    'p999_us': values[2].value, 'max_us': values[3].value}
+        return latency
+
+    def reset_ack_latency(self):
+        '''
+        Clear the ACK latency histograms.
+
+        Examples:
+            reset_ack_latency()
+
+        '''
+        state = self.clib.reset_ack_latency(self._stm32)
+        if state < 0:
+            raise SPIBootLoaderFWDLException(self._get_state_message(state))
+        return 'done'
+
 
 if __name__ == "__main__":
     import time
@@ -422,7 +1124,7 @@ if __name__ == "__main__":
     md5 = "20eb868d5d3df4be0e3f1d68342d31a8"
 
     t_start = time.time()
-    ret = sbl_fwdl.mass_erase()
+    ret = sbl_fwdl.erase_image(base_addr, os.path.getsize(file))
     print(ret)
     print("erase cost {} s".format(time.time() - t_start))
 
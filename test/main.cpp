@@ -117,7 +117,7 @@ int main(int argc ,char **argv){
     for (int i=1; i<=total; ++i)
     {
         start = std::chrono::steady_clock::now();
-        stat = stm32.mass_erase();
+        stat = stm32.erase_image(flash_base_addr, file_size);
         end = std::chrono::steady_clock::now();
         elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
         printf("erase cost %d ms\n", elapsed);
@@ -0,0 +1,640 @@
+/*
+ * sim_test.cpp
+ *
+ *  Regression test of the programer on Stm32BootloaderSim, no hardware needed.
+ *  Exit code 0 when every case passes.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
+
+#include "DbgrCommon.h"
+#include "stm32xxx.hpp"
+#include "stm32xxx_sim.hpp"
+
+
+using namespace std;
+
+#define TEST_FLASH_BASE     SIM_FLASH_BASE
+#define TEST_RAM_BASE       SIM_RAM_BASE
+#define TEST_IMAGE_B        (64 * 1024 + 1000)     // not a multiple of the page nor of the 4 KB chunk
+
+
+static uint32_t failures = 0;
+
+#define CHECK(cond) do{ \
+        if (! (cond)){ \
+            printf("    FAIL %s, line %d\n", #cond, __LINE__); \
+            failures++; \
+        } \
+    }while(0)
+
+
+static Stm32SimConfig_t sim_config(bool get_checksum, uint32_t dw_drop_ppm)
+{
+    Stm32SimConfig_t config = stm32_sim_default_config();
+    config.time_scale = 0;
+    config.get_checksum = get_checksum;
+    config.dw_drop_ppm = dw_drop_ppm;
+    return config;
+}
+
+
+/* STM32L47xxx: 1 MB in two banks of 512 KB */
+static Stm32SimConfig_t dual_bank_config()
+{
+    Stm32SimConfig_t config = sim_config(false, 0);
+    config.pid = 0x0415;
+    config.flash_size = 1024 * 1024;
+    config.bank_size = 512 * 1024;
+    return config;
+}
+
+
+/* the simulated part and the programer driving it, the part answers without delay */
+class SimTarget
+{
+public:
+    SimTarget(bool get_checksum=false, uint32_t dw_drop_ppm=0)
+        : SimTarget(sim_config(get_checksum, dw_drop_ppm))
+    {
+    }
+    explicit SimTarget(const Stm32SimConfig_t& config)
+        : sim(new Stm32BootloaderSim(config)), stm32(sim, true)
+    {
+        this->stm32.logger->set_level(spdlog::level::off);
+        this->init_stat = this->stm32.init();
+    }
+
+    Stm32BootloaderSim* sim;
+    STM32XXX stm32;
+    DebuggerExecutingState_t init_stat;
+};
+
+
+static string temp_path(const char* name)
+{
+    return string("/tmp/sim_test_") + to_string(getpid()) + "_" + name;
+}
+
+
+static vector<uint8_t> random_data(uint32_t size, uint32_t seed)
+{
+    vector<uint8_t> data(size);
+    srand(seed);
+    for (auto& byte: data){
+        byte = rand();
+    }
+    return data;
+}
+
+
+static bool write_file(const string& file_name, const vector<uint8_t>& data)
+{
+    ofstream file(file_name, ios::binary|ios::out|ios::trunc);
+    file.write((const char*)data.data(), data.size());
+    return ! file.fail();
+}
+
+
+static vector<uint8_t> peek(SimTarget& target, uint32_t addr, uint32_t size)
+{
+    vector<uint8_t> data(size);
+    target.sim->peek(addr, data.data(), size);
+    return data;
+}
+
+
+/* CRC unit of the STM32, bit by bit */
+static uint32_t crc32_stm32_reference(uint32_t crc, const uint8_t* data, uint32_t size)
+{
+    for (uint32_t i=0; i+4<=size; i+=4)
+    {
+        crc ^= (uint32_t)data[i] | ((uint32_t)data[i+1] << 8) | ((uint32_t)data[i+2] << 16) | ((uint32_t)data[i+3] << 24);
+        for (int bit=0; bit<32; ++bit){
+            crc = (crc & 0x80000000U)? (crc << 1) ^ SE_CRC32_STM32_POLY: crc << 1;
+        }
+    }
+    return crc;
+}
+
+
+static void test_program_verify(bool pipeline)
+{
+    SimTarget target(false, 20000);
+    CHECK(DebuggerExecutingNormal == target.init_stat);
+
+    vector<uint8_t> image = random_data(TEST_IMAGE_B, 1);
+    string file = temp_path("image.bin");
+    CHECK(write_file(file, image));
+
+    target.stm32.set_pipeline(pipeline);
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_image(TEST_FLASH_BASE, image.size()));
+    CHECK(DebuggerExecutingNormal == target.stm32.program_only((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+    CHECK(peek(target, TEST_FLASH_BASE, image.size()) == image);
+    CHECK(0 == target.sim->statistics().dw_reprogrammed);
+    CHECK(DebuggerExecutingNormal == target.stm32.verify((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+
+    // one byte changed on the target must fail verify
+    uint8_t byte = image[TEST_IMAGE_B / 2] ^ 0x01;
+    target.sim->poke(TEST_FLASH_BASE + TEST_IMAGE_B / 2, &byte, 1);
+    CHECK(DebuggerExecutingProgrammingCheckoutError == target.stm32.verify((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+    remove(file.c_str());
+}
+
+
+static void test_program_sequential()
+{
+    test_program_verify(false);
+}
+
+
+static void test_program_pipelined()
+{
+    test_program_verify(true);
+}
+
+
+static void test_verify_checksum()
+{
+    SimTarget target(true);
+    CHECK(DebuggerExecutingNormal == target.init_stat);
+
+    vector<uint8_t> image = random_data(TEST_IMAGE_B, 2);
+    string file = temp_path("image.bin");
+    CHECK(write_file(file, image));
+    target.sim->poke(TEST_FLASH_BASE, image.data(), image.size());
+
+    CHECK(DebuggerExecutingNormal == target.stm32.set_verify_mode(ProgramerVerifyChecksum));
+    CHECK(DebuggerExecutingNormal == target.stm32.verify((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+    uint8_t byte = image[100] ^ 0x80;
+    target.sim->poke(TEST_FLASH_BASE + 100, &byte, 1);
+    CHECK(DebuggerExecutingProgrammingCheckoutError == target.stm32.verify((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+    remove(file.c_str());
+}
+
+
+static void test_program_diff()
+{
+    SimTarget target;
+    CHECK(DebuggerExecutingNormal == target.init_stat);
+
+    uint32_t page = target.stm32.page_size();
+    vector<uint8_t> image = random_data(TEST_IMAGE_B, 3);
+    string file = temp_path("image.bin");
+    CHECK(write_file(file, image));
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_image(TEST_FLASH_BASE, image.size()));
+    CHECK(DebuggerExecutingNormal == target.stm32.program_only((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+
+    // two pages changed, one of them the partial last page
+    image[3 * page + 17] ^= 0xff;
+    image[TEST_IMAGE_B - 1] ^= 0xff;
+    CHECK(write_file(file, image));
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.program_diff((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+    ProgramerResult_t result = target.stm32.last_result();
+    uint32_t pages = (TEST_IMAGE_B + page - 1) / page;
+    CHECK(2 == result.pages_rewritten);
+    CHECK(pages - 2 == result.pages_unchanged);
+    CHECK(2 == target.sim->statistics().pages_erased);
+    CHECK(peek(target, TEST_FLASH_BASE, image.size()) == image);
+    remove(file.c_str());
+}
+
+
+/* the journal up to the line recording verified Bytes, as left by a run that failed after them */
+static bool cut_journal(const string& journal_file, uint32_t verified)
+{
+    ifstream input(journal_file);
+    string kept, line;
+    bool found = false;
+    while (getline(input, line))
+    {
+        kept += line + "\n";
+        istringstream fields(line);
+        string uid, hash, addr;
+        uint32_t size, done;
+        if (('#' != line[0]) && (fields >> uid >> hash >> addr >> size >> done) && (done == verified)){
+            found = true;
+            break;
+        }
+    }
+    input.close();
+    ofstream output(journal_file, ios::out|ios::trunc);
+    output << kept;
+    return found && (! output.fail());
+}
+
+
+static void test_journal_resume()
+{
+    SimTarget target;
+    CHECK(DebuggerExecutingNormal == target.init_stat);
+
+    vector<uint8_t> image = random_data(TEST_IMAGE_B, 4);
+    string file = temp_path("image.bin");
+    string journal_file = temp_path("program.journal");
+    CHECK(write_file(file, image));
+    remove(journal_file.c_str());
+    CHECK(DebuggerExecutingNormal == target.stm32.enable_journal((char*)journal_file.c_str()));
+
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_image(TEST_FLASH_BASE, image.size()));
+    CHECK(DebuggerExecutingNormal == target.stm32.program_only((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+
+    // the run failed in the chunk after 16 KB: that chunk partly written, the rest still erased
+    uint32_t verified = 4 * ALIGN_SIZE_B;
+    CHECK(cut_journal(journal_file, verified));
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_image(TEST_FLASH_BASE + verified, image.size() - verified));
+    target.sim->poke(TEST_FLASH_BASE + verified, image.data() + verified, 100);
+
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.program_only((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+    // the boundary chunk read back, the verified chunks before it not written again
+    CHECK(target.sim->statistics().frames_written <= (image.size() - verified + 255) / 256);
+    CHECK(0 == target.sim->statistics().dw_reprogrammed);
+    CHECK(peek(target, TEST_FLASH_BASE, image.size()) == image);
+
+    // a finished run does not resume
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_image(TEST_FLASH_BASE, image.size()));
+    CHECK(DebuggerExecutingNormal == target.stm32.program_only((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+    CHECK(target.sim->statistics().frames_written >= (image.size() + 255) / 256);
+    CHECK(peek(target, TEST_FLASH_BASE, image.size()) == image);
+    remove(file.c_str());
+    remove(journal_file.c_str());
+}
+
+
+static void test_sparse_dump_restore()
+{
+    SimTarget target;
+    CHECK(DebuggerExecutingNormal == target.init_stat);
+
+    uint32_t size = 128 * 1024;
+    vector<uint8_t> a = random_data(1000, 5), b = random_data(300, 6), c = random_data(ALIGN_SIZE_B, 7);
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_image(TEST_FLASH_BASE, size));
+    CHECK(DebuggerExecutingNormal == target.stm32.write(TEST_FLASH_BASE + 0x100, a.data(), a.size()));
+    CHECK(DebuggerExecutingNormal == target.stm32.write(TEST_FLASH_BASE + 0x8005, b.data(), b.size()));
+    CHECK(DebuggerExecutingNormal == target.stm32.write(TEST_FLASH_BASE + size - c.size(), c.data(), c.size()));
+    vector<uint8_t> expected = peek(target, TEST_FLASH_BASE, size);
+
+    string file = temp_path("dump");
+    string sparse_file = file + ".sparse";
+    CHECK(DebuggerExecutingNormal == target.stm32.set_dump_format(ProgramerDumpSparse));
+    CHECK(DebuggerExecutingNormal == target.stm32.dump((char*)file.c_str(), TEST_FLASH_BASE, size));
+    ifstream dump_file(sparse_file, ios::binary|ios::ate);
+    CHECK(dump_file.is_open() && ((uint64_t)dump_file.tellg() < 8 * 1024));
+    dump_file.close();
+
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_image(TEST_FLASH_BASE, size));
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.restore_sparse((char*)sparse_file.c_str()));
+    CHECK(peek(target, TEST_FLASH_BASE, size) == expected);
+    CHECK(target.sim->statistics().frames_written < 32);
+    remove(sparse_file.c_str());
+}
+
+
+static void test_read_write_v()
+{
+    SimTarget target;
+    CHECK(DebuggerExecutingNormal == target.init_stat);
+
+    vector<uint8_t> ram = random_data(4096, 8);
+    target.sim->poke(TEST_RAM_BASE, ram.data(), ram.size());
+
+    // nearby, adjacent and overlapping regions, out of order
+    vector<vector<uint8_t>> buffers;
+    vector<MemoryRegion_t> regions;
+    for (uint32_t i=0; i<50; ++i){
+        buffers.emplace_back(1 + i % 9);
+    }
+    for (uint32_t i=0; i<50; ++i){
+        regions.push_back({TEST_RAM_BASE + (i * 397) % 4000, (uint32_t)buffers[i].size(), buffers[i].data()});
+    }
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.read_v(regions.data(), regions.size()));
+    for (auto& region: regions){
+        CHECK(equal(region.data, region.data + region.size, ram.begin() + (region.addr - TEST_RAM_BASE)));
+    }
+    CHECK(target.sim->statistics().commands < regions.size());
+
+    // an overlapped byte takes the data of the later region
+    vector<uint8_t> expected = ram;
+    buffers.clear();
+    regions.clear();
+    for (uint32_t i=0; i<30; ++i){
+        buffers.emplace_back(6, (uint8_t)i);
+    }
+    for (uint32_t i=0; i<30; ++i){
+        uint32_t offset = 0x800 + 4 * ((i * 7) % 30);
+        regions.push_back({TEST_RAM_BASE + offset, (uint32_t)buffers[i].size(), buffers[i].data()});
+        copy(buffers[i].begin(), buffers[i].end(), expected.begin() + offset);
+    }
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.write_v(regions.data(), regions.size()));
+    CHECK(peek(target, TEST_RAM_BASE, ram.size()) == expected);
+    CHECK(target.sim->statistics().commands < regions.size());
+}
+
+
+static void test_write_v_flash()
+{
+    SimTarget target;
+    CHECK(DebuggerExecutingNormal == target.init_stat);
+
+    // the double-word between the two regions is programmed: no frame may cover it
+    uint32_t addr = TEST_FLASH_BASE + 0x10000;
+    uint8_t middle[8] = {1, 2, 3, 4, 5, 6, 7, 8}, low[4] = {9, 9, 9, 9}, high[4] = {10, 10, 10, 10};
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_image(addr, 8 * 1024));
+    CHECK(DebuggerExecutingNormal == target.stm32.write(addr + 8, middle, sizeof(middle)));
+    MemoryRegion_t pair[] = {{addr + 0x10, sizeof(high), high}, {addr, sizeof(low), low}};
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.write_v(pair, 2));
+    CHECK(0 == target.sim->statistics().dw_reprogrammed);
+    vector<uint8_t> expected(8 * 1024, 0xff);
+    copy(low, low + 4, expected.begin());
+    copy(middle, middle + 8, expected.begin() + 8);
+    copy(high, high + 4, expected.begin() + 0x10);
+    CHECK(peek(target, addr, expected.size()) == expected);
+
+    // scattered and overlapping regions on erased flash, an overlapped byte takes the data of the later region
+    vector<vector<uint8_t>> buffers;
+    vector<MemoryRegion_t> regions;
+    srand(12);
+    for (uint32_t i=0; i<60; ++i){
+        buffers.push_back(random_data(1 + rand() % 24, 100 + i));
+    }
+    srand(13);
+    for (uint32_t i=0; i<60; ++i){
+        uint32_t offset = 0x100 + rand() % (8 * 1024 - 0x100 - 24);
+        regions.push_back({addr + offset, (uint32_t)buffers[i].size(), buffers[i].data()});
+        copy(buffers[i].begin(), buffers[i].end(), expected.begin() + offset);
+    }
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.write_v(regions.data(), regions.size()));
+    CHECK(0 == target.sim->statistics().dw_reprogrammed);
+    CHECK(0 == target.sim->statistics().naks);
+    CHECK(peek(target, addr, expected.size()) == expected);
+}
+
+
+static void test_read_cache()
+{
+    SimTarget target;
+    CHECK(DebuggerExecutingNormal == target.init_stat);
+
+    uint32_t addr = TEST_FLASH_BASE + 0x1000;
+    vector<uint8_t> low = random_data(128, 9), high = random_data(128, 10);
+    uint8_t data[256];
+    target.stm32.set_read_cache(true);
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_image(addr, 256));
+    CHECK(DebuggerExecutingNormal == target.stm32.write(addr, low.data(), low.size()));
+
+    CHECK(DebuggerExecutingNormal == target.stm32.read(addr, data, sizeof(data)));
+    ReadCacheStatistics_t before = target.stm32.read_cache_statistics();
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.read(addr, data, sizeof(data)));
+    CHECK(target.stm32.read_cache_statistics().hits > before.hits);
+    CHECK(0 == target.sim->statistics().commands);
+    CHECK(equal(low.begin(), low.end(), data));
+    CHECK(all_of(data + 128, data + 256, [](uint8_t byte){ return 0xff == byte; }));
+
+    // a write and an erase drop the cached frame
+    CHECK(DebuggerExecutingNormal == target.stm32.write(addr + 128, high.data(), high.size()));
+    CHECK(DebuggerExecutingNormal == target.stm32.read(addr, data, sizeof(data)));
+    CHECK(equal(low.begin(), low.end(), data) && equal(high.begin(), high.end(), data + 128));
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_image(addr, 256));
+    CHECK(DebuggerExecutingNormal == target.stm32.read(addr, data, sizeof(data)));
+    CHECK(all_of(data, data + 256, [](uint8_t byte){ return 0xff == byte; }));
+}
+
+
+static void test_crc32_threads()
+{
+    // the first checksum of the process on 8 threads at once: the tables are built once for all of them
+    vector<uint8_t> data = random_data(8192, 15);
+    vector<uint32_t> crc(8, 0);
+    vector<thread> threads;
+    for (uint32_t i=0; i<crc.size(); ++i){
+        threads.emplace_back([&data, &crc, i](){ crc[i] = DbgrCrc32Stm32(SE_CRC32_STM32_INIT, data.data(), data.size()); });
+    }
+    for (auto& worker: threads){
+        worker.join();
+    }
+    uint32_t expected = crc32_stm32_reference(SE_CRC32_STM32_INIT, data.data(), data.size());
+    CHECK(all_of(crc.begin(), crc.end(), [expected](uint32_t value){ return expected == value; }));
+}
+
+
+static void test_crc32()
+{
+    vector<uint8_t> data = random_data(8192 + 3, 11);
+    uint32_t sizes[] = {0, 4, 8, 60, 64, 68, 252, 256, 1020, 4096, 8192};
+    for (uint32_t offset=0; offset<4; ++offset){
+        for (uint32_t size: sizes){
+            const uint8_t* p = data.data() + offset;
+            CHECK(crc32_stm32_reference(SE_CRC32_STM32_INIT, p, size) == DbgrCrc32Stm32(SE_CRC32_STM32_INIT, p, size));
+        }
+    }
+    // chained over word aligned pieces
+    uint32_t crc = DbgrCrc32Stm32(SE_CRC32_STM32_INIT, data.data(), 1028);
+    crc = DbgrCrc32Stm32(crc, data.data() + 1028, 8192 - 1028);
+    CHECK(crc32_stm32_reference(SE_CRC32_STM32_INIT, data.data(), 8192) == crc);
+
+    // the CRC the target computes
+    SimTarget target(true);
+    CHECK(DebuggerExecutingNormal == target.init_stat);
+    target.sim->poke(TEST_FLASH_BASE, data.data(), 8192);
+    crc = 0;
+    CHECK(DebuggerExecutingNormal == target.stm32.target_checksum(TEST_FLASH_BASE, 8192, crc));
+    CHECK(crc32_stm32_reference(SE_CRC32_STM32_INIT, data.data(), 8192) == crc);
+}
+
+
+#define TEST_BANK2_BASE     (TEST_FLASH_BASE + 512 * 1024)
+
+
+/* one byte other than 0xFF at each addr, an erase of its page clears it */
+static void mark(SimTarget& target, const vector<uint32_t>& addrs)
+{
+    uint8_t byte = 0x5a;
+    for (uint32_t addr: addrs){
+        target.sim->poke(addr, &byte, 1);
+    }
+}
+
+
+static bool marked(SimTarget& target, uint32_t addr)
+{
+    return 0x5a == peek(target, addr, 1)[0];
+}
+
+
+static void test_erase_bank()
+{
+    SimTarget target(dual_bank_config());
+    CHECK(DebuggerExecutingNormal == target.init_stat);
+    CHECK(DebuggerExecutingNormal == target.stm32.set_erase_policy(Stm32ErasePolicyFastest));
+
+    // an image in bank 1, then one in bank 2: the other bank is kept
+    uint32_t addr[] = {TEST_FLASH_BASE + 0x1000, TEST_BANK2_BASE + 0x1000};
+    uint32_t size[] = {TEST_IMAGE_B, TEST_IMAGE_B};
+    uint32_t outside[] = {TEST_FLASH_BASE + 0x40000, TEST_BANK2_BASE + 0x40000};
+    for (uint32_t bank=0; bank<2; ++bank)
+    {
+        mark(target, {addr[bank], outside[0], outside[1]});
+        target.sim->reset_statistics();
+        CHECK(DebuggerExecutingNormal == target.stm32.erase_images(&addr[bank], &size[bank], 1));
+        CHECK(1 == target.sim->statistics().mass_erases);
+        CHECK(! marked(target, addr[bank]));
+        CHECK(! marked(target, outside[bank]));
+        CHECK(marked(target, outside[1 - bank]));
+    }
+}
+
+
+static void test_erase_global()
+{
+    SimTarget target(dual_bank_config());
+    CHECK(DebuggerExecutingNormal == target.init_stat);
+    CHECK(DebuggerExecutingNormal == target.stm32.set_erase_policy(Stm32ErasePolicyFastest));
+
+    // an image across the bank boundary
+    uint32_t addr = TEST_BANK2_BASE - 0x8000, size = 0x10000;
+    mark(target, {addr, TEST_BANK2_BASE, TEST_FLASH_BASE, TEST_BANK2_BASE + 0x40000});
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_images(&addr, &size, 1));
+    CHECK(1 == target.sim->statistics().mass_erases);
+    CHECK(! (marked(target, addr) || marked(target, TEST_BANK2_BASE)));
+    CHECK(! (marked(target, TEST_FLASH_BASE) || marked(target, TEST_BANK2_BASE + 0x40000)));
+
+    // two pages are erased faster one by one
+    addr = TEST_FLASH_BASE;
+    size = 1024;
+    mark(target, {TEST_FLASH_BASE, TEST_FLASH_BASE + 0x40000});
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_images(&addr, &size, 1));
+    CHECK(0 == target.sim->statistics().mass_erases);
+    CHECK(! marked(target, TEST_FLASH_BASE));
+    CHECK(marked(target, TEST_FLASH_BASE + 0x40000));
+}
+
+
+static void test_erase_fastest_keeps_pages()
+{
+    // program_diff and the journal resume erase the exact pages under Stm32ErasePolicyFastest
+    SimTarget target(dual_bank_config());
+    CHECK(DebuggerExecutingNormal == target.init_stat);
+    CHECK(DebuggerExecutingNormal == target.stm32.set_erase_policy(Stm32ErasePolicyFastest));
+
+    uint32_t page = target.stm32.page_size();
+    uint32_t addr = TEST_FLASH_BASE, size = TEST_IMAGE_B;
+    vector<uint8_t> image = random_data(TEST_IMAGE_B, 14);
+    string file = temp_path("image.bin");
+    CHECK(write_file(file, image));
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_images(&addr, &size, 1));
+    CHECK(DebuggerExecutingNormal == target.stm32.program_only((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+    mark(target, {TEST_FLASH_BASE + 0x40000, TEST_BANK2_BASE});
+
+    for (uint32_t i=4; i<8; ++i){
+        image[i * page] ^= 0xff;
+    }
+    CHECK(write_file(file, image));
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.program_diff((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+    CHECK(0 == target.sim->statistics().mass_erases);
+    CHECK(peek(target, TEST_FLASH_BASE, image.size()) == image);
+    CHECK(marked(target, TEST_FLASH_BASE + 0x40000) && marked(target, TEST_BANK2_BASE));
+
+    string journal_file = temp_path("program.journal");
+    remove(journal_file.c_str());
+    CHECK(DebuggerExecutingNormal == target.stm32.enable_journal((char*)journal_file.c_str()));
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_images(&addr, &size, 1));
+    CHECK(DebuggerExecutingNormal == target.stm32.program_only((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+    mark(target, {TEST_FLASH_BASE + 0x40000, TEST_BANK2_BASE});
+    uint32_t verified = 4 * ALIGN_SIZE_B;
+    CHECK(cut_journal(journal_file, verified));
+    uint32_t rest_addr = TEST_FLASH_BASE + verified, rest_size = image.size() - verified;
+    CHECK(DebuggerExecutingNormal == target.stm32.erase_pages(rest_addr, (rest_size + page - 1) / page * page));
+    target.sim->reset_statistics();
+    CHECK(DebuggerExecutingNormal == target.stm32.program_only((char*)file.c_str(), TEST_FLASH_BASE, image.size()));
+    CHECK(0 == target.sim->statistics().mass_erases);
+    CHECK(peek(target, TEST_FLASH_BASE, image.size()) == image);
+    CHECK(marked(target, TEST_FLASH_BASE + 0x40000) && marked(target, TEST_BANK2_BASE));
+    remove(file.c_str());
+    remove(journal_file.c_str());
+}
+
+
+static void test_erase4k()
+{
+    // STM32G47xxx with the bank bit of its option bytes cleared: single-bank, 4 KB pages
+    Stm32SimConfig_t config = sim_config(false, 0);
+    config.pid = 0x0469;
+    config.page_size = 4 * 1024;
+    for (uint32_t single_bank=0; single_bank<2; ++single_bank)
+    {
+        SimTarget target(single_bank? config: sim_config(false, 0));
+        if (single_bank){
+            uint8_t optr[4];
+            target.sim->peek(SIM_OPTION_BYTES_BASE, optr, 4);
+            optr[2] &= ~(1 << (22 - 16));
+            target.sim->poke(SIM_OPTION_BYTES_BASE, optr, 4);
+        }
+        CHECK(DebuggerExecutingNormal == target.init_stat);
+        CHECK((single_bank? 4 * 1024U: 2 * 1024U) == target.stm32.page_size());
+
+        mark(target, {TEST_FLASH_BASE + 0xfff, TEST_FLASH_BASE + 0x1000, TEST_FLASH_BASE + 0x1fff, TEST_FLASH_BASE + 0x2000});
+        CHECK(DebuggerExecutingNormal == target.stm32.erase4k(1));
+        CHECK(marked(target, TEST_FLASH_BASE + 0xfff) && marked(target, TEST_FLASH_BASE + 0x2000));
+        CHECK(! (marked(target, TEST_FLASH_BASE + 0x1000) || marked(target, TEST_FLASH_BASE + 0x1fff)));
+    }
+}
+
+
+typedef struct{
+    const char* name;
+    void (*run)();
+}TestCase_t;
+
+static const TestCase_t test_cases[] = {
+    {"Crc32 on several threads, first in the process", test_crc32_threads},
+    {"program_only sequential, verify", test_program_sequential},
+    {"program_only pipelined, verify", test_program_pipelined},
+    {"verify by target checksum", test_verify_checksum},
+    {"program_diff", test_program_diff},
+    {"journal resume", test_journal_resume},
+    {"sparse dump and restore", test_sparse_dump_restore},
+    {"read_v and write_v", test_read_write_v},
+    {"write_v scattered on flash", test_write_v_flash},
+    {"read cache invalidation", test_read_cache},
+    {"Crc32 against the bitwise reference", test_crc32},
+    {"bank mass erase of an image in one bank", test_erase_bank},
+    {"global mass erase of an image in both banks", test_erase_global},
+    {"program_diff and journal resume keep the other pages", test_erase_fastest_keeps_pages},
+    {"erase4k on 2 KB and 4 KB pages", test_erase4k},
+};
+
+
+int main()
+{
+    spdlog::set_level(spdlog::level::off);
+
+    uint32_t failed_cases = 0;
+    for (auto& test_case: test_cases)
+    {
+        uint32_t before = failures;
+        test_case.run();
+        printf("%s %s\n", (before == failures)? "PASS": "FAIL", test_case.name);
+        failed_cases += (before == failures)? 0: 1;
+    }
+    printf("%u of %u cases failed\n", failed_cases, (uint32_t)(sizeof(test_cases) / sizeof(test_cases[0])));
+    return failed_cases? EXIT_FAILURE: EXIT_SUCCESS;
+}